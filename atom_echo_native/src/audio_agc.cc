@@ -0,0 +1,150 @@
+#include "audio_agc.h"
+#include <esp_log.h>
+#include <cmath>
+
+static int32_t db_to_q16(int db) {
+    return (int32_t)(65536.0f * powf(10.0f, db / 20.0f));
+}
+
+static int32_t dbfs_to_linear(int dbfs) {
+    return (int32_t)(32767.0f * powf(10.0f, dbfs / 20.0f));
+}
+
+// One-pole coefficient (Q15) for a time constant, evaluated once per chunk
+static int32_t smoothing_q15(int tau_ms, int chunk_ms) {
+    if (tau_ms <= 0) return 32767;
+    return (int32_t)(32767.0f * (1.0f - expf(-(float)chunk_ms / tau_ms)));
+}
+
+static uint32_t isqrt32(uint32_t v) {
+    uint32_t res = 0;
+    uint32_t bit = 1u << 30;
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= res + bit) {
+            v -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return res;
+}
+
+bool AudioAgc::Init(int sample_rate, int block_samples) {
+    if (sample_rate <= 0 || block_samples <= 0) return false;
+    sample_rate_ = sample_rate;
+    block_samples_ = block_samples;
+    TakeConfig();
+    Configure();
+    return true;
+}
+
+void AudioAgc::SetConfig(const AgcConfig& cfg) {
+    config_ = cfg;
+    slots_[write_slot_] = cfg;
+    write_slot_ = latest_.exchange(write_slot_ | kSlotNew) & ~kSlotNew;
+}
+
+// Reader side: swap in the newest published slot, if there is one
+bool AudioAgc::TakeConfig() {
+    if (!(latest_.load(std::memory_order_relaxed) & kSlotNew)) return false;
+    read_slot_ = latest_.exchange(read_slot_) & ~kSlotNew;
+    return true;
+}
+
+void AudioAgc::Configure() {
+    const AgcConfig& cfg = slots_[read_slot_];
+    int chunk_ms = block_samples_ * 1000 / sample_rate_;
+    if (chunk_ms <= 0) chunk_ms = 1;
+
+    max_gain_q16_ = db_to_q16(cfg.max_gain_db);
+    min_gain_q16_ = db_to_q16(cfg.min_gain_db);
+    attack_q15_ = smoothing_q15(cfg.attack_ms, chunk_ms);
+    release_q15_ = smoothing_q15(cfg.release_ms, chunk_ms);
+    target_rms_ = dbfs_to_linear(cfg.target_dbfs);
+    limit_ = dbfs_to_linear(cfg.limiter_dbfs);
+    gate_rms_ = dbfs_to_linear(cfg.noise_gate_dbfs);
+    Reset();
+}
+
+void AudioAgc::Reset() {
+    gain_q16_ = 65536;
+    if (gain_q16_ > max_gain_q16_) gain_q16_ = max_gain_q16_;
+    if (gain_q16_ < min_gain_q16_) gain_q16_ = min_gain_q16_;
+    stats_.gain_q16 = gain_q16_;
+}
+
+void AudioAgc::ResetStats() {
+    stats_ = AgcStats();
+    stats_.gain_q16 = gain_q16_;
+}
+
+void AudioAgc::Process(int16_t* pcm, int samples) {
+    if (samples <= 0) return;
+    if (TakeConfig()) Configure();
+
+    // Level detection: RMS and peak of the input chunk
+    int64_t sum_sq = 0;
+    int32_t peak = 0;
+    for (int i = 0; i < samples; i++) {
+        int32_t s = pcm[i];
+        sum_sq += s * s;
+        if (s < 0) s = -s;
+        if (s > peak) peak = s;
+    }
+    int32_t rms = (int32_t)isqrt32((uint32_t)(sum_sq / samples));
+
+    // Desired gain brings RMS to target; hold when below the noise gate
+    int32_t desired = gain_q16_;
+    if (rms >= gate_rms_ && rms > 0) {
+        desired = (int32_t)(((int64_t)target_rms_ << 16) / rms);
+        if (desired > max_gain_q16_) desired = max_gain_q16_;
+        if (desired < min_gain_q16_) desired = min_gain_q16_;
+    } else {
+        stats_.gated++;
+    }
+
+    int32_t coef = desired < gain_q16_ ? attack_q15_ : release_q15_;
+    int32_t target_gain = gain_q16_ + (int32_t)(((int64_t)(desired - gain_q16_) * coef) >> 15);
+
+    // Limiter: instant attack so the chunk peak never exceeds the ceiling.
+    // The ramp starts from the previous gain, so both ends are capped: any
+    // gain between them keeps peak * gain <= limit_.
+    int32_t start_gain = gain_q16_;
+    if (peak > 0) {
+        int32_t cap = (int32_t)(((int64_t)limit_ << 16) / peak);
+        if (start_gain > cap || target_gain > cap) {
+            if (start_gain > cap) start_gain = cap;
+            if (target_gain > cap) target_gain = cap;
+            stats_.limited++;
+        }
+    }
+
+    // Ramp gain across the chunk; saturate as a final safety net
+    int32_t g = start_gain;
+    int32_t step = (target_gain - start_gain) / samples;
+    for (int i = 0; i < samples; i++) {
+        g += step;
+        int32_t y = (int32_t)(((int64_t)pcm[i] * g) >> 16);
+        if (y > limit_) y = limit_;
+        else if (y < -limit_) y = -limit_;
+        pcm[i] = (int16_t)y;
+    }
+    gain_q16_ = target_gain;
+
+    stats_.frames++;
+    stats_.gain_q16 = gain_q16_;
+    stats_.rms = (uint16_t)rms;
+    if (peak > stats_.peak) stats_.peak = (uint16_t)peak;
+}
+
+void AudioAgc::LogStats(const char* tag) const {
+    if (stats_.frames == 0) return;
+    float gain_db = 20.0f * log10f(stats_.gain_q16 / 65536.0f);
+    float rms_db = stats_.rms > 0 ? 20.0f * log10f(stats_.rms / 32767.0f) : -96.0f;
+    float peak_db = stats_.peak > 0 ? 20.0f * log10f(stats_.peak / 32767.0f) : -96.0f;
+    ESP_LOGI(tag, "AGC: frames=%lu gain=%.1fdB rms=%.1fdBFS peak=%.1fdBFS limited=%lu gated=%lu",
+             stats_.frames, gain_db, rms_db, peak_db, stats_.limited, stats_.gated);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "audio_stage.h"
+
+// Fixed-point automatic gain control with a peak limiter.
+// Runs in-place on 10ms PCM chunks; gain is tracked in Q16 and
+// interpolated across each chunk to avoid zipper noise.
+struct AgcConfig {
+    int target_dbfs = -18;      // Target RMS level
+    int max_gain_db = 24;       // Gain ceiling (quiet / distant speaker)
+    int min_gain_db = -12;      // Gain floor (close speaker)
+    int attack_ms = 20;         // Time constant when gain must drop
+    int release_ms = 400;       // Time constant when gain may rise
+    int limiter_dbfs = -1;      // Output peak ceiling
+    int noise_gate_dbfs = -55;  // Below this RMS, hold gain (don't boost noise)
+};
+
+struct AgcStats {
+    uint32_t frames = 0;        // Chunks processed
+    uint32_t limited = 0;       // Chunks where the limiter cut gain
+    uint32_t gated = 0;         // Chunks held by the noise gate
+    int32_t gain_q16 = 0;       // Current gain (Q16, 65536 = 0dB)
+    uint16_t rms = 0;           // Last chunk input RMS (linear, 0..32767)
+    uint16_t peak = 0;          // Input peak since last ResetStats()
+};
+
+class AudioAgc : public AudioStage {
+public:
+    AudioAgc() = default;
+
+    const char* name() const override { return "agc"; }
+    bool Init(int sample_rate, int block_samples) override;
+    void Process(int16_t* pcm, int samples) override;
+    void Reset() override;
+
+    // Called from one control task (with config()); applied before the next
+    // block. Never blocks and never waits for Process.
+    void SetConfig(const AgcConfig& cfg);
+    const AgcConfig& config() const { return config_; }
+    const AgcStats& stats() const { return stats_; }
+    void ResetStats();
+    // Log level statistics for tuning
+    void LogStats(const char* tag) const;
+
+private:
+    static constexpr int kSlotNew = 4;  // Flag on latest_: not yet taken by Process
+
+    bool TakeConfig();
+    void Configure();
+
+    // SetConfig publishes through a triple buffer: the writer fills the slot
+    // it owns and swaps it into latest_; Process swaps latest_ with the slot
+    // it last read, once per block. Neither side touches a slot the other
+    // holds, so a block never sees half of one config and half of the next.
+    AgcConfig config_;                 // Last SetConfig() value, writer side
+    AgcConfig slots_[3];
+    int write_slot_ = 0;               // Owned by SetConfig
+    int read_slot_ = 1;                // Owned by Process
+    std::atomic<int> latest_{2};
+    AgcStats stats_;
+    int sample_rate_ = 0;
+    int block_samples_ = 0;
+
+    int32_t gain_q16_ = 65536;
+    int32_t max_gain_q16_ = 65536;
+    int32_t min_gain_q16_ = 65536;
+    int32_t attack_q15_ = 32767;   // Per-chunk smoothing coefficients
+    int32_t release_q15_ = 32767;
+    int32_t target_rms_ = 4125;
+    int32_t limit_ = 32767;
+    int32_t gate_rms_ = 0;
+};
@@ -0,0 +1,298 @@
+#include "audio_bench.h"
+#include "audio_service.h"
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_cpu.h>
+#include <esp_pm.h>
+#include <sdkconfig.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_audio_enc.h"
+#include "esp_audio_dec.h"
+#include "esp_opus_enc.h"
+#include "esp_opus_dec.h"
+
+#define TAG "AudioBench"
+
+#ifndef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 240
+#endif
+
+// Same budget as the real codec task, so an overflow here means one there
+#define BENCH_STACK_SIZE AUDIO_CODEC_STACK_SIZE
+
+enum BenchKernel {
+    KERNEL_OPUS_ENC,
+    KERNEL_OPUS_DEC,
+    KERNEL_RESAMPLE,
+    KERNEL_PCM_COPY,
+};
+
+struct BenchJob {
+    BenchKernel kernel;
+    int complexity;
+    int iterations;
+    int codec_sr;
+    int decode_sr;
+    const int16_t* canned;        // BENCH_CANNED_FRAMES Opus frames @ 16kHz
+    const int16_t* canned_codec;  // Same content at the codec rate
+    BenchResult* result;
+    SemaphoreHandle_t done;       // Given by the task once it no longer touches the job
+};
+
+// Not the caller's task notification: the main task's is also given by the
+// button ISR and by wake_main_loop(), and waking early would hand the stack
+// holding the job to the next kernel while the task still writes to it
+static StaticSemaphore_t done_buf;
+
+// Deterministic stand-in for voiced speech: 140Hz harmonic stack under a
+// 4Hz syllable envelope, plus low-level noise so the encoder can't coast
+static void make_canned(int16_t* pcm, int samples, int sample_rate) {
+    uint32_t lcg = 12345;
+    for (int i = 0; i < samples; i++) {
+        float t = (float)i / sample_rate;
+        float env = 0.5f + 0.5f * sinf(2.0f * (float)M_PI * 4.0f * t);
+        float v = 0.0f;
+        for (int h = 1; h <= 8; h++) {
+            v += sinf(2.0f * (float)M_PI * 140.0f * h * t) / h;
+        }
+        lcg = lcg * 1664525u + 1013904223u;
+        int noise = (int)((lcg >> 16) & 0x3ff) - 512;
+        pcm[i] = (int16_t)(4000.0f * env * v + noise);
+    }
+}
+
+static void add_cycles(BenchResult* r, uint32_t cycles, uint64_t* total) {
+    if (r->iterations == 0 || cycles < r->cycles_min) r->cycles_min = cycles;
+    if (cycles > r->cycles_max) r->cycles_max = cycles;
+    *total += cycles;
+    r->iterations++;
+}
+
+static void* open_encoder(int complexity) {
+    esp_opus_enc_config_t cfg = ESP_OPUS_ENC_CONFIG_DEFAULT();
+    cfg.sample_rate = OPUS_ENCODE_SAMPLE_RATE;
+    cfg.channel = 1;
+    cfg.bitrate = 24000;
+    cfg.complexity = complexity;
+    cfg.frame_duration = ESP_OPUS_ENC_FRAME_DURATION_60_MS;
+    void* enc = nullptr;
+    if (esp_opus_enc_open(&cfg, sizeof(cfg), &enc) != ESP_AUDIO_ERR_OK) return nullptr;
+    return enc;
+}
+
+static bool encode_frame(void* enc, const int16_t* pcm, uint8_t* out, int* out_len) {
+    esp_audio_enc_in_frame_t in = {
+        .buffer = (uint8_t*)pcm,
+        .len = (uint32_t)(OPUS_FRAME_SAMPLES * sizeof(int16_t)),
+    };
+    esp_audio_enc_out_frame_t o = {
+        .buffer = out,
+        .len = OPUS_ENC_OUTBUF_SIZE,
+        .encoded_bytes = 0,
+        .pts = 0,
+    };
+    if (esp_opus_enc_process(enc, &in, &o) != ESP_AUDIO_ERR_OK) return false;
+    *out_len = (int)o.encoded_bytes;
+    return true;
+}
+
+static bool bench_encode(const BenchJob& job, uint64_t* total) {
+    BenchResult* r = job.result;
+    void* enc = open_encoder(job.complexity);
+    auto* out = (uint8_t*)malloc(OPUS_ENC_OUTBUF_SIZE);
+    bool ok = enc && out;
+    int64_t bytes = 0;
+    for (int i = 0; ok && i < job.iterations; i++) {
+        const int16_t* pcm = job.canned + (i % BENCH_CANNED_FRAMES) * OPUS_FRAME_SAMPLES;
+        int len = 0;
+        uint32_t t0 = esp_cpu_get_cycle_count();
+        ok = encode_frame(enc, pcm, out, &len);
+        add_cycles(r, esp_cpu_get_cycle_count() - t0, total);
+        bytes += len;
+    }
+    if (r->iterations > 0) r->out_bytes = (int)(bytes / r->iterations);
+    free(out);
+    if (enc) esp_opus_enc_close(enc);
+    return ok;
+}
+
+static bool bench_decode(const BenchJob& job, uint64_t* total) {
+    BenchResult* r = job.result;
+    const int dec_samples = job.decode_sr * OPUS_FRAME_DURATION_MS / 1000;
+    if (dec_samples > OPUS_DEC_OUTBUF_SAMPLES) return false;
+
+    // Packets come from the firmware's encoder settings at the governor's starting level (complexity 0)
+    void* enc = open_encoder(0);
+    auto* enc_out = (uint8_t*)malloc(OPUS_ENC_OUTBUF_SIZE);
+    auto* packets = (uint8_t*)malloc(BENCH_CANNED_FRAMES * OPUS_MAX_PACKET_SIZE);
+    auto* pcm = (int16_t*)malloc(OPUS_DEC_OUTBUF_SAMPLES * sizeof(int16_t));
+    int lens[BENCH_CANNED_FRAMES] = {};
+    bool ok = enc && enc_out && packets && pcm;
+    for (int f = 0; ok && f < BENCH_CANNED_FRAMES; f++) {
+        ok = encode_frame(enc, job.canned + f * OPUS_FRAME_SAMPLES, enc_out, &lens[f]) &&
+             lens[f] > 0 && lens[f] <= OPUS_MAX_PACKET_SIZE;
+        if (ok) memcpy(packets + f * OPUS_MAX_PACKET_SIZE, enc_out, lens[f]);
+    }
+    if (enc) esp_opus_enc_close(enc);
+    free(enc_out);
+
+    void* dec = nullptr;
+    esp_opus_dec_cfg_t cfg = {
+        .sample_rate = (uint32_t)job.decode_sr,
+        .channel = 1,
+        .self_delimited = false,
+    };
+    if (ok && (esp_opus_dec_open(&cfg, sizeof(cfg), &dec) != ESP_AUDIO_ERR_OK || !dec)) ok = false;
+
+    for (int i = 0; ok && i < job.iterations; i++) {
+        int f = i % BENCH_CANNED_FRAMES;
+        esp_audio_dec_in_raw_t raw = {
+            .buffer = packets + f * OPUS_MAX_PACKET_SIZE,
+            .len = (uint32_t)lens[f],
+            .consumed = 0,
+        };
+        esp_audio_dec_out_frame_t out = {
+            .buffer = (uint8_t*)pcm,
+            .len = (uint32_t)(dec_samples * sizeof(int16_t)),
+            .needed_size = 0,
+            .decoded_size = 0,
+        };
+        esp_audio_dec_info_t info = {};
+        uint32_t t0 = esp_cpu_get_cycle_count();
+        ok = esp_opus_dec_decode(dec, &raw, &out, &info) == ESP_AUDIO_ERR_OK && out.decoded_size > 0;
+        add_cycles(r, esp_cpu_get_cycle_count() - t0, total);
+    }
+    if (dec) esp_opus_dec_close(dec);
+    free(packets);
+    free(pcm);
+    return ok;
+}
+
+static bool bench_resample(const BenchJob& job, uint64_t* total) {
+    const int in_samples = job.codec_sr * OPUS_FRAME_DURATION_MS / 1000;
+    int16_t* out = (int16_t*)malloc(OPUS_FRAME_SAMPLES * sizeof(int16_t));
+    if (!out) return false;
+    for (int i = 0; i < job.iterations; i++) {
+        const int16_t* in = job.canned_codec + (i % BENCH_CANNED_FRAMES) * in_samples;
+        uint32_t t0 = esp_cpu_get_cycle_count();
+        ResampleLinear(in, in_samples, out, OPUS_FRAME_SAMPLES);
+        add_cycles(job.result, esp_cpu_get_cycle_count() - t0, total);
+    }
+    free(out);
+    return true;
+}
+
+// CodecTask copies each decoded frame into a fresh playback block
+static bool bench_pcm_copy(const BenchJob& job, uint64_t* total) {
+    const size_t bytes = job.decode_sr * OPUS_FRAME_DURATION_MS / 1000 * sizeof(int16_t);
+    auto* src = (uint8_t*)malloc(bytes);
+    auto* dst = (uint8_t*)malloc(OPUS_DEC_OUTBUF_SAMPLES * sizeof(int16_t));
+    bool ok = src && dst && bytes <= OPUS_DEC_OUTBUF_SAMPLES * sizeof(int16_t);
+    if (ok) make_canned((int16_t*)src, bytes / sizeof(int16_t), job.decode_sr);
+    for (int i = 0; ok && i < job.iterations; i++) {
+        uint32_t t0 = esp_cpu_get_cycle_count();
+        memcpy(dst, src, bytes);
+        add_cycles(job.result, esp_cpu_get_cycle_count() - t0, total);
+    }
+    free(src);
+    free(dst);
+    return ok;
+}
+
+static void bench_task(void* arg) {
+    auto* job = (BenchJob*)arg;
+    BenchResult* r = job->result;
+    uint64_t total = 0;
+    switch (job->kernel) {
+        case KERNEL_OPUS_ENC: r->ok = bench_encode(*job, &total); break;
+        case KERNEL_OPUS_DEC: r->ok = bench_decode(*job, &total); break;
+        case KERNEL_RESAMPLE: r->ok = bench_resample(*job, &total); break;
+        case KERNEL_PCM_COPY: r->ok = bench_pcm_copy(*job, &total); break;
+    }
+    if (r->iterations > 0) r->cycles_avg = (uint32_t)(total / r->iterations);
+    // ESP-IDF reports the high-water mark in bytes
+    r->stack_bytes = BENCH_STACK_SIZE - (int)uxTaskGetStackHighWaterMark(NULL);
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
+}
+
+int RunAudioBench(int iterations, int codec_sample_rate, int decode_sample_rate,
+                  BenchResult* out, int max) {
+    if (iterations < 1) iterations = 1;
+    if (iterations > BENCH_MAX_ITERATIONS) iterations = BENCH_MAX_ITERATIONS;
+    const int codec_frame = codec_sample_rate * OPUS_FRAME_DURATION_MS / 1000;
+
+    auto* canned = (int16_t*)malloc(BENCH_CANNED_FRAMES * OPUS_FRAME_SAMPLES * sizeof(int16_t));
+    auto* canned_codec = (int16_t*)malloc(BENCH_CANNED_FRAMES * codec_frame * sizeof(int16_t));
+    if (!canned || !canned_codec) {
+        ESP_LOGE(TAG, "No memory for canned audio");
+        free(canned);
+        free(canned_codec);
+        return 0;
+    }
+    make_canned(canned, BENCH_CANNED_FRAMES * OPUS_FRAME_SAMPLES, OPUS_ENCODE_SAMPLE_RATE);
+    make_canned(canned_codec, BENCH_CANNED_FRAMES * codec_frame, codec_sample_rate);
+
+    // Cycle counts are clock independent, but flash wait states are not
+    esp_pm_lock_handle_t lock = nullptr;
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "bench", &lock) == ESP_OK) {
+        esp_pm_lock_acquire(lock);
+    } else {
+        lock = nullptr;
+    }
+
+    SemaphoreHandle_t done = xSemaphoreCreateBinaryStatic(&done_buf);
+    const uint32_t frame_cycles = (uint32_t)CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000 * OPUS_FRAME_DURATION_MS;
+    int n = 0;
+    for (int k = 0; k < BENCH_MAX_KERNELS && n < max; k++) {
+        BenchJob job = {};
+        job.iterations = iterations;
+        job.codec_sr = codec_sample_rate;
+        job.decode_sr = decode_sample_rate;
+        job.canned = canned;
+        job.canned_codec = canned_codec;
+        job.done = done;
+
+        BenchResult* r = &out[n];
+        *r = BenchResult();
+        if (k <= BENCH_OPUS_COMPLEXITY_MAX) {
+            job.kernel = KERNEL_OPUS_ENC;
+            job.complexity = k;
+            snprintf(r->name, sizeof(r->name), "opus_enc_c%d", k);
+        } else {
+            static const char* const names[] = {"opus_dec", "resample", "pcm_copy"};
+            int extra = k - BENCH_OPUS_COMPLEXITY_MAX - 1;
+            job.kernel = (BenchKernel)(KERNEL_OPUS_DEC + extra);
+            snprintf(r->name, sizeof(r->name), "%s", names[extra]);
+        }
+        job.result = r;
+        n++;
+
+        TaskHandle_t task = nullptr;
+        if (xTaskCreatePinnedToCore(bench_task, "bench", BENCH_STACK_SIZE, &job,
+                                    uxTaskPriorityGet(NULL), &task, xPortGetCoreID()) != pdPASS) {
+            ESP_LOGE(TAG, "%s: no memory for task", r->name);
+            continue;
+        }
+        // job lives on this stack, so wait for the task however long it takes
+        xSemaphoreTake(done, portMAX_DELAY);
+
+        uint32_t pct10 = frame_cycles ? (uint32_t)((uint64_t)r->cycles_avg * 1000 / frame_cycles) : 0;
+        ESP_LOGI(TAG, "%s: %s cycles/frame avg=%lu min=%lu max=%lu (%lu.%lu%% of %dms), stack=%d out=%dB",
+                 r->name, r->ok ? "ok" : "FAILED", r->cycles_avg, r->cycles_min, r->cycles_max,
+                 pct10 / 10, pct10 % 10, OPUS_FRAME_DURATION_MS, r->stack_bytes, r->out_bytes);
+    }
+
+    vSemaphoreDelete(done);
+    if (lock) {
+        esp_pm_lock_release(lock);
+        esp_pm_lock_delete(lock);
+    }
+    free(canned);
+    free(canned_codec);
+    return n;
+}
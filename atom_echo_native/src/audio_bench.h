@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+// On-device microbenchmark of the audio hot paths, on canned audio:
+// Opus encode at every complexity, Opus decode, the capture resampler and
+// the decoded-block copy. Cycle counts come from esp_cpu_get_cycle_count,
+// so they reflect Xtensa timing and flash/cache behaviour, not the host.
+#define BENCH_MAX_ITERATIONS  200
+#define BENCH_OPUS_COMPLEXITY_MAX 10
+#define BENCH_MAX_KERNELS     (BENCH_OPUS_COMPLEXITY_MAX + 1 + 3)
+#define BENCH_CANNED_FRAMES   4     // Distinct 60ms frames, reused cyclically
+
+struct BenchResult {
+    char name[16];            // e.g. "opus_enc_c5", "resample"
+    int iterations = 0;       // Frames processed
+    uint32_t cycles_avg = 0;  // Per 60ms frame
+    uint32_t cycles_min = 0;
+    uint32_t cycles_max = 0;
+    int stack_bytes = 0;      // Peak stack used by the kernel's task
+    int out_bytes = 0;        // Average encoded size (encode kernels only)
+    bool ok = false;
+};
+
+// Run every kernel `iterations` times at the device's rates. Blocks the
+// caller; holds the CPU at max clock. Returns the number of results written.
+int RunAudioBench(int iterations, int codec_sample_rate, int decode_sample_rate,
+                  BenchResult* out, int max);
@@ -1,5 +1,9 @@
 #include "audio_codec.h"
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
+
+#include "trace.h"
 
 #define TAG "AudioCodec"
 
@@ -11,6 +15,13 @@ void AudioCodec::SetOutputVolume(int volume) {
 void AudioCodec::EnableInput(bool enable) {
     if (enable == input_enabled_) return;
     input_enabled_ = enable;
+    if (enable) {
+        // Opening the device restarts RX DMA; drop stale bookkeeping
+        portENTER_CRITICAL(&rx_lock_);
+        rx_ready_ = 0;
+        rx_overruns_seen_ = rx_overruns_;
+        portEXIT_CRITICAL(&rx_lock_);
+    }
     ESP_LOGI(TAG, "Input %s", enable ? "enabled" : "disabled");
 }
 
@@ -20,8 +31,67 @@ void AudioCodec::EnableOutput(bool enable) {
     ESP_LOGI(TAG, "Output %s", enable ? "enabled" : "disabled");
 }
 
-int AudioCodec::ReadSamples(int16_t* dest, int samples) {
-    return Read(dest, samples);
+int AudioCodec::ReadSamples(int16_t* dest, int samples, CaptureInfo* info) {
+    int got = Read(dest, samples);
+
+    portENTER_CRITICAL(&rx_lock_);
+    int ready = rx_ready_ - got;
+    if (ready < 0) ready = 0;
+    rx_ready_ = ready;
+    int64_t last_us = rx_last_us_;
+    uint32_t overruns = rx_overruns_;
+    portEXIT_CRITICAL(&rx_lock_);
+
+    if (info) {
+        // Frames still queued behind this block were captured after it
+        info->timestamp_us = input_sample_rate_ > 0
+            ? last_us - (int64_t)ready * 1000000 / input_sample_rate_
+            : last_us;
+        info->overrun = overruns != rx_overruns_seen_;
+    }
+    rx_overruns_seen_ = overruns;
+    return got;
+}
+
+bool AudioCodec::WaitForInput(int samples, TickType_t timeout) {
+    if (!rx_callbacks_) return true;  // Plain blocking reads
+    capture_task_ = xTaskGetCurrentTaskHandle();
+    while (rx_ready_ < samples) {
+        if (!input_enabled_) return false;  // Nothing more will arrive; a notify after disabling ends the wait
+        if (ulTaskNotifyTake(pdTRUE, timeout) == 0) return false;
+    }
+    return true;
+}
+
+void AudioCodec::RegisterRxCallbacks() {
+    i2s_event_callbacks_t cbs = {};
+    cbs.on_recv = OnRecv;
+    cbs.on_recv_q_ovf = OnRecvOverflow;
+    ESP_ERROR_CHECK(i2s_channel_register_event_callback(rx_handle_, &cbs, this));
+    rx_callbacks_ = true;
+}
+
+bool IRAM_ATTR AudioCodec::OnRecv(i2s_chan_handle_t handle, i2s_event_data_t* event, void* ctx) {
+    auto* self = (AudioCodec*)ctx;
+    int max_ready = self->dma_desc_num_ * self->dma_frame_num_;
+
+    portENTER_CRITICAL_ISR(&self->rx_lock_);
+    self->rx_last_us_ = esp_timer_get_time();
+    int ready = self->rx_ready_ + self->dma_frame_num_;
+    self->rx_ready_ = ready > max_ready ? max_ready : ready;
+    portEXIT_CRITICAL_ISR(&self->rx_lock_);
+    TRACE(TRACE_RX_DMA, self->rx_ready_);
+
+    BaseType_t woken = pdFALSE;
+    TaskHandle_t task = self->capture_task_;
+    if (task && self->input_enabled_) vTaskNotifyGiveFromISR(task, &woken);  // No wakeups while idle
+    return woken == pdTRUE;
+}
+
+bool IRAM_ATTR AudioCodec::OnRecvOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* ctx) {
+    auto* self = (AudioCodec*)ctx;
+    self->rx_overruns_++;
+    return false;
 }
 
 void AudioCodec::WriteSamples(const int16_t* data, int samples) {
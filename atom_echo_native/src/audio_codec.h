@@ -1,11 +1,19 @@
 #pragma once
 
 #include <driver/i2s_std.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <cstdint>
 
 #define AUDIO_CODEC_DMA_DESC_NUM 6
 #define AUDIO_CODEC_DMA_FRAME_NUM 240
 
+// Per-read capture metadata derived from the I2S RX DMA callbacks
+struct CaptureInfo {
+    int64_t timestamp_us = 0;  // esp_timer time the block's last sample was captured
+    bool overrun = false;      // RX DMA dropped data since the previous read
+};
+
 class AudioCodec {
 public:
     AudioCodec() = default;
@@ -14,8 +22,22 @@ public:
     virtual void SetOutputVolume(int volume);
     virtual void EnableInput(bool enable);
     virtual void EnableOutput(bool enable);
+    // Rebuild I2S DMA with a new depth. Returns false if the codec can't be
+    // reconfigured at runtime.
+    virtual bool SetDmaConfig(int desc_num, int frame_num) { return false; }
+
+    // Returns samples actually read (0 on error; dest is zero-filled)
+    int ReadSamples(int16_t* dest, int samples, CaptureInfo* info = nullptr);
+    // Sleep until the RX DMA has delivered `samples` unread frames. The
+    // calling task becomes the one notified from the on_recv callback.
+    // Returns true at once if the codec has no RX callbacks; false on timeout
+    // or, once woken, if input has been disabled.
+    bool WaitForInput(int samples, TickType_t timeout);
+    uint32_t rx_overruns() const { return rx_overruns_; }
 
-    int ReadSamples(int16_t* dest, int samples);
+    // Per-block cost of the codec's read/write path, for profiling
+    virtual void LogIoStats(const char* tag) {}
+    virtual void ResetIoStats() {}
     void WriteSamples(const int16_t* data, int samples);
 
     int input_sample_rate() const { return input_sample_rate_; }
@@ -23,6 +45,8 @@ public:
     int output_volume() const { return output_volume_; }
     bool input_enabled() const { return input_enabled_; }
     bool output_enabled() const { return output_enabled_; }
+    int dma_desc_num() const { return dma_desc_num_; }
+    int dma_frame_num() const { return dma_frame_num_; }
 
 protected:
     i2s_chan_handle_t tx_handle_ = nullptr;
@@ -33,7 +57,25 @@ protected:
     int input_sample_rate_ = 0;
     int output_sample_rate_ = 0;
     int output_volume_ = 70;
+    int dma_desc_num_ = AUDIO_CODEC_DMA_DESC_NUM;
+    int dma_frame_num_ = AUDIO_CODEC_DMA_FRAME_NUM;
+
+    // Hook on_recv/on_recv_q_ovf on rx_handle_; call before enabling the channel
+    void RegisterRxCallbacks();
 
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
+
+private:
+    static bool OnRecv(i2s_chan_handle_t handle, i2s_event_data_t* event, void* ctx);
+    static bool OnRecvOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* ctx);
+
+    // Written from the I2S ISR
+    portMUX_TYPE rx_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    bool rx_callbacks_ = false;
+    TaskHandle_t volatile capture_task_ = nullptr;
+    volatile int64_t rx_last_us_ = 0;    // When the newest DMA buffer completed
+    volatile int rx_ready_ = 0;          // Frames delivered but not yet read
+    volatile uint32_t rx_overruns_ = 0;
+    uint32_t rx_overruns_seen_ = 0;
 };
@@ -1,5 +1,6 @@
 #include "audio_service.h"
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <cstring>
 #include <cstdlib>
 
@@ -9,52 +10,87 @@
 #include "esp_opus_enc.h"
 #include "esp_opus_dec.h"
 
+#include "trace.h"
+#include "flight_recorder.h"
+
 #define TAG "AudioService"
 
-// Queue depths
-#define ENCODE_QUEUE_DEPTH   4
-#define DECODE_QUEUE_DEPTH   30
-#define PLAYBACK_QUEUE_DEPTH 20
-#define SEND_QUEUE_DEPTH     10
+// Queues are allocated at LATENCY_MAX_* capacity; the active LatencyProfile
+// sets the depth actually used
+#define IO_PAUSE_TIMEOUT_MS 500
+#define IO_TASK_COUNT       2   // InputTask + OutputTask
+#define CAPTURE_WAIT_MS     100 // Longest expected gap between RX DMA callbacks
+// Idle waits are event driven; these only bound how long a task sleeps
+#define INPUT_IDLE_WAIT_MS   1000
+#define CODEC_IDLE_WAIT_MS   1000
+#define OUTPUT_IDLE_WAIT_MS  100
+#define TAIL_ENQUEUE_WAIT_MS 500   // The tail waits for room in the encode queue, never dropped
+#define PLAYBACK_IDLE_MS     1000  // Release the CPU lock if nothing plays for this long
+// Playback start/stop: a short digital ramp replaces the old 30ms silence
+// lead-in, and the amp stays on across short gaps instead of toggling
+#define PLAYBACK_RAMP_MS     5     // Fade in after silence, fade out into an underrun
+#define AMP_SETTLE_MS        10    // Amp output settles this long after unmute
+#define AMP_IDLE_MUTE_MS     300   // Mute the amp after this much continuous silence
+#define PLAYBACK_TSM_GAIN_PCT 2    // Speed change per frame of queue error (clamped to ±TSM_MAX_RATE_PCT)
+#define LOOPBACK_PREROLL_MS  50    // Capture before each chirp is queued
+#define LOOPBACK_SETTLE_MS   100   // Let the room decay between runs
 
 // PCM buffer for one Opus frame (960 samples @ 16kHz = 1920 bytes)
 struct PcmBlock {
     int16_t samples[OPUS_FRAME_SAMPLES];
     int count;
+    int64_t timestamp_us;  // Capture time of the last sample (0 if unknown)
+    bool overrun;          // Samples were lost or zero-filled inside this block
+    bool last;             // End of the recording (tail frame, or count 0 if none)
 };
 
 // Larger PCM block for decoded output (may be at higher sample rate)
 struct DecodedPcmBlock {
-    int16_t samples[2880];  // max: 24kHz * 60ms = 1440 samples
+    int16_t samples[OPUS_DEC_OUTBUF_SAMPLES];  // max: 24kHz * 60ms = 1440 samples
     int count;
+    uint32_t seq;           // From the OpusPacket
+    bool probe;             // Loopback chirp: timestamp it, no fade
 };
 
-AudioService::AudioService(AudioCodec* codec) : codec_(codec) {}
+// ========== Static memory ==========
+// One AudioService per device, so its long-lived memory is file scope and
+// accounted for in AUDIO_STATIC_BYTES. Queues carry pointers to heap blocks.
+static StackType_t input_stack[AUDIO_INPUT_STACK_SIZE];
+static StackType_t output_stack[AUDIO_OUTPUT_STACK_SIZE];
+static StackType_t codec_stack[AUDIO_CODEC_STACK_SIZE];
+static StaticTask_t input_tcb, output_tcb, codec_tcb;
+
+static uint8_t encode_queue_storage[LATENCY_MAX_ENCODE_DEPTH * sizeof(PcmBlock*)];
+static uint8_t decode_queue_storage[LATENCY_MAX_DECODE_DEPTH * sizeof(OpusPacket*)];
+static uint8_t playback_queue_storage[LATENCY_MAX_PLAYBACK_DEPTH * sizeof(DecodedPcmBlock*)];
+static StaticQueue_t encode_queue_buf, decode_queue_buf, playback_queue_buf;
+
+static int16_t read_buf[AUDIO_READ_BUF_SAMPLES];     // InputTask
+static uint8_t enc_out_buf[OPUS_ENC_OUTBUF_SIZE];    // CodecTask
+static int16_t dec_out_buf[OPUS_DEC_OUTBUF_SAMPLES]; // CodecTask
+static int16_t tsm_out_buf[AUDIO_TSM_CHUNK_SAMPLES]; // OutputTask
+
+AudioService::AudioService(AudioCodec* codec)
+    : codec_(codec), profile_(&DefaultLatencyProfile()) {
+    capture_chain_.SetStage(CAPTURE_STAGE_NS, &ns_, false);
+    capture_chain_.SetStage(CAPTURE_STAGE_AGC, &agc_, true);
+}
 
 AudioService::~AudioService() {
     Stop();
 }
 
-bool AudioService::Start(int decode_sample_rate) {
+bool AudioService::OpenOpus(int decode_sample_rate) {
+    if (opus_encoder_ && opus_decoder_) return true;
     decode_sample_rate_ = decode_sample_rate;
     decode_frame_samples_ = decode_sample_rate_ * OPUS_FRAME_DURATION_MS / 1000;
+    int64_t t0 = esp_timer_get_time();
 
-    // Create Opus encoder using direct API (16kHz, mono, 60ms frames)
-    esp_opus_enc_config_t enc_cfg = ESP_OPUS_ENC_CONFIG_DEFAULT();
-    enc_cfg.sample_rate = OPUS_ENCODE_SAMPLE_RATE;
-    enc_cfg.channel = 1;
-    enc_cfg.bitrate = 24000;  // 24kbps, good for 16kHz mono voice
-    enc_cfg.complexity = 0;
-    enc_cfg.frame_duration = ESP_OPUS_ENC_FRAME_DURATION_60_MS;
-
-    ESP_LOGI(TAG, "Opus enc cfg: sr=%d ch=%d bps=%d br=%d dur=%d cx=%d cfg_sz=%d",
-             enc_cfg.sample_rate, enc_cfg.channel, enc_cfg.bits_per_sample,
-             enc_cfg.bitrate, enc_cfg.frame_duration, enc_cfg.complexity, (int)sizeof(enc_cfg));
-    esp_audio_err_t ret = esp_opus_enc_open(&enc_cfg, sizeof(enc_cfg), &opus_encoder_);
-    if (ret != ESP_AUDIO_ERR_OK || !opus_encoder_) {
-        ESP_LOGE(TAG, "Failed to create Opus encoder: %d", ret);
-        return false;
-    }
+    // Starts at complexity 0; the governor raises it once encoding has
+    // proven cheap enough
+    enc_gov_.Init(OPUS_FRAME_DURATION_MS * 1000, ENC_GOV_MAX_COMPLEXITY);
+    uplink_.Init(OPUS_FRAME_DURATION_MS * 1000, uplink_min_bps_, uplink_max_bps_);
+    if (!OpenEncoder(enc_gov_.complexity())) return false;
     int enc_in_size = 0, enc_out_size = 0;
     esp_opus_enc_get_frame_size(opus_encoder_, &enc_in_size, &enc_out_size);
     ESP_LOGI(TAG, "Opus encoder: %dHz mono, %dms, expected_in=%d expected_out=%d (our_pcm=%d)",
@@ -68,25 +104,68 @@ bool AudioService::Start(int decode_sample_rate) {
         .self_delimited = false,
     };
 
-    ret = esp_opus_dec_open(&dec_cfg, sizeof(dec_cfg), &opus_decoder_);
+    esp_audio_err_t ret = esp_opus_dec_open(&dec_cfg, sizeof(dec_cfg), &opus_decoder_);
     if (ret != ESP_AUDIO_ERR_OK || !opus_decoder_) {
         ESP_LOGE(TAG, "Failed to create Opus decoder: %d", ret);
         return false;
     }
     ESP_LOGI(TAG, "Opus decoder: %dHz mono, %dms frames", decode_sample_rate_, OPUS_FRAME_DURATION_MS);
+    ESP_LOGI(TAG, "Opus setup took %d ms", (int)((esp_timer_get_time() - t0) / 1000));
+    return true;
+}
+
+bool AudioService::OpenEncoder(int complexity) {
+    // Free the old instance first so the new one can reuse its memory
+    if (opus_encoder_) { esp_opus_enc_close(opus_encoder_); opus_encoder_ = nullptr; }
+
+    // Direct API (16kHz, mono, 60ms frames)
+    esp_opus_enc_config_t enc_cfg = ESP_OPUS_ENC_CONFIG_DEFAULT();
+    enc_cfg.sample_rate = OPUS_ENCODE_SAMPLE_RATE;
+    enc_cfg.channel = 1;
+    enc_cfg.bitrate = uplink_.bitrate();  // 24kbps on a good link; changed live after
+    enc_cfg.complexity = complexity;
+    enc_cfg.frame_duration = ESP_OPUS_ENC_FRAME_DURATION_60_MS;
 
-    // Create queues
-    encode_queue_ = xQueueCreate(ENCODE_QUEUE_DEPTH, sizeof(PcmBlock*));
-    decode_queue_ = xQueueCreate(DECODE_QUEUE_DEPTH, sizeof(OpusPacket*));
-    playback_queue_ = xQueueCreate(PLAYBACK_QUEUE_DEPTH, sizeof(DecodedPcmBlock*));
-    send_queue_ = xQueueCreate(SEND_QUEUE_DEPTH, sizeof(OpusPacket*));
+    ESP_LOGI(TAG, "Opus enc cfg: sr=%d ch=%d bps=%d br=%d dur=%d cx=%d cfg_sz=%d",
+             enc_cfg.sample_rate, enc_cfg.channel, enc_cfg.bits_per_sample,
+             enc_cfg.bitrate, enc_cfg.frame_duration, enc_cfg.complexity, (int)sizeof(enc_cfg));
+    esp_audio_err_t ret = esp_opus_enc_open(&enc_cfg, sizeof(enc_cfg), &opus_encoder_);
+    if (ret != ESP_AUDIO_ERR_OK || !opus_encoder_) {
+        ESP_LOGE(TAG, "Failed to create Opus encoder: %d", ret);
+        opus_encoder_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool AudioService::Start(int decode_sample_rate) {
+    if (!OpenOpus(decode_sample_rate)) return false;
+
+    // Create queues (static storage, cannot fail)
+    encode_queue_ = xQueueCreateStatic(LATENCY_MAX_ENCODE_DEPTH, sizeof(PcmBlock*),
+                                       encode_queue_storage, &encode_queue_buf);
+    decode_queue_ = xQueueCreateStatic(LATENCY_MAX_DECODE_DEPTH, sizeof(OpusPacket*),
+                                       decode_queue_storage, &decode_queue_buf);
+    playback_queue_ = xQueueCreateStatic(LATENCY_MAX_PLAYBACK_DEPTH, sizeof(DecodedPcmBlock*),
+                                         playback_queue_storage, &playback_queue_buf);
+
+    const LatencyProfile& profile = latency_profile();
+    codec_->SetDmaConfig(profile.dma_desc_num, profile.dma_frame_num);
+
+    // Fails with ESP_ERR_NOT_SUPPORTED when power management is disabled
+    if (!pm_cpu_lock_ && esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "audio", &pm_cpu_lock_) != ESP_OK) {
+        pm_cpu_lock_ = nullptr;
+    }
 
     running_ = true;
 
-    // Create tasks
-    xTaskCreatePinnedToCore(InputTask, "audio_in", 6144, this, 8, &input_task_, 0);
-    xTaskCreate(OutputTask, "audio_out", 6144, this, 4, &output_task_);
-    xTaskCreate(CodecTask, "opus_codec", 24576, this, 2, &codec_task_);
+    // Create tasks (static stacks and TCBs)
+    input_task_ = xTaskCreateStaticPinnedToCore(InputTask, "audio_in", AUDIO_INPUT_STACK_SIZE, this, 8,
+                                                input_stack, &input_tcb, 0);
+    output_task_ = xTaskCreateStatic(OutputTask, "audio_out", AUDIO_OUTPUT_STACK_SIZE, this, 4,
+                                     output_stack, &output_tcb);
+    codec_task_ = xTaskCreateStatic(CodecTask, "opus_codec", AUDIO_CODEC_STACK_SIZE, this, 2,
+                                    codec_stack, &codec_tcb);
 
     ESP_LOGI(TAG, "Audio service started, free heap: %lu", esp_get_free_heap_size());
     return true;
@@ -94,7 +173,9 @@ bool AudioService::Start(int decode_sample_rate) {
 
 void AudioService::Stop() {
     running_ = false;
+    if (recording_) HoldCpu(false);
     recording_ = false;
+    SetPlaybackActive(false);
 
     if (input_task_) { vTaskDelay(pdMS_TO_TICKS(100)); vTaskDelete(input_task_); input_task_ = nullptr; }
     if (output_task_) { vTaskDelete(output_task_); output_task_ = nullptr; }
@@ -104,12 +185,189 @@ void AudioService::Stop() {
     if (encode_queue_) { PcmBlock* b; while (xQueueReceive(encode_queue_, &b, 0)) free(b); vQueueDelete(encode_queue_); encode_queue_ = nullptr; }
     if (decode_queue_) { OpusPacket* p; while (xQueueReceive(decode_queue_, &p, 0)) free(p); vQueueDelete(decode_queue_); decode_queue_ = nullptr; }
     if (playback_queue_) { DecodedPcmBlock* b; while (xQueueReceive(playback_queue_, &b, 0)) free(b); vQueueDelete(playback_queue_); playback_queue_ = nullptr; }
-    if (send_queue_) { OpusPacket* p; while (xQueueReceive(send_queue_, &p, 0)) free(p); vQueueDelete(send_queue_); send_queue_ = nullptr; }
 
     if (opus_encoder_) { esp_opus_enc_close(opus_encoder_); opus_encoder_ = nullptr; }
     if (opus_decoder_) { esp_opus_dec_close(opus_decoder_); opus_decoder_ = nullptr; }
 }
 
+LatencyBudget AudioService::latency_budget() const {
+    return GetLatencyBudget(latency_profile(), codec_->output_sample_rate(), OPUS_FRAME_DURATION_MS);
+}
+
+void AudioService::HoldCpu(bool hold) {
+    if (!pm_cpu_lock_) return;
+    if (hold) esp_pm_lock_acquire(pm_cpu_lock_);
+    else esp_pm_lock_release(pm_cpu_lock_);
+}
+
+void AudioService::SetPlaybackActive(bool active) {
+    if (playback_active_.exchange(active) != active) HoldCpu(active);
+}
+
+int AudioService::DownlinkFill() const {
+    if (!decode_queue_ || !playback_queue_) return 0;
+    return (int)(uxQueueMessagesWaiting(decode_queue_) + uxQueueMessagesWaiting(playback_queue_));
+}
+
+bool AudioService::IsPlaybackIdle() const {
+    return !playback_active_ &&
+           (!decode_queue_ || uxQueueMessagesWaiting(decode_queue_) == 0) &&
+           (!playback_queue_ || uxQueueMessagesWaiting(playback_queue_) == 0);
+}
+
+void AudioService::SetOutputPowerDown(bool down) {
+    std::lock_guard<std::mutex> lock(output_power_lock_);
+    output_power_down_ = down;
+}
+
+void AudioService::EnsureOutputOpen() {
+    std::lock_guard<std::mutex> lock(output_power_lock_);
+    output_power_down_ = false;
+    codec_->EnableOutput(true);
+}
+
+// OutputTask, amp muted: close the output if low power asked for it and
+// nothing is queued. A block queued after this reopens it in OutputTask.
+void AudioService::PowerDownOutputIfRequested() {
+    if (!output_power_down_.load()) return;
+    std::lock_guard<std::mutex> lock(output_power_lock_);
+    if (!output_power_down_ || uxQueueMessagesWaiting(playback_queue_) > 0) return;
+    output_power_down_ = false;
+    codec_->EnableOutput(false);
+}
+
+bool AudioService::PauseIo() {
+    io_pause_ = true;
+    Notify(input_task_);
+    for (int waited = 0; io_parked_ < IO_TASK_COUNT; waited += 5) {
+        if (waited >= IO_PAUSE_TIMEOUT_MS) {
+            io_pause_ = false;
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    return true;
+}
+
+void AudioService::ParkIo() {
+    io_parked_++;
+    while (io_pause_ && running_) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    io_parked_--;
+}
+
+bool AudioService::SetLatencyProfile(const LatencyProfile& profile) {
+    if (profile.dma_desc_num != codec_->dma_desc_num() ||
+        profile.dma_frame_num != codec_->dma_frame_num()) {
+        if (running_ && !PauseIo()) {
+            ESP_LOGE(TAG, "Latency profile '%s': audio tasks did not pause", profile.name);
+            return false;
+        }
+        bool ok = codec_->SetDmaConfig(profile.dma_desc_num, profile.dma_frame_num);
+        if (running_) ResumeIo();
+        if (!ok) {
+            ESP_LOGW(TAG, "Codec can't change DMA at runtime, keeping %dx%d",
+                     codec_->dma_desc_num(), codec_->dma_frame_num());
+        }
+    }
+    profile_ = &profile;
+
+    LatencyBudget b = latency_budget();
+    ESP_LOGI(TAG, "Latency profile '%s': DMA %dx%d (%dms/dir), queues enc=%d dec=%d pb=%d, "
+             "credit=%d, worst-case uplink=%dms downlink=%dms",
+             profile.name, codec_->dma_desc_num(), codec_->dma_frame_num(), b.dma_ms,
+             profile.encode_queue_depth, profile.decode_queue_depth, profile.playback_queue_depth,
+             profile.credit_window, b.uplink_ms, b.downlink_ms);
+    return true;
+}
+
+// ========== Loopback latency test ==========
+LoopbackProbe* AudioService::AcquireProbe() {
+    probe_users_.fetch_add(1);
+    LoopbackProbe* probe = probe_.load();
+    if (!probe) probe_users_.fetch_sub(1);
+    return probe;
+}
+
+bool AudioService::RunLoopbackTest(int runs, LoopbackResult* result) {
+    *result = LoopbackResult();
+    if (!running_ || recording_ || !IsPlaybackIdle() || probe_.load()) {
+        ESP_LOGW(TAG, "Loopback test: audio busy");
+        return false;
+    }
+    const int sr = codec_->output_sample_rate();
+    if (codec_->input_sample_rate() != sr) {
+        ESP_LOGW(TAG, "Loopback test: input %dHz != output %dHz", codec_->input_sample_rate(), sr);
+        return false;
+    }
+    if (runs < 1) runs = 1;
+    if (runs > LOOPBACK_MAX_RUNS) runs = LOOPBACK_MAX_RUNS;
+
+    LoopbackProbe probe;
+    if (!probe.Init(sr) || probe.chirp_samples() > OPUS_DEC_OUTBUF_SAMPLES) {
+        ESP_LOGE(TAG, "Loopback test: probe buffers unavailable");
+        return false;
+    }
+
+    HoldCpu(true);
+    codec_->EnableInput(true);
+    vTaskDelay(pdMS_TO_TICKS(20));  // Let codec device finish opening
+    probe_ = &probe;
+    Notify(input_task_);
+
+    int64_t sum_us = 0;
+    result->runs = runs;
+    for (int run = 0; run < runs; run++) {
+        probe.BeginRun();
+        vTaskDelay(pdMS_TO_TICKS(LOOPBACK_PREROLL_MS));
+
+        auto* block = (DecodedPcmBlock*)malloc(sizeof(DecodedPcmBlock));
+        if (!block) break;
+        memcpy(block->samples, probe.chirp(), probe.chirp_samples() * sizeof(int16_t));
+        block->count = probe.chirp_samples();
+        block->seq = played_seq_;
+        block->probe = true;
+        if (xQueueSend(playback_queue_, &block, 0) != pdTRUE) {
+            free(block);
+            break;
+        }
+        for (int waited = 0; !probe.Full() && waited < 2 * LOOPBACK_CAPTURE_MS; waited += 10) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+
+        int ratio = 0;
+        int latency = probe.Analyze(&ratio);
+        ESP_LOGI(TAG, "Loopback run %d/%d: latency=%dus peak_ratio=%d", run + 1, runs, latency, ratio);
+        if (run == 0 || ratio < result->peak_ratio_min) result->peak_ratio_min = ratio;
+        if (latency >= 0) {
+            if (result->detected == 0 || latency < result->latency_min_us) result->latency_min_us = latency;
+            if (latency > result->latency_max_us) result->latency_max_us = latency;
+            sum_us += latency;
+            result->detected++;
+        }
+        vTaskDelay(pdMS_TO_TICKS(LOOPBACK_SETTLE_MS));
+    }
+
+    // Unpublish, then wait out any I/O task still inside the probe
+    probe_ = nullptr;
+    while (probe_users_.load() > 0) vTaskDelay(1);
+    codec_->EnableInput(false);
+    HoldCpu(false);
+
+    if (result->detected > 0) {
+        result->latency_mean_us = (int)(sum_us / result->detected);
+        result->jitter_us = result->latency_max_us - result->latency_min_us;
+    }
+    LatencyBudget b = latency_budget();
+    ESP_LOGI(TAG, "Loopback test (profile '%s', DMA %dms/dir): %d/%d detected, "
+             "latency min=%dus mean=%dus max=%dus, jitter=%dus, peak_ratio_min=%d",
+             latency_profile().name, b.dma_ms, result->detected, result->runs,
+             result->latency_min_us, result->latency_mean_us, result->latency_max_us,
+             result->jitter_us, result->peak_ratio_min);
+    return result->detected > 0;
+}
+
 // --- Pipeline stats counters (reset on each playback session) ---
 static volatile int stat_rx_frames = 0;      // Opus frames received from server
 static volatile int stat_rx_dropped = 0;     // Opus frames dropped (decode queue full)
@@ -118,72 +376,268 @@ static volatile int stat_decode_err = 0;     // Decode errors
 static volatile int stat_pb_queued = 0;      // Frames queued for playback
 static volatile int stat_pb_dropped = 0;     // Frames dropped (playback queue full)
 static volatile int stat_played = 0;         // Frames actually played
+static volatile int stat_underruns = 0;      // Playback resumed after running dry (amp still on)
+static volatile int stat_unmute_first = 0;   // Amp unmute → first sample queued to DMA (us)
+static volatile int stat_concealed = 0;      // Lost frames decoded as PLC
+static volatile int stat_rx_gap_max = 0;     // Max time between received frames (us)
+static int64_t stat_rx_last_us = 0;
 
 static void stats_reset() {
     stat_rx_frames = 0; stat_rx_dropped = 0;
     stat_decoded = 0; stat_decode_err = 0;
     stat_pb_queued = 0; stat_pb_dropped = 0;
-    stat_played = 0;
+    stat_played = 0; stat_underruns = 0;
+    stat_unmute_first = 0;
+    stat_concealed = 0; stat_rx_gap_max = 0; stat_rx_last_us = 0;
 }
 
 static void stats_print() {
-    ESP_LOGW(TAG, "STATS: rx=%d rx_drop=%d dec=%d dec_err=%d pb_q=%d pb_drop=%d played=%d",
-             stat_rx_frames, stat_rx_dropped, stat_decoded, stat_decode_err,
-             stat_pb_queued, stat_pb_dropped, stat_played);
+    ESP_LOGW(TAG, "STATS: rx=%d rx_drop=%d plc=%d dec=%d dec_err=%d pb_q=%d pb_drop=%d played=%d "
+             "underruns=%d unmute_to_first=%dus rx_gap_max=%dms",
+             stat_rx_frames, stat_rx_dropped, stat_concealed, stat_decoded, stat_decode_err,
+             stat_pb_queued, stat_pb_dropped, stat_played, stat_underruns, stat_unmute_first,
+             stat_rx_gap_max / 1000);
 }
 
-void AudioService::PushOpusForDecode(const uint8_t* data, size_t len) {
-    if (!decode_queue_ || len == 0 || len > OPUS_MAX_PACKET_SIZE) return;
+static void stats_snapshot(PlaybackStats* st) {
+    st->rx = stat_rx_frames;
+    st->concealed = stat_concealed;
+    st->dropped = stat_rx_dropped + stat_pb_dropped;
+    st->played = stat_played;
+    st->underruns = stat_underruns;
+    st->rx_gap_max_ms = stat_rx_gap_max / 1000;
+}
+
+// Linear fade in over the first `ramp` samples
+static void ramp_in(int16_t* pcm, int count, int ramp) {
+    if (ramp > count) ramp = count;
+    for (int i = 0; i < ramp; i++) {
+        pcm[i] = (int16_t)((int32_t)pcm[i] * i / ramp);
+    }
+}
+
+// Silence chunk that decays from the last played sample instead of stepping to 0
+static void ramp_out(int16_t from, int16_t* out, int count, int ramp) {
+    for (int i = 0; i < count; i++) {
+        out[i] = i < ramp ? (int16_t)((int32_t)from * (ramp - i) / ramp) : 0;
+    }
+}
+
+// --- Capture timing counters (reset on each recording) ---
+static volatile int stat_cap_blocks = 0;     // 10ms chunks read
+static volatile int stat_cap_overruns = 0;   // Chunks preceded by an RX DMA overflow
+static volatile int stat_cap_errors = 0;     // Failed/short reads (zero-filled)
+static volatile int stat_cap_timeouts = 0;   // No RX DMA callback within CAPTURE_WAIT_MS
+static volatile int stat_cap_wake_max = 0;   // Max DMA-complete → chunk-read delay (us)
+static volatile int stat_cap_jitter_max = 0; // Max deviation of chunk spacing from nominal (us)
+static volatile int stat_wake_to_record = 0; // Button edge → first captured sample (us)
+
+static void capture_stats_reset() {
+    stat_cap_blocks = 0; stat_cap_overruns = 0;
+    stat_cap_errors = 0; stat_cap_timeouts = 0;
+    stat_cap_wake_max = 0; stat_cap_jitter_max = 0;
+    stat_wake_to_record = 0;
+}
+
+static void capture_stats_print() {
+    ESP_LOGI(TAG, "CAPTURE: blocks=%d overruns=%d read_err=%d wait_timeout=%d wake_max=%dus jitter_max=%dus "
+             "wake_to_record=%dus",
+             stat_cap_blocks, stat_cap_overruns, stat_cap_errors, stat_cap_timeouts,
+             stat_cap_wake_max, stat_cap_jitter_max, stat_wake_to_record);
+}
+
+void AudioService::PushOpusForDecode(const uint8_t* data, size_t len, uint32_t seq) {
+    if (!decode_queue_ || len > OPUS_MAX_PACKET_SIZE) return;
 
     auto* pkt = (OpusPacket*)malloc(sizeof(OpusPacket));
     if (!pkt) return;
-    memcpy(pkt->data, data, len);
+    if (len) memcpy(pkt->data, data, len);
     pkt->len = len;
+    pkt->seq = seq;
 
-    if (stat_rx_frames == 0) {
+    if (stat_rx_frames == 0 && stat_concealed == 0) {
         stats_reset();  // Reset all counters on first frame of new session
     }
-    stat_rx_frames++;
-    if (xQueueSend(decode_queue_, &pkt, 0) != pdTRUE) {
+    if (len) {
+        int64_t now = esp_timer_get_time();
+        if (stat_rx_last_us && now - stat_rx_last_us > stat_rx_gap_max) {
+            stat_rx_gap_max = (int)(now - stat_rx_last_us);
+        }
+        stat_rx_last_us = now;
+        stat_rx_frames++;
+    } else {
+        stat_concealed++;
+    }
+    TRACE(TRACE_WS_RX_AUDIO, seq);
+    FLIGHT(FLIGHT_DOWNLINK, seq, DownlinkFill(), data, len);
+    SetPlaybackActive(true);
+    if ((int)uxQueueMessagesWaiting(decode_queue_) >= latency_profile().decode_queue_depth ||
+        xQueueSend(decode_queue_, &pkt, 0) != pdTRUE) {
         stat_rx_dropped++;
+        TRACE(TRACE_DEC_DROP, seq);
+        FLIGHT(FLIGHT_DROP_DECODE, seq, uxQueueMessagesWaiting(decode_queue_));
         free(pkt);
+        return;
     }
+    TRACE(TRACE_DEC_QUEUE, uxQueueMessagesWaiting(decode_queue_));
+    Notify(codec_task_);
+}
+
+bool AudioService::TakePlaybackStats(PlaybackStats* out) {
+    if (!playback_stats_ready_.exchange(false)) return false;
+    *out = last_playback_;
+    return true;
 }
 
-void AudioService::StartRecording() {
+void AudioService::StartRecording(int64_t trigger_us) {
+    if (recording_) return;
+    HoldCpu(true);
+    record_trigger_us_ = trigger_us;
+    capture_stats_reset();
+    uplink_.ResetRecordingStats();
+    codec_->ResetIoStats();
+    capture_chain_.ResetStats();
+    agc_.ResetStats();
+    ns_.ResetStats();
     codec_->EnableInput(true);
     vTaskDelay(pdMS_TO_TICKS(20));  // Let codec device finish opening
     recording_ = true;
+    Notify(input_task_);
     ESP_LOGI(TAG, "Recording started (codec input_sr=%d, encode_sr=%d)", codec_->input_sample_rate(), OPUS_ENCODE_SAMPLE_RATE);
 }
 
 void AudioService::StopRecording() {
+    if (!recording_) return;
+    record_stop_us_ = esp_timer_get_time();
     recording_ = false;
+    stop_gen_++;  // InputTask flushes the tail on this even if a Start follows at once
     codec_->EnableInput(false);
+    Notify(input_task_);  // Out of WaitForInput now rather than at its timeout
+    HoldCpu(false);
     ESP_LOGI(TAG, "Recording stopped");
+    capture_stats_print();
+    codec_->LogIoStats(TAG);
+    capture_chain_.LogStats(TAG, "capture");
+    if (noise_suppression_enabled()) ns_.LogStats(TAG);
+    if (capture_chain_.IsEnabled(CAPTURE_STAGE_AGC)) agc_.LogStats(TAG);
+}
+
+void ResampleLinear(const int16_t* in, int in_count, int16_t* out, int out_count) {
+    float ratio = (float)in_count / out_count;
+    for (int i = 0; i < out_count; i++) {
+        float src_idx = i * ratio;
+        int idx = (int)src_idx;
+        if (idx >= in_count - 1) idx = in_count - 2;
+        float frac = src_idx - idx;
+        out[i] = (int16_t)(in[idx] * (1.0f - frac) + in[idx + 1] * frac);
+    }
+}
+
+// One frame of codec-rate samples into an encode block at OPUS_ENCODE_SAMPLE_RATE
+static void FillPcmBlock(PcmBlock* block, const int16_t* in, int codec_frame) {
+    if (codec_frame == OPUS_FRAME_SAMPLES) {
+        // Same rate, just copy
+        memcpy(block->samples, in, OPUS_FRAME_SAMPLES * sizeof(int16_t));
+    } else {
+        // Simple linear downsampling (e.g., 24kHz → 16kHz)
+        ResampleLinear(in, codec_frame, block->samples, OPUS_FRAME_SAMPLES);
+    }
+    block->count = OPUS_FRAME_SAMPLES;
 }
 
 // ========== Input Task: Mic → PCM blocks ==========
 void AudioService::InputTask(void* arg) {
     auto* self = (AudioService*)arg;
+    TraceRegisterTask(TRACE_TASK_INPUT);
     // Accumulate 960 samples (60ms @ 16kHz)
     // If codec runs at 24kHz, read 1440 samples and downsample
     const int codec_sr = self->codec_->input_sample_rate();
     const int codec_frame = codec_sr * OPUS_FRAME_DURATION_MS / 1000;
     const int read_chunk = codec_sr / 100;  // 10ms chunks
 
-    auto* read_buf = (int16_t*)malloc(codec_frame * sizeof(int16_t));
+    const int64_t chunk_us = (int64_t)read_chunk * 1000000 / codec_sr;
+
+    if (codec_frame > AUDIO_READ_BUF_SAMPLES) {
+        ESP_LOGE(TAG, "InputTask: codec_sr=%d needs %d samples, buffer holds %d",
+                 codec_sr, codec_frame, AUDIO_READ_BUF_SAMPLES);
+        vTaskDelete(NULL);
+        return;
+    }
     int accumulated = 0;
+    int64_t last_chunk_us = 0;
+    bool frame_overrun = false;
+    bool first_chunk = true;
+    bool in_recording = false;  // A recording's stream is open (tail not queued yet)
+    uint32_t record_gen = 0;    // stop_gen_ when that stream began
+    self->capture_chain_.Prepare(codec_sr, read_chunk);
 
     ESP_LOGI(TAG, "InputTask started: codec_sr=%d, codec_frame=%d, read_chunk=%d", codec_sr, codec_frame, read_chunk);
 
     while (self->running_) {
+        if (self->io_pause_) {
+            self->ParkIo();
+            accumulated = 0;
+            last_chunk_us = 0;
+            continue;
+        }
+
+        // Read before recording_: a Stop that lands after this load shows up
+        // as a new generation on the next pass
+        const uint32_t stop_gen = self->stop_gen_.load();
+        if (in_recording && (!self->recording_ || stop_gen != record_gen)) {
+            // Recording over: the partial frame goes out zero-padded, marked
+            // as the end of the stream. Keyed on the stop generation too, so
+            // a Stop followed by a Start before we looked still ends it.
+            in_recording = false;
+            auto* block = (PcmBlock*)malloc(sizeof(PcmBlock));
+            if (block) {
+                block->count = 0;
+                if (accumulated > 0) {
+                    memset(read_buf + accumulated, 0, (codec_frame - accumulated) * sizeof(int16_t));
+                    FillPcmBlock(block, read_buf, codec_frame);
+                }
+                block->timestamp_us = last_chunk_us;
+                block->overrun = frame_overrun;
+                block->last = true;
+                if (xQueueSend(self->encode_queue_, &block, pdMS_TO_TICKS(TAIL_ENQUEUE_WAIT_MS)) != pdTRUE) {
+                    ESP_LOGW(TAG, "InputTask: encode queue stuck, end of stream lost");
+                    free(block);
+                } else {
+                    Notify(self->codec_task_);
+                }
+            }
+            accumulated = 0;
+            last_chunk_us = 0;
+            frame_overrun = false;
+            first_chunk = true;
+        }
+
         if (!self->recording_) {
             accumulated = 0;
-            vTaskDelay(pdMS_TO_TICKS(20));
+            last_chunk_us = 0;
+            frame_overrun = false;
+            first_chunk = true;
+            if (self->probe_.load()) {
+                // Loopback test: raw mic chunks (no capture chain) go to the probe
+                self->codec_->WaitForInput(read_chunk, pdMS_TO_TICKS(CAPTURE_WAIT_MS));
+                CaptureInfo cap;
+                int got = self->codec_->ReadSamples(read_buf, read_chunk, &cap);
+                LoopbackProbe* probe = self->AcquireProbe();  // May have ended during the read
+                if (probe) {
+                    probe->PushCapture(read_buf, read_chunk, cap.timestamp_us, cap.overrun || got < read_chunk);
+                    self->ReleaseProbe();
+                }
+                continue;
+            }
+            // StartRecording/PauseIo/RunLoopbackTest notify; the timeout only re-checks running_
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(INPUT_IDLE_WAIT_MS));
             continue;
         }
 
+        if (!in_recording) {
+            in_recording = true;
+            record_gen = stop_gen;
+        }
         static bool first_read = true;
         if (first_read) {
             ESP_LOGI(TAG, "InputTask: first ReadSamples call, chunk=%d, dev=%p, input_en=%d",
@@ -191,8 +645,49 @@ void AudioService::InputTask(void* arg) {
             first_read = false;
         }
 
-        // Read 10ms from codec
-        self->codec_->ReadSamples(read_buf + accumulated, read_chunk);
+        // Sleep until the RX DMA callback reports 10ms ready, then read it
+        bool ready = self->codec_->WaitForInput(read_chunk, pdMS_TO_TICKS(CAPTURE_WAIT_MS));
+        if (!self->recording_ || self->stop_gen_.load() != record_gen) {
+            // Stopped while we slept: the input is off, so a read would only
+            // append a zero-filled chunk to the tail. The top of the loop ends
+            // the stream.
+            continue;
+        }
+        if (!ready) stat_cap_timeouts++;
+        CaptureInfo cap;
+        int got = self->codec_->ReadSamples(read_buf + accumulated, read_chunk, &cap);
+        TRACE(TRACE_MIC_READ, got);
+        stat_cap_blocks++;
+        if (got < read_chunk) {
+            // Keep uplink timing continuous: the zero-filled chunk is still sent
+            stat_cap_errors++;
+            frame_overrun = true;
+        }
+        if (cap.overrun) {
+            stat_cap_overruns++;
+            frame_overrun = true;
+        }
+        if (cap.timestamp_us > 0) {
+            int wake = (int)(esp_timer_get_time() - cap.timestamp_us);
+            if (wake > stat_cap_wake_max) stat_cap_wake_max = wake;
+            if (last_chunk_us > 0) {
+                int jitter = (int)(cap.timestamp_us - last_chunk_us - chunk_us);
+                if (jitter < 0) jitter = -jitter;
+                if (jitter > stat_cap_jitter_max) stat_cap_jitter_max = jitter;
+            }
+            last_chunk_us = cap.timestamp_us;
+        }
+        if (first_chunk) {
+            first_chunk = false;
+            int64_t trigger = self->record_trigger_us_;
+            if (trigger > 0) {
+                int64_t end = cap.timestamp_us > 0 ? cap.timestamp_us : esp_timer_get_time();
+                stat_wake_to_record = (int)(end - chunk_us - trigger);
+                ESP_LOGI(TAG, "Wake-to-record: %d ms (button edge → first captured sample)",
+                         stat_wake_to_record / 1000);
+            }
+        }
+        self->capture_chain_.Process(read_buf + accumulated, read_chunk);
         accumulated += read_chunk;
 
         static bool first_accumulated = true;
@@ -208,86 +703,208 @@ void AudioService::InputTask(void* arg) {
             }
             auto* block = (PcmBlock*)malloc(sizeof(PcmBlock));
             if (block) {
-                if (codec_sr == OPUS_ENCODE_SAMPLE_RATE) {
-                    // Same rate, just copy
-                    memcpy(block->samples, read_buf, OPUS_FRAME_SAMPLES * sizeof(int16_t));
-                    block->count = OPUS_FRAME_SAMPLES;
-                } else {
-                    // Simple linear downsampling (e.g., 24kHz → 16kHz)
-                    float ratio = (float)codec_sr / OPUS_ENCODE_SAMPLE_RATE;
-                    for (int i = 0; i < OPUS_FRAME_SAMPLES; i++) {
-                        float src_idx = i * ratio;
-                        int idx = (int)src_idx;
-                        if (idx >= codec_frame - 1) idx = codec_frame - 2;
-                        float frac = src_idx - idx;
-                        block->samples[i] = (int16_t)(read_buf[idx] * (1.0f - frac) + read_buf[idx + 1] * frac);
-                    }
-                    block->count = OPUS_FRAME_SAMPLES;
-                }
+                FillPcmBlock(block, read_buf, codec_frame);
+                block->timestamp_us = last_chunk_us;
+                block->overrun = frame_overrun;
+                block->last = false;
 
-                if (xQueueSend(self->encode_queue_, &block, 0) != pdTRUE) {
+                if ((int)uxQueueMessagesWaiting(self->encode_queue_) >= self->latency_profile().encode_queue_depth ||
+                    xQueueSend(self->encode_queue_, &block, 0) != pdTRUE) {
+                    TRACE(TRACE_ENC_DROP, 0);
+                    FLIGHT(FLIGHT_DROP_ENCODE, 0, uxQueueMessagesWaiting(self->encode_queue_));
                     free(block);
+                } else {
+                    TRACE(TRACE_ENC_QUEUE, uxQueueMessagesWaiting(self->encode_queue_));
+                    Notify(self->codec_task_);
                 }
             }
             accumulated = 0;
+            frame_overrun = false;
         }
     }
 
-    free(read_buf);
     vTaskDelete(NULL);
 }
 
+void AudioService::WritePlayback(int16_t* pcm, int count, int fade_in) {
+    const int block = playback_chain_.block_samples();
+    for (int off = 0; off < count; off += block) {
+        int n = count - off < block ? count - off : block;
+        playback_chain_.Process(pcm + off, n);
+    }
+    if (fade_in > 0) ramp_in(pcm, count, fade_in);
+    if (count > 0) last_played_sample_ = pcm[count - 1];
+    TRACE(TRACE_SPK_WRITE_BEGIN, count);
+    codec_->WriteSamples(pcm, count);
+    TRACE(TRACE_SPK_WRITE_END, count);
+}
+
+void AudioService::PlayDecoded(int16_t* pcm, int count, int fade_in) {
+    if (!tsm_ready_ || !tsm_enabled_) {
+        FlushStretch();
+        WritePlayback(pcm, count, fade_in);
+        return;
+    }
+    // Fill = frames still waiting downstream of the network
+    int depth = DownlinkFill();
+    stretch_.SetRatePct((depth - latency_profile().playback_target_depth) * PLAYBACK_TSM_GAIN_PCT);
+
+    int n = stretch_.Process(pcm, count, tsm_out_buf, AUDIO_TSM_CHUNK_SAMPLES);
+    while (n > 0) {
+        WritePlayback(tsm_out_buf, n, fade_in);
+        fade_in = 0;
+        n = stretch_.Process(nullptr, 0, tsm_out_buf, AUDIO_TSM_CHUNK_SAMPLES);
+    }
+}
+
+void AudioService::FlushStretch() {
+    int n;
+    while ((n = stretch_.Flush(tsm_out_buf, AUDIO_TSM_CHUNK_SAMPLES)) > 0) {
+        WritePlayback(tsm_out_buf, n);
+    }
+}
+
 // ========== Output Task: PCM blocks → Speaker ==========
 // Codec output stays always-on. Muting is done via hardware amp shutdown pin
 // (~10ms) instead of esp_codec_dev_open/close (~50-100ms).
 void AudioService::OutputTask(void* arg) {
     auto* self = (AudioService*)arg;
+    TraceRegisterTask(TRACE_TASK_OUTPUT);
     bool unmuted = false;
+    bool after_silence = true;  // Next block starts from silence: fade it in
     int idle_ticks = 0;
-    // Hardware amp mute is fast (~10ms), so we only need a short idle window
-    const int MAX_IDLE_TICKS = 10;  // 10 * 10ms = 100ms
+    int muted_idle_ms = 0;
+    const int MAX_IDLE_TICKS = AMP_IDLE_MUTE_MS / 10;  // Silence is written in 10ms chunks
+    const int out_sr = self->codec_->output_sample_rate();
+    const int ramp = out_sr * PLAYBACK_RAMP_MS / 1000;
+
+    self->playback_chain_.Prepare(out_sr, out_sr / 100);
+    self->tsm_ready_ = self->stretch_.Init(out_sr);
 
     while (self->running_) {
+        if (self->io_pause_) {
+            // Codec is being rebuilt: silence the amp rather than pop
+            if (unmuted && self->on_mute_) self->on_mute_(true);
+            unmuted = false;
+            after_silence = true;
+            idle_ticks = 0;
+            self->stretch_.Reset();
+            self->ParkIo();
+            continue;
+        }
+
         DecodedPcmBlock* block = nullptr;
-        if (xQueueReceive(self->playback_queue_, &block, pdMS_TO_TICKS(10))) {
+        TickType_t wait = pdMS_TO_TICKS(unmuted ? 10 : OUTPUT_IDLE_WAIT_MS);
+        if (xQueueReceive(self->playback_queue_, &block, wait)) {
+            TRACE(TRACE_PB_DEQUEUE, uxQueueMessagesWaiting(self->playback_queue_));
+            muted_idle_ms = 0;
+            if (!self->codec_->output_enabled()) {
+                // Powered down while idle; reopen before unmuting
+                self->codec_->EnableOutput(true);
+            }
+            int64_t unmute_us = 0;
+            int lead_ms = 0;
             if (!unmuted) {
-                // Unmute amp via hardware GPIO (fast, ~10ms)
+                // Unmute amp via hardware GPIO right before the first real
+                // samples. The TX DMA (auto-clear) always has at least one
+                // descriptor of silence ahead of a write, which covers the amp
+                // settling; top up with zeros only if a descriptor is shorter.
+                unmute_us = esp_timer_get_time();
                 if (self->on_mute_) self->on_mute_(false);
+                TRACE(TRACE_AMP, 1);
                 unmuted = true;
-                // Write silence to let amp stabilize before real audio
-                int16_t lead_in[240] = {0};
-                for (int i = 0; i < 3; i++) {  // 3 * 240 samples @ 24kHz ≈ 30ms
-                    self->codec_->WriteSamples(lead_in, 240);
+                int desc_ms = self->codec_->dma_frame_num() * 1000 / out_sr;
+                lead_ms = AMP_SETTLE_MS - desc_ms;
+                if (lead_ms > 0) {
+                    int16_t lead_in[240] = {0};
+                    for (int left = out_sr * lead_ms / 1000; left > 0; left -= 240) {
+                        self->codec_->WriteSamples(lead_in, left < 240 ? left : 240);
+                    }
+                } else {
+                    lead_ms = 0;
                 }
-                ESP_LOGI(TAG, "OutputTask: amp unmuted (30ms lead-in)");
+            }
+            if (after_silence && !unmute_us && !block->probe) {
+                stat_underruns++;  // Resumed after a gap
+                TRACE(TRACE_UNDERRUN, block->seq);
+                FLIGHT(FLIGHT_UNDERRUN, block->seq, self->DownlinkFill());
             }
             idle_ticks = 0;
             stat_played++;
-            self->codec_->WriteSamples(block->samples, block->count);
+            if (block->probe) {
+                // Loopback chirp: reference time is the codec write, and
+                // fade-in or time-stretch would smear its onset
+                LoopbackProbe* probe = self->AcquireProbe();
+                if (probe) {
+                    probe->MarkPlayed(esp_timer_get_time());
+                    self->ReleaseProbe();
+                }
+                self->WritePlayback(block->samples, block->count);
+            } else {
+                self->PlayDecoded(block->samples, block->count, after_silence ? ramp : 0);
+            }
+            after_silence = false;
+            self->played_seq_ = block->seq;
             free(block);
+            if (unmute_us) {
+                stat_unmute_first = (int)(esp_timer_get_time() - unmute_us);
+                int dma_ms = self->codec_->dma_desc_num() * self->codec_->dma_frame_num() * 1000 / out_sr;
+                ESP_LOGI(TAG, "OutputTask: amp unmuted, first sample queued after %dus "
+                         "(lead-in %dms, audible within %dms)",
+                         stat_unmute_first, lead_ms, lead_ms + dma_ms);
+            }
         } else if (unmuted) {
-            // Queue empty — write silence to keep I2S DMA fed
+            // Queue empty — keep I2S DMA fed. The first chunk fades out from
+            // the last sample so an underrun or end of speech doesn't click.
             int16_t silence[240] = {0};
+            if (!after_silence) {
+                self->FlushStretch();  // Lookahead tail, then fade from its last sample
+                ramp_out(self->last_played_sample_, silence, 240, ramp);
+                after_silence = true;
+            }
             self->codec_->WriteSamples(silence, 240);
             idle_ticks++;
             if (idle_ticks >= MAX_IDLE_TICKS) {
                 // Drain any remaining frames before muting
                 DecodedPcmBlock* drain = nullptr;
+                bool drained = false;
                 while (xQueueReceive(self->playback_queue_, &drain, 0) == pdTRUE) {
                     stat_played++;
-                    self->codec_->WriteSamples(drain->samples, drain->count);
+                    self->PlayDecoded(drain->samples, drain->count, drained ? 0 : ramp);
+                    self->played_seq_ = drain->seq;
                     free(drain);
+                    drained = true;
+                }
+                if (drained) {
+                    self->FlushStretch();
+                    ramp_out(self->last_played_sample_, silence, 240, ramp);
+                    self->codec_->WriteSamples(silence, 240);
                 }
-                // Mute amp via hardware GPIO (fast, ~10ms)
+                // DMA now holds only silence: mute amp via hardware GPIO (fast, ~10ms)
                 if (self->on_mute_) self->on_mute_(true);
+                TRACE(TRACE_AMP, 0);
                 unmuted = false;
                 idle_ticks = 0;
                 stats_print();
+                stats_snapshot(&self->last_playback_);
+                self->playback_stats_ready_ = true;
                 stats_reset();
-                ESP_LOGI(TAG, "OutputTask: amp muted after 100ms idle");
+                self->playback_chain_.LogStats(TAG, "playback");
+                self->playback_chain_.ResetStats();
+                self->stretch_.LogStats(TAG);
+                self->stretch_.ResetStats();
+                self->SetPlaybackActive(false);
+                ESP_LOGI(TAG, "OutputTask: amp muted after %dms idle", AMP_IDLE_MUTE_MS);
+            }
+        } else if (self->playback_active_) {
+            // Packets arrived but nothing became playable (e.g. decode errors)
+            muted_idle_ms += OUTPUT_IDLE_WAIT_MS;
+            if (muted_idle_ms >= PLAYBACK_IDLE_MS && uxQueueMessagesWaiting(self->decode_queue_) == 0) {
+                self->SetPlaybackActive(false);
+                muted_idle_ms = 0;
             }
         } else {
-            vTaskDelay(pdMS_TO_TICKS(10));
+            self->PowerDownOutputIfRequested();
         }
     }
     if (unmuted && self->on_mute_) {
@@ -299,30 +916,23 @@ void AudioService::OutputTask(void* arg) {
 // ========== Codec Task: Opus encode + decode ==========
 void AudioService::CodecTask(void* arg) {
     auto* self = (AudioService*)arg;
-
-    // Heap-allocate large buffers to avoid stack overflow
-    auto* enc_out_buf = (uint8_t*)malloc(OPUS_ENC_OUTBUF_SIZE);
-    auto* dec_out_buf = (int16_t*)malloc(2880 * sizeof(int16_t));
-    if (!enc_out_buf || !dec_out_buf) {
-        ESP_LOGE(TAG, "CodecTask: failed to allocate buffers");
-        free(enc_out_buf);
-        free(dec_out_buf);
-        vTaskDelete(NULL);
-        return;
-    }
+    TraceRegisterTask(TRACE_TASK_CODEC);
+    uint32_t stream_frames = 0;  // Sent since the last end of stream
 
     while (self->running_) {
         bool did_work = false;
 
         // --- Decode: Opus → PCM for playback ---
+        const LatencyProfile& profile = self->latency_profile();
         OpusPacket* opus_pkt = nullptr;
-        if (uxQueueMessagesWaiting(self->playback_queue_) < PLAYBACK_QUEUE_DEPTH &&
+        if ((int)uxQueueMessagesWaiting(self->playback_queue_) < profile.playback_queue_depth &&
             xQueueReceive(self->decode_queue_, &opus_pkt, 0) == pdTRUE) {
 
             esp_audio_dec_in_raw_t raw = {
                 .buffer = opus_pkt->data,
                 .len = (uint32_t)opus_pkt->len,
                 .consumed = 0,
+                .frame_recover = opus_pkt->len ? ESP_AUDIO_DEC_RECOVERY_NONE : ESP_AUDIO_DEC_RECOVERY_PLC,
             };
             esp_audio_dec_out_frame_t out = {
                 .buffer = (uint8_t*)dec_out_buf,
@@ -332,8 +942,11 @@ void AudioService::CodecTask(void* arg) {
             };
             esp_audio_dec_info_t dec_info = {};
             // Use direct Opus decoder API
+            TRACE(TRACE_DECODE_BEGIN, opus_pkt->len);
             esp_audio_err_t ret = esp_opus_dec_decode(
                 self->opus_decoder_, &raw, &out, &dec_info);
+            TRACE(TRACE_DECODE_END, out.decoded_size / sizeof(int16_t));
+            uint32_t seq = opus_pkt->seq;
             free(opus_pkt);
 
             if (ret == ESP_AUDIO_ERR_OK && out.decoded_size > 0) {
@@ -343,11 +956,16 @@ void AudioService::CodecTask(void* arg) {
                 if (pcm) {
                     memcpy(pcm->samples, dec_out_buf, out.decoded_size);
                     pcm->count = samples;
+                    pcm->seq = seq;
+                    pcm->probe = false;
                     if (xQueueSend(self->playback_queue_, &pcm, pdMS_TO_TICKS(100)) != pdTRUE) {
                         stat_pb_dropped++;
+                        TRACE(TRACE_PB_DROP, seq);
+                        FLIGHT(FLIGHT_DROP_PLAYBACK, seq, uxQueueMessagesWaiting(self->playback_queue_));
                         free(pcm);
                     } else {
                         stat_pb_queued++;
+                        TRACE(TRACE_PB_QUEUE, uxQueueMessagesWaiting(self->playback_queue_));
                     }
                 }
             } else {
@@ -356,12 +974,13 @@ void AudioService::CodecTask(void* arg) {
             did_work = true;
         }
 
-        // --- Encode: PCM → Opus for sending ---
+        // --- Encode: PCM → Opus, sent from here through on_send_ ---
         PcmBlock* pcm_block = nullptr;
-        if (uxQueueMessagesWaiting(self->send_queue_) < SEND_QUEUE_DEPTH &&
-            xQueueReceive(self->encode_queue_, &pcm_block, 0) == pdTRUE) {
+        if (xQueueReceive(self->encode_queue_, &pcm_block, 0) == pdTRUE) {
 
             static int enc_count = 0;
+            bool last = pcm_block->last;
+            bool has_audio = pcm_block->count > 0;  // A bare end marker has none
             esp_audio_enc_in_frame_t in = {
                 .buffer = (uint8_t*)pcm_block->samples,
                 .len = (uint32_t)(pcm_block->count * sizeof(int16_t)),
@@ -372,9 +991,19 @@ void AudioService::CodecTask(void* arg) {
                 .encoded_bytes = 0,
                 .pts = 0,
             };
-            // Use direct Opus encoder API
-            esp_audio_err_t ret = esp_opus_enc_process(
-                self->opus_encoder_, &in, &out);
+            esp_audio_err_t ret = ESP_AUDIO_ERR_OK;
+            uint32_t enc_us = 0;
+            uint32_t send_us = 0;
+            if (has_audio) {
+                // Use direct Opus encoder API
+                TRACE(TRACE_ENCODE_BEGIN, pcm_block->count);
+                if (!self->opus_encoder_) self->OpenEncoder(self->enc_gov_.complexity());  // Failed reopen
+                int64_t enc_start = esp_timer_get_time();
+                ret = self->opus_encoder_
+                    ? esp_opus_enc_process(self->opus_encoder_, &in, &out) : ESP_AUDIO_ERR_FAIL;
+                enc_us = (uint32_t)(esp_timer_get_time() - enc_start);
+                TRACE(TRACE_ENCODE_END, out.encoded_bytes);
+            }
             free(pcm_block);
 
             if (ret == ESP_AUDIO_ERR_OK && out.encoded_bytes > 0) {
@@ -383,20 +1012,58 @@ void AudioService::CodecTask(void* arg) {
                              enc_count, out.encoded_bytes, self->on_send_ ? "yes" : "no");
                 }
                 // Send directly via callback (avoid extra queue)
+                int64_t send_start = esp_timer_get_time();
                 if (self->on_send_) {
                     self->on_send_(enc_out_buf, out.encoded_bytes);
+                    stream_frames++;
                 }
+                send_us = (uint32_t)(esp_timer_get_time() - send_start);
             } else if (ret != ESP_AUDIO_ERR_OK) {
                 ESP_LOGE(TAG, "Opus encode failed: %d", ret);
             }
+            int waiting = uxQueueMessagesWaiting(self->encode_queue_);
+
+            // Link slow or backed up: lower the bitrate (no reopen needed)
+            UplinkRateController& uplink = self->uplink_;
+            uplink.SetRssi(self->uplink_rssi_);
+            uplink.SetLimits(self->uplink_min_bps_, self->uplink_max_bps_);
+            if (has_audio && ret == ESP_AUDIO_ERR_OK && uplink.OnFrame(send_us, waiting + self->uplink_tx_backlog_)) {
+                esp_opus_enc_set_bitrate(self->opus_encoder_, uplink.bitrate());
+                ESP_LOGI(TAG, "Uplink %s: %dbps, %d frame(s)/message (send avg %luus)",
+                         uplink.congested() ? "congested" : "clear", uplink.bitrate(), uplink.bundle(),
+                         (unsigned long)uplink.stats().send_avg_us);
+            }
+            // Over budget or falling behind: drop a level before the next
+            // frame. Frames held up by the network are the rate's job, not this.
+            if (has_audio && ret == ESP_AUDIO_ERR_OK &&
+                self->enc_gov_.OnFrame(enc_us, uplink.congested() ? 0 : waiting)) {
+                ESP_LOGW(TAG, "Opus encode %luus over budget, complexity -> %d",
+                         (unsigned long)enc_us, self->enc_gov_.complexity());
+                self->OpenEncoder(self->enc_gov_.complexity());
+            }
+
+            // Tail is out: release a partial bundle, report the end of the
+            // stream, maybe one complexity level up for the next recording
+            if (last) {
+                if (self->on_send_) self->on_send_(nullptr, 0);
+                uint32_t tail_us = (uint32_t)(esp_timer_get_time() - self->record_stop_us_);
+                ESP_LOGI(TAG, "End of stream: %lu frames, tail out %lums after stop",
+                         (unsigned long)stream_frames, (unsigned long)(tail_us / 1000));
+                self->enc_gov_.LogStats(TAG);
+                self->uplink_.LogStats(TAG);
+                if (self->on_stream_end_) self->on_stream_end_(stream_frames, tail_us);
+                stream_frames = 0;
+                if (self->enc_gov_.EndRecording()) self->OpenEncoder(self->enc_gov_.complexity());
+            }
             did_work = true;
         }
 
         if (!did_work) {
-            vTaskDelay(pdMS_TO_TICKS(5));
+            // Producers notify on every enqueue. Packets waiting on playback
+            // backpressure need a short poll since OutputTask doesn't notify.
+            bool backlog = uxQueueMessagesWaiting(self->decode_queue_) > 0;
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(backlog ? 5 : CODEC_IDLE_WAIT_MS));
         }
     }
-    free(enc_out_buf);
-    free(dec_out_buf);
     vTaskDelete(NULL);
 }
@@ -3,10 +3,22 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <esp_pm.h>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <mutex>
 
 #include "audio_codec.h"
+#include "audio_stage.h"
+#include "audio_agc.h"
+#include "noise_suppressor.h"
+#include "latency_profile.h"
+#include "loopback_probe.h"
+#include "time_stretch.h"
+#include "encoder_governor.h"
+#include "uplink_rate.h"
 
 // Opus frame: 60ms at 16kHz = 960 samples
 #define OPUS_FRAME_DURATION_MS  60
@@ -17,42 +29,201 @@
 #define OPUS_MAX_PACKET_SIZE 512
 // Buffer size required by esp_opus_enc_process (must be >= encoder's expected_out_size)
 #define OPUS_ENC_OUTBUF_SIZE 4000
+// Decoder output buffer (samples), large enough for any supported frame
+#define OPUS_DEC_OUTBUF_SAMPLES 2880
+// InputTask accumulation buffer: one 60ms frame at the highest codec rate (24kHz)
+#define AUDIO_READ_BUF_SAMPLES  1440
+// OutputTask time-stretch output, drained in chunks of two segments
+#define AUDIO_TSM_CHUNK_SAMPLES (2 * TSM_OVERLAP_MAX)
+
+// Task stacks in bytes (ESP-IDF FreeRTOS: StackType_t is one byte)
+#define AUDIO_INPUT_STACK_SIZE  6144
+#define AUDIO_OUTPUT_STACK_SIZE 6144
+#define AUDIO_CODEC_STACK_SIZE  24576
+
+// Statically allocated by AudioService (see memory_plan.h): task stacks and
+// TCBs, queue storage at LATENCY_MAX_* capacity, codec work buffers.
+// Per-frame blocks passed through the queues still come from the heap.
+constexpr size_t AUDIO_STATIC_BYTES =
+    AUDIO_INPUT_STACK_SIZE + AUDIO_OUTPUT_STACK_SIZE + AUDIO_CODEC_STACK_SIZE +
+    3 * sizeof(StaticTask_t) +
+    3 * sizeof(StaticQueue_t) +
+    (LATENCY_MAX_ENCODE_DEPTH + LATENCY_MAX_DECODE_DEPTH + LATENCY_MAX_PLAYBACK_DEPTH) * sizeof(void*) +
+    OPUS_ENC_OUTBUF_SIZE + OPUS_DEC_OUTBUF_SAMPLES * sizeof(int16_t) +
+    AUDIO_READ_BUF_SAMPLES * sizeof(int16_t) +
+    AUDIO_TSM_CHUNK_SAMPLES * sizeof(int16_t);
+
+// Built-in capture stage slots (remaining slots are free for custom stages)
+#define CAPTURE_STAGE_NS  0
+#define CAPTURE_STAGE_AGC 1
+
+// Acoustic loopback test summary (latencies are speaker write → mic capture)
+struct LoopbackResult {
+    int runs = 0;
+    int detected = 0;         // Runs where the chirp was found with clean timing
+    int latency_min_us = 0;
+    int latency_mean_us = 0;
+    int latency_max_us = 0;
+    int jitter_us = 0;        // max - min across detected runs (DMA phase)
+    int peak_ratio_min = 0;   // Weakest correlation peak / mean
+};
+
+// Linear resampler used by InputTask (codec rate → Opus encode rate)
+void ResampleLinear(const int16_t* in, int in_count, int16_t* out, int out_count);
+
+// Downlink summary of one playback session (amp unmute → idle mute)
+struct PlaybackStats {
+    int rx = 0;               // Opus frames received
+    int concealed = 0;        // Lost frames decoded as PLC (datagram path)
+    int dropped = 0;          // Decode or playback queue full
+    int played = 0;
+    int underruns = 0;
+    int rx_gap_max_ms = 0;    // Longest wait between received frames
+};
 
 struct OpusPacket {
     uint8_t data[OPUS_MAX_PACKET_SIZE];
-    size_t  len;
+    size_t  len;   // 0 = frame lost in transport, decoder conceals it
+    uint32_t seq;  // Transport sequence number (downlink), 0 if none
 };
 
 class AudioService {
 public:
+    // One encoded uplink frame; data == nullptr, len == 0 once the recording's
+    // last frame is out (flush anything held back for bundling)
     using SendCallback = std::function<void(const uint8_t* data, size_t len)>;
     using MuteCallback = std::function<void(bool mute)>;
+    // A recording's uplink is complete: its last frame (the tail, padded to a
+    // full frame) has been through SendCallback. frames: sent this recording;
+    // tail_us: StopRecording() to now.
+    using StreamEndCallback = std::function<void(uint32_t frames, uint32_t tail_us)>;
 
     AudioService(AudioCodec* codec);
     ~AudioService();
 
     void SetSendCallback(SendCallback cb) { on_send_ = cb; }
     void SetMuteCallback(MuteCallback cb) { on_mute_ = cb; }
+    void SetStreamEndCallback(StreamEndCallback cb) { on_stream_end_ = cb; }
 
+    // Create the Opus encoder/decoder. Independent of the codec hardware, so
+    // boot runs it in parallel with codec setup; Start() calls it if needed.
+    bool OpenOpus(int decode_sample_rate = 24000);
     bool Start(int decode_sample_rate = 24000);
     void Stop();
 
-    // Push received Opus packet for decoding + playback
-    void PushOpusForDecode(const uint8_t* data, size_t len);
+    // Push received Opus packet for decoding + playback. len == 0 marks
+    // frame `seq` as lost: the decoder fills it with concealment.
+    void PushOpusForDecode(const uint8_t* data, size_t len, uint32_t seq = 0);
+    // Stats of the playback session that ended last; true once per session
+    bool TakePlaybackStats(PlaybackStats* out);
+    // Sequence number of the last downlink frame written to the codec
+    uint32_t played_seq() const { return played_seq_; }
 
-    // Control recording
-    void StartRecording();
+    // Control recording. trigger_us (esp_timer time of the button edge)
+    // is used to log wake-to-record latency. After StopRecording() the
+    // partial last frame is padded and encoded, then StreamEndCallback fires.
+    void StartRecording(int64_t trigger_us = 0);
     void StopRecording();
     bool IsRecording() const { return recording_; }
+    // No downlink audio pending or playing
+    bool IsPlaybackIdle() const;
+    // Low power: ask OutputTask to close the codec output once it is idle
+    // (it is the task that reopens it for downlink audio, so a packet
+    // arriving meanwhile can't have the device closed under its write).
+    // false cancels a request that hasn't been acted on.
+    void SetOutputPowerDown(bool down);
+    // Cancel a pending power-down and open the output, for writers outside
+    // OutputTask (notification sounds)
+    void EnsureOutputOpen();
+    // Downlink frames waiting to be decoded or played
+    int DownlinkFill() const;
+
+    // Switch buffering preset (profile must have static storage, e.g. from
+    // FindLatencyProfile). Changing DMA depth briefly pauses audio I/O.
+    bool SetLatencyProfile(const LatencyProfile& profile);
+    const LatencyProfile& latency_profile() const { return *profile_.load(); }
+    LatencyBudget latency_budget() const;
+
+    // Acoustic loopback: play a chirp `runs` times while capturing and time
+    // its arrival at the mic. Blocks ~400ms per run. Fails while recording
+    // or playing, or if input and output run at different sample rates.
+    bool RunLoopbackTest(int runs, LoopbackResult* result);
+
+    // DSP stage chains on 10ms blocks: capture runs before encode,
+    // playback runs after decode
+    AudioStageChain& capture_chain() { return capture_chain_; }
+    AudioStageChain& playback_chain() { return playback_chain_; }
+
+    // Capture AGC
+    void SetAgcConfig(const AgcConfig& cfg) { agc_.SetConfig(cfg); }
+    const AgcConfig& agc_config() const { return agc_.config(); }
+    void EnableAgc(bool enable) { capture_chain_.SetEnabled(CAPTURE_STAGE_AGC, enable); }
+    const AgcStats& agc_stats() const { return agc_.stats(); }
+
+    // Capture noise suppression (adds one 10ms block of delay when enabled)
+    void EnableNoiseSuppression(bool enable) { capture_chain_.SetEnabled(CAPTURE_STAGE_NS, enable); }
+    bool noise_suppression_enabled() const { return capture_chain_.IsEnabled(CAPTURE_STAGE_NS); }
+    const NsStats& ns_stats() const { return ns_.stats(); }
+
+    // Playback time-stretch: speed changes of up to ±TSM_MAX_RATE_PCT steer
+    // the queued downlink toward the profile's playback_target_depth
+    void EnableTimeStretch(bool enable) { tsm_enabled_ = enable; }
+    bool time_stretch_enabled() const { return tsm_enabled_; }
+
+    // Opus encoder complexity follows measured encode cost (see
+    // EncoderGovernor), up to max_complexity; 0 pins it at 0
+    void SetEncoderMaxComplexity(int max_complexity) { enc_gov_.SetMaxComplexity(max_complexity); }
+    const EncoderStats& encoder_stats() const { return enc_gov_.stats(); }
+
+    // Uplink bitrate and frames per message follow the link (see
+    // UplinkRateController); send blocking is measured around the send
+    // callback. The owner reports RSSI and frames buffered in the transport.
+    void SetUplinkLinkState(int rssi_dbm, int transport_backlog) {
+        uplink_rssi_ = rssi_dbm;
+        uplink_tx_backlog_ = transport_backlog;
+    }
+    void SetUplinkBitrateLimits(int min_bps, int max_bps) {
+        uplink_min_bps_ = min_bps;
+        uplink_max_bps_ = max_bps;
+    }
+    int uplink_bundle() const { return uplink_.stats().bundle; }
+    const UplinkRateStats& uplink_rate_stats() const { return uplink_.stats(); }
 
 private:
     static void InputTask(void* arg);
     static void OutputTask(void* arg);
     static void CodecTask(void* arg);
 
+    // Run the playback chain over decoded PCM and write it to the codec,
+    // fading in over the first fade_in samples (0 = none)
+    void WritePlayback(int16_t* pcm, int count, int fade_in = 0);
+    // (Re)create the Opus encoder; complexity is fixed at open time
+    bool OpenEncoder(int complexity);
+    // Time-stretch decoded PCM according to queue fill, then WritePlayback()
+    void PlayDecoded(int16_t* pcm, int count, int fade_in);
+    // Write out audio still held as time-stretch lookahead
+    void FlushStretch();
+
+    // Hold the CPU at max clock while audio is streaming (no-op without CONFIG_PM_ENABLE)
+    void HoldCpu(bool hold);
+    void SetPlaybackActive(bool active);
+    void PowerDownOutputIfRequested();  // OutputTask only
+    // Probe access from the I/O tasks: counted first, then checked, so
+    // RunLoopbackTest() can clear probe_ and wait for the count to drain
+    // before the probe goes out of scope (same handshake as the codec's I/O)
+    LoopbackProbe* AcquireProbe();
+    void ReleaseProbe() { probe_users_.fetch_sub(1); }
+    static void Notify(TaskHandle_t task) { if (task) xTaskNotifyGive(task); }
+
+    // I/O pause handshake with InputTask/OutputTask (for codec reconfiguration)
+    bool PauseIo();
+    void ResumeIo() { io_pause_ = false; }
+    void ParkIo();
+
     AudioCodec* codec_;
     SendCallback on_send_;
     MuteCallback on_mute_;
+    StreamEndCallback on_stream_end_;
 
     void* opus_encoder_ = nullptr;
     void* opus_decoder_ = nullptr;
@@ -62,12 +233,43 @@ private:
     QueueHandle_t encode_queue_ = nullptr;  // PCM blocks to encode
     QueueHandle_t decode_queue_ = nullptr;  // Opus packets to decode
     QueueHandle_t playback_queue_ = nullptr; // PCM blocks to play
-    QueueHandle_t send_queue_ = nullptr;     // Opus packets to send
 
     TaskHandle_t input_task_ = nullptr;
     TaskHandle_t output_task_ = nullptr;
     TaskHandle_t codec_task_ = nullptr;
 
+    AudioStageChain capture_chain_;
+    AudioStageChain playback_chain_;
+    AudioAgc agc_;
+    NoiseSuppressor ns_;
+    TimeStretch stretch_;               // OutputTask only
+    EncoderGovernor enc_gov_;           // CodecTask only (stats read anywhere)
+    UplinkRateController uplink_;       // CodecTask only (stats read anywhere)
+    std::atomic<int> uplink_rssi_{0};
+    std::atomic<int> uplink_tx_backlog_{0};
+    std::atomic<int> uplink_min_bps_{UPLINK_DEFAULT_MIN_BPS};
+    std::atomic<int> uplink_max_bps_{UPLINK_DEFAULT_MAX_BPS};
+    std::atomic<bool> tsm_enabled_{true};
+    bool tsm_ready_ = false;
+
+    std::atomic<const LatencyProfile*> profile_;
+    std::atomic<bool> io_pause_{false};
+    std::atomic<int> io_parked_{0};
+
+    esp_pm_lock_handle_t pm_cpu_lock_ = nullptr;
+    std::atomic<bool> playback_active_{false};  // Downlink session holds pm_cpu_lock_
+    std::atomic<uint32_t> played_seq_{0};
+    std::atomic<LoopbackProbe*> probe_{nullptr};  // Set while RunLoopbackTest captures
+    std::atomic<int> probe_users_{0};             // I/O tasks inside the probe right now
+    PlaybackStats last_playback_;                 // Written by OutputTask at idle mute
+    std::atomic<bool> playback_stats_ready_{false};  // Set by OutputTask at idle mute; TakePlaybackStats clears
+    std::atomic<bool> output_power_down_{false};     // Requested, OutputTask acts at idle
+    std::mutex output_power_lock_;                   // Power-down check + close vs EnsureOutputOpen
+    int16_t last_played_sample_ = 0;  // OutputTask: start point of the fade-out
+    volatile int64_t record_trigger_us_ = 0;
+    volatile int64_t record_stop_us_ = 0;
+
     volatile bool running_ = false;
     volatile bool recording_ = false;
+    std::atomic<uint32_t> stop_gen_{0};  // StopRecording calls; InputTask ends the stream on a change
 };
@@ -0,0 +1,117 @@
+#include "audio_stage.h"
+#include <esp_log.h>
+#include <esp_cpu.h>
+#include <sdkconfig.h>
+
+#ifndef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 240
+#endif
+
+void AudioStageChain::SetStage(int slot, AudioStage* stage, bool enabled) {
+    if (slot < 0 || slot >= AUDIO_STAGE_CHAIN_SLOTS) return;
+    slots_[slot].requested.store(stage);
+    slots_[slot].want_enabled.store(enabled);
+    generation_.fetch_add(1);
+}
+
+void AudioStageChain::SetEnabled(int slot, bool enabled) {
+    if (slot < 0 || slot >= AUDIO_STAGE_CHAIN_SLOTS) return;
+    slots_[slot].want_enabled.store(enabled);
+    generation_.fetch_add(1);
+}
+
+bool AudioStageChain::IsEnabled(int slot) const {
+    if (slot < 0 || slot >= AUDIO_STAGE_CHAIN_SLOTS) return false;
+    return slots_[slot].want_enabled.load();
+}
+
+// Apply a pending swap/enable request for one slot (owning task)
+void AudioStageChain::Sync(Slot& slot) {
+    AudioStage* want = slot.requested.load();
+    bool want_enabled = slot.want_enabled.load() && want != nullptr;
+
+    if (want != slot.stage) {
+        slot.stage = want;
+        slot.ready = want && block_samples_ > 0 && want->Init(sample_rate_, block_samples_);
+        slot.enabled = false;
+        slot.stats = AudioStageStats();
+        slot.stats.name = want ? want->name() : nullptr;
+    }
+    if (want_enabled && !slot.enabled && slot.ready) {
+        slot.stage->Reset();
+    }
+    slot.enabled = want_enabled && slot.ready;
+    slot.stats.enabled = slot.enabled;
+}
+
+void AudioStageChain::Prepare(int sample_rate, int block_samples) {
+    sample_rate_ = sample_rate;
+    block_samples_ = block_samples;
+    budget_cycles_ = sample_rate > 0
+        ? (uint32_t)((uint64_t)block_samples * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000 / sample_rate)
+        : 0;
+    seen_generation_ = generation_.load();
+    for (auto& slot : slots_) {
+        slot.stage = nullptr;  // Force Init() for the new block size
+        Sync(slot);
+    }
+}
+
+void AudioStageChain::Process(int16_t* pcm, int samples) {
+    uint32_t gen = generation_.load();
+    if (gen != seen_generation_) {
+        seen_generation_ = gen;
+        for (auto& slot : slots_) Sync(slot);
+    }
+
+    for (auto& slot : slots_) {
+        if (!slot.enabled) continue;
+        uint32_t t0 = esp_cpu_get_cycle_count();
+        slot.stage->Process(pcm, samples);
+        uint32_t cycles = esp_cpu_get_cycle_count() - t0;
+
+        AudioStageStats& st = slot.stats;
+        st.blocks++;
+        st.cycles_last = cycles;
+        if (cycles > st.cycles_max) st.cycles_max = cycles;
+        st.cycles_total += cycles;
+    }
+}
+
+void AudioStageChain::Reset() {
+    for (auto& slot : slots_) {
+        if (slot.enabled) slot.stage->Reset();
+    }
+}
+
+int AudioStageChain::GetStats(AudioStageStats* out, int max) const {
+    int n = 0;
+    for (const auto& slot : slots_) {
+        if (!slot.stats.name || n >= max) continue;
+        out[n++] = slot.stats;
+    }
+    return n;
+}
+
+void AudioStageChain::ResetStats() {
+    for (auto& slot : slots_) {
+        const char* name = slot.stats.name;
+        bool enabled = slot.stats.enabled;
+        slot.stats = AudioStageStats();
+        slot.stats.name = name;
+        slot.stats.enabled = enabled;
+    }
+}
+
+void AudioStageChain::LogStats(const char* tag, const char* label) const {
+    for (const auto& slot : slots_) {
+        const AudioStageStats& st = slot.stats;
+        if (!st.name || st.blocks == 0) continue;
+        uint32_t avg = (uint32_t)(st.cycles_total / st.blocks);
+        ESP_LOGI(tag, "%s stage %s: blocks=%lu cycles avg=%lu max=%lu (%lu.%lu%% of %lu)",
+                 label, st.name, st.blocks, avg, st.cycles_max,
+                 budget_cycles_ ? avg * 100 / budget_cycles_ : 0,
+                 budget_cycles_ ? (avg * 1000 / budget_cycles_) % 10 : 0,
+                 budget_cycles_);
+    }
+}
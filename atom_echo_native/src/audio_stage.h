@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// In-place PCM processor run on fixed-size blocks by an AudioStageChain.
+// Init/Process/Reset are always called from the chain's owning task.
+class AudioStage {
+public:
+    virtual ~AudioStage() = default;
+
+    virtual const char* name() const = 0;
+    // (Re)initialize for a block size; return false to keep the stage bypassed
+    virtual bool Init(int sample_rate, int block_samples) = 0;
+    // samples == block_samples except possibly for a trailing partial block
+    virtual void Process(int16_t* pcm, int samples) = 0;
+    // Drop internal history (called when the stage is (re)enabled)
+    virtual void Reset() {}
+};
+
+#define AUDIO_STAGE_CHAIN_SLOTS 4
+
+struct AudioStageStats {
+    const char* name = nullptr;
+    bool enabled = false;
+    uint32_t blocks = 0;
+    uint32_t cycles_last = 0;
+    uint32_t cycles_max = 0;
+    uint64_t cycles_total = 0;
+};
+
+// Ordered, fixed-capacity list of stages. Stages are owned by the caller and
+// must outlive their time in the chain; the chain itself never allocates.
+// SetStage/SetEnabled may be called from any task: changes are picked up by
+// the owning task at the start of the next block.
+class AudioStageChain {
+public:
+    AudioStageChain() = default;
+
+    void SetStage(int slot, AudioStage* stage, bool enabled = true);
+    void SetEnabled(int slot, bool enabled);
+    bool IsEnabled(int slot) const;
+
+    // Owning task only
+    void Prepare(int sample_rate, int block_samples);
+    void Process(int16_t* pcm, int samples);
+    void Reset();
+
+    int block_samples() const { return block_samples_; }
+    // Cycle budget of one block in real time (100% CPU)
+    uint32_t block_budget_cycles() const { return budget_cycles_; }
+
+    int GetStats(AudioStageStats* out, int max) const;
+    void ResetStats();
+    void LogStats(const char* tag, const char* label) const;
+
+private:
+    struct Slot {
+        std::atomic<AudioStage*> requested{nullptr};
+        std::atomic<bool> want_enabled{false};
+        AudioStage* stage = nullptr;   // Active stage (owning task view)
+        bool enabled = false;
+        bool ready = false;            // Init() succeeded for current block size
+        AudioStageStats stats;
+    };
+
+    void Sync(Slot& slot);
+
+    Slot slots_[AUDIO_STAGE_CHAIN_SLOTS];
+    std::atomic<uint32_t> generation_{0};
+    uint32_t seen_generation_ = 0;
+    int sample_rate_ = 0;
+    int block_samples_ = 0;
+    uint32_t budget_cycles_ = 0;
+};
@@ -0,0 +1,61 @@
+#include "clock_sync.h"
+
+bool ClockSync::Due(int64_t now_us) const {
+    int64_t gap_ms = burst_left_ > 0 ? CLOCK_SYNC_BURST_GAP_MS : CLOCK_SYNC_INTERVAL_MS;
+    return sent_us_ == 0 || now_us - sent_us_ >= gap_ms * 1000;
+}
+
+void ClockSync::OnRequestSent(int64_t now_us) {
+    sent_us_ = now_us;
+    if (burst_left_ > 0) burst_left_--;
+}
+
+void ClockSync::Restart() {
+    burst_left_ = CLOCK_SYNC_BURST;
+    sent_us_ = 0;
+}
+
+void ClockSync::OnSample(int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+    int64_t rtt = (t4 - t1) - (t3 - t2);
+    if (t1 <= 0 || t2 <= 0 || t3 < t2 || rtt < 0 || rtt > (int64_t)CLOCK_SYNC_MAX_RTT_MS * 1000) {
+        stats_.rejected++;
+        return;
+    }
+    Sample s = {t1 + (t4 - t1) / 2, ((t2 - t1) + (t3 - t4)) / 2, (uint32_t)rtt};
+    window_[next_] = s;
+    next_ = (next_ + 1) % CLOCK_SYNC_WINDOW;
+    if (count_ < CLOCK_SYNC_WINDOW) count_++;
+    stats_.samples++;
+    stats_.last_rtt_us = s.rtt_us;
+
+    // Lowest round trip in the window; ties go to the newer sample
+    Sample best = window_[0];
+    for (int i = 1; i < count_; i++) {
+        const Sample& w = window_[i];
+        if (w.rtt_us < best.rtt_us || (w.rtt_us == best.rtt_us && w.device_us > best.device_us)) best = w;
+    }
+    if (!stats_.synced) anchor_ = best;
+
+    // Skew from two best samples far enough apart that offset noise is small
+    // next to the drift between them
+    int64_t span = best.device_us - anchor_.device_us;
+    if (span >= (int64_t)CLOCK_SYNC_SKEW_SPAN_MS * 1000) {
+        int64_t ppb = (best.offset_us - anchor_.offset_us) * 1000000000LL / span;
+        if (ppb > CLOCK_SYNC_MAX_SKEW_PPB) ppb = CLOCK_SYNC_MAX_SKEW_PPB;
+        if (ppb < -CLOCK_SYNC_MAX_SKEW_PPB) ppb = -CLOCK_SYNC_MAX_SKEW_PPB;
+        stats_.skew_ppb = skew_known_ ? (int32_t)(stats_.skew_ppb - stats_.skew_ppb / 4 + ppb / 4) : (int32_t)ppb;
+        skew_known_ = true;
+        anchor_ = best;
+    }
+
+    best_ = best;
+    stats_.synced = true;
+    stats_.offset_us = best.offset_us;
+    stats_.rtt_us = best.rtt_us;
+}
+
+int64_t ClockSync::ToServerUs(int64_t device_us) const {
+    if (!stats_.synced) return 0;
+    int64_t since = device_us - best_.device_us;
+    return device_us + best_.offset_us + since * stats_.skew_ppb / 1000000000LL;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+// Device (esp_timer) to server (Unix time, us) clock mapping from NTP-style
+// exchanges: t1 device send, t2 server receive, t3 server send, t4 device
+// receive. Each gives offset ((t2-t1)+(t3-t4))/2, wrong by at most half the
+// path asymmetry, and round trip (t4-t1)-(t3-t2). WiFi delay is mostly
+// queueing and power-save wakeups, so the filter keeps the lowest-RTT sample
+// of the last CLOCK_SYNC_WINDOW: the one least inflated, whose error bound
+// (rtt/2) is smallest. The two crystals drift apart by tens of ppm, so skew
+// is estimated from best samples at least CLOCK_SYNC_SKEW_SPAN_MS apart.
+#define CLOCK_SYNC_WINDOW         8
+#define CLOCK_SYNC_BURST          8       // Exchanges after each (re)connect...
+#define CLOCK_SYNC_BURST_GAP_MS   250     // ...this far apart
+#define CLOCK_SYNC_INTERVAL_MS    10000   // Then one per interval
+#define CLOCK_SYNC_MAX_RTT_MS     1000    // Slower replies are stale or meaningless
+#define CLOCK_SYNC_SKEW_SPAN_MS   60000   // Best samples this far apart before a skew estimate
+#define CLOCK_SYNC_MAX_SKEW_PPB   500000  // Crystals are ±tens of ppm; beyond this is noise
+
+struct ClockSyncStats {
+    bool synced = false;
+    int64_t offset_us = 0;      // Server minus device, at the best sample
+    uint32_t rtt_us = 0;        // Best sample's round trip: offset is within ±rtt/2
+    uint32_t last_rtt_us = 0;
+    int32_t skew_ppb = 0;       // Server clock rate relative to the device's
+    uint32_t samples = 0;       // Since boot
+    uint32_t rejected = 0;      // Stale or malformed replies
+};
+
+class ClockSync {
+public:
+    // A request should go out now (burst after Restart(), then periodic)
+    bool Due(int64_t now_us) const;
+    void OnRequestSent(int64_t now_us);
+    // New connection: burst again. Samples are kept, the clocks haven't changed.
+    void Restart();
+
+    // One exchange; t1/t4 device esp_timer us, t2/t3 server Unix us
+    void OnSample(int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+    bool synced() const { return stats_.synced; }
+    // Device esp_timer time as server Unix time in us (0 if not synced)
+    int64_t ToServerUs(int64_t device_us) const;
+
+    const ClockSyncStats& stats() const { return stats_; }
+
+private:
+    struct Sample {
+        int64_t device_us;      // Midpoint of t1..t4
+        int64_t offset_us;
+        uint32_t rtt_us;
+    };
+
+    Sample window_[CLOCK_SYNC_WINDOW] = {};
+    int count_ = 0;
+    int next_ = 0;
+    Sample best_ = {};          // Reference point for ToServerUs()
+    Sample anchor_ = {};        // Earlier best sample the skew is measured from
+    bool skew_known_ = false;
+    int burst_left_ = CLOCK_SYNC_BURST;
+    int64_t sent_us_ = 0;
+    ClockSyncStats stats_;
+};
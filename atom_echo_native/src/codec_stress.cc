@@ -0,0 +1,156 @@
+#include "codec_stress.h"
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <atomic>
+#include <cstring>
+
+#define TAG "CodecStress"
+
+#define STRESS_TOGGLE_MIN_MS  2
+#define STRESS_TOGGLE_MAX_MS  20
+#define STRESS_REBUILD_EVERY  8    // Toggles per DMA rebuild, on average
+#define STRESS_STOP_WAIT_MS   500  // Longer than a blocked read/write (IO_TIMEOUT_MS)
+#define STRESS_MAX_BLOCK      480  // 10ms at up to 48kHz
+#define STRESS_RECOVER_MS     200
+
+struct StressShared {
+    Es8311AudioCodec* codec;
+    int block;                   // 10ms at the codec rate
+    volatile bool stop;
+    volatile uint32_t reads;
+    volatile uint32_t writes;
+    volatile uint32_t bad_reads;
+};
+
+// Static so a task that misses the stop deadline never touches a dead frame;
+// the next run refuses to start until both have exited. Exits are counted on
+// their own semaphore: the main task's notification is also given by the
+// button ISR and the network callbacks, which would pass for an exit.
+static StressShared shared;
+static std::atomic<int> tasks_alive{0};
+static StaticSemaphore_t exited_buf;
+static SemaphoreHandle_t exited;
+
+static void reader_task(void* arg) {
+    auto* s = (StressShared*)arg;
+    int16_t buf[STRESS_MAX_BLOCK];
+    while (!s->stop) {
+        // Called whether or not input is enabled: the refusal path races too
+        int got = s->codec->ReadSamples(buf, s->block);
+        if (got > s->block) s->bad_reads++;
+        if (got > 0) s->reads++;
+        else vTaskDelay(1);
+    }
+    xSemaphoreGive(exited);
+    tasks_alive--;  // After the give, so a new run never sees a stale one
+    vTaskDelete(nullptr);
+}
+
+static void writer_task(void* arg) {
+    auto* s = (StressShared*)arg;
+    int16_t silence[STRESS_MAX_BLOCK];
+    memset(silence, 0, sizeof(silence));
+    while (!s->stop) {
+        bool enabled = s->codec->output_enabled();
+        s->codec->WriteSamples(silence, s->block);
+        if (enabled) s->writes++;
+        else vTaskDelay(1);
+    }
+    xSemaphoreGive(exited);
+    tasks_alive--;  // After the give, so a new run never sees a stale one
+    vTaskDelete(nullptr);
+}
+
+bool RunCodecStress(Es8311AudioCodec* codec, int duration_ms, CodecStressResult* r) {
+    *r = CodecStressResult();
+    if (duration_ms > CODEC_STRESS_MAX_MS) duration_ms = CODEC_STRESS_MAX_MS;
+    r->duration_ms = duration_ms;
+
+    const bool in0 = codec->input_enabled();
+    const bool out0 = codec->output_enabled();
+    const int desc0 = codec->dma_desc_num();
+    const int frames0 = codec->dma_frame_num();
+
+    int block = codec->input_sample_rate() / 100;
+    if (tasks_alive > 0 || block <= 0 || block > STRESS_MAX_BLOCK) {
+        ESP_LOGE(TAG, "Not started (%d I/O tasks still running, block %d)", tasks_alive.load(), block);
+        return false;
+    }
+    StressShared& s = shared;
+    s = StressShared();
+    s.codec = codec;
+    s.block = block;
+    codec->ResetSwitchStats();
+    if (!exited) exited = xSemaphoreCreateCountingStatic(2, 0, &exited_buf);
+    while (xSemaphoreTake(exited, 0) == pdTRUE) {}  // Late exits from a timed-out run
+
+    // Reader on the capture core at InputTask's priority, writer where OutputTask runs
+    tasks_alive = 2;
+    int started = 0;
+    if (xTaskCreatePinnedToCore(reader_task, "stress_rd", CODEC_STRESS_STACK, &s, 8, nullptr, 1) == pdPASS) {
+        started++;
+    }
+    if (xTaskCreate(writer_task, "stress_wr", CODEC_STRESS_STACK, &s, 4, nullptr) == pdPASS) {
+        started++;
+    }
+    if (started < 2) {
+        ESP_LOGE(TAG, "Could not start the I/O tasks");
+        tasks_alive -= 2 - started;
+        s.stop = true;
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Toggling I/O for %dms (block %d, DMA %dx%d <-> %dx%d)",
+             duration_ms, s.block, desc0, frames0, desc0 + 2, frames0);
+    int64_t end_us = esp_timer_get_time() + (int64_t)duration_ms * 1000;
+    bool alt_dma = false;
+    while (esp_timer_get_time() < end_us) {
+        uint32_t rnd = esp_random();
+        if (rnd % STRESS_REBUILD_EVERY == 0) {
+            alt_dma = !alt_dma;
+            codec->SetDmaConfig(alt_dma ? desc0 + 2 : desc0, frames0);
+            r->rebuilds++;
+        } else if (rnd & 0x100) {
+            codec->EnableInput(!codec->input_enabled());
+            r->toggles++;
+        } else {
+            codec->EnableOutput(!codec->output_enabled());
+            r->toggles++;
+        }
+        int gap = STRESS_TOGGLE_MIN_MS + (rnd >> 16) % (STRESS_TOGGLE_MAX_MS - STRESS_TOGGLE_MIN_MS + 1);
+        vTaskDelay(pdMS_TO_TICKS(gap) > 0 ? pdMS_TO_TICKS(gap) : 1);
+    }
+
+    s.stop = true;
+    int stopped = 0;
+    while (stopped < 2 && xSemaphoreTake(exited, pdMS_TO_TICKS(STRESS_STOP_WAIT_MS)) == pdTRUE) stopped++;
+    r->tasks_stopped = stopped == 2;
+    r->reads = s.reads;
+    r->writes = s.writes;
+    r->bad_reads = s.bad_reads;
+
+    // Capture must still work once the dust settles. Plain blocking reads,
+    // like the reader task's: WaitForInput() would make this task the one the
+    // RX callback wakes, and InputTask would sleep through its DMA blocks.
+    codec->SetDmaConfig(desc0, frames0);
+    codec->EnableOutput(out0);
+    codec->EnableInput(true);
+    int16_t buf[STRESS_MAX_BLOCK];
+    int64_t recover_end_us = esp_timer_get_time() + STRESS_RECOVER_MS * 1000;
+    while (!r->recovered && esp_timer_get_time() < recover_end_us) {
+        r->recovered = codec->ReadSamples(buf, s.block) == s.block;
+    }
+    codec->EnableInput(in0);
+
+    r->sw = codec->switch_stats();
+    r->ok = r->tasks_stopped && r->recovered && r->bad_reads == 0 && r->sw.io_users == 0;
+    ESP_LOGI(TAG, "%s: toggles=%lu rebuilds=%lu reads=%lu writes=%lu quiesces=%lu drained=%lu "
+             "drain_max=%luus refused=%lu io_users=%d",
+             r->ok ? "OK" : "FAILED", r->toggles, r->rebuilds, r->reads, r->writes,
+             r->sw.quiesces, r->sw.drained, r->sw.drain_max_us, r->sw.refused, r->sw.io_users);
+    return r->ok;
+}
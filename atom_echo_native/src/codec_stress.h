@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+#include "es8311_audio_codec.h"
+
+// Stress test for the codec's lock-free data-path switching: a reader and a
+// writer task stream 10ms blocks through the direct I/O path (as InputTask
+// and OutputTask do) while the caller toggles input and output at random
+// 2-20ms intervals and rebuilds the I2S DMA every few toggles. A broken
+// quiescence shows up as a crash, a stuck io_users count, a short read
+// returning more than asked, or a codec that no longer captures afterwards.
+#define CODEC_STRESS_MAX_MS   30000
+#define CODEC_STRESS_STACK    3072
+
+struct CodecStressResult {
+    int duration_ms = 0;
+    uint32_t toggles = 0;        // EnableInput/EnableOutput flips
+    uint32_t rebuilds = 0;       // SetDmaConfig calls that rebuilt the channels
+    uint32_t reads = 0;          // Read calls that returned samples
+    uint32_t writes = 0;         // Write calls made with output enabled
+    uint32_t bad_reads = 0;      // Returned more samples than asked for
+    bool tasks_stopped = false;  // Reader and writer exited when asked
+    bool recovered = false;      // A clean 10ms read after the run
+    CodecSwitchStats sw;         // Quiesce/drain/refused counters for the run
+    bool ok = false;
+};
+
+// Blocks the caller for duration_ms. Input, output and DMA depth are put
+// back as they were. Run only while AudioService isn't streaming.
+bool RunCodecStress(Es8311AudioCodec* codec, int duration_ms, CodecStressResult* r);
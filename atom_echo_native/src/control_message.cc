@@ -0,0 +1,79 @@
+#include "control_message.h"
+#include <cstring>
+
+static const char* skip_space(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    return p;
+}
+
+// p is on the opening quote; returns the closing quote, or end if unterminated
+static const char* string_end(const char* p, const char* end) {
+    for (p++; p < end && *p != '"'; p++) {
+        if (*p == '\\') p++;
+    }
+    return p < end ? p : end;
+}
+
+static bool copy_scalar(const char* p, const char* end, char* out, size_t out_size) {
+    const char* s = p;
+    const char* e;
+    if (p < end && *p == '"') {
+        s = p + 1;
+        e = string_end(p, end);
+        if (e == end) return false;
+    } else {
+        if (p >= end || *p == '{' || *p == '[') return false;
+        e = p;
+        while (e < end && *e != ',' && *e != '}' && *e != ']' && *e != ' ' &&
+               *e != '\t' && *e != '\r' && *e != '\n') {
+            e++;
+        }
+        if (e == s) return false;
+    }
+    size_t n = e - s;
+    if (n + 1 > out_size) return false;
+    memcpy(out, s, n);
+    out[n] = '\0';
+    return true;
+}
+
+bool ControlField(const char* json, size_t len, const char* key, char* out, size_t out_size) {
+    if (!json || !key || !out || out_size == 0) return false;
+    const size_t key_len = strlen(key);
+    const char* p = json;
+    const char* end = json + len;
+    int depth = 0;
+    bool at_key = false;  // Next string at depth 1 is a key
+    while (p < end) {
+        char c = *p;
+        if (c == '"') {
+            const char* e = string_end(p, end);
+            if (e == end) return false;
+            if (depth == 1 && at_key) {
+                at_key = false;
+                const char* name = p + 1;
+                size_t n = e - name;
+                p = skip_space(e + 1, end);
+                if (p >= end || *p != ':') return false;
+                p = skip_space(p + 1, end);
+                if (n == key_len && memcmp(name, key, n) == 0) {
+                    return copy_scalar(p, end, out, out_size);
+                }
+                continue;  // Value is walked like anything else
+            }
+            p = e + 1;
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            depth++;
+            at_key = c == '{' && depth == 1;
+        } else if (c == '}' || c == ']') {
+            depth--;
+            if (depth <= 0) return false;  // End of the top-level object
+        } else if (c == ',' && depth == 1) {
+            at_key = true;
+        }
+        p++;
+    }
+    return false;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+// Field lookup for server control messages. The server writes them with
+// Python's json.dumps or aiohttp's send_json, which put a space after ':'
+// and ','; matching byte strings like "\"type\":\"bench\"" only works on
+// compact JSON. This walks the tokens instead, cheap enough to run on every
+// message before deciding whether a full cJSON parse is needed.
+
+// Top-level scalar `key` of the JSON object: a string's contents (escapes
+// kept as written) or a literal as written (number, true, false, null).
+// False if the key is missing, its value is an object or array, or it
+// doesn't fit in out_size (including the terminator).
+bool ControlField(const char* json, size_t len, const char* key, char* out, size_t out_size);
+
+// The message's "type", "" if it has none
+inline const char* ControlType(const char* json, size_t len, char* out, size_t out_size) {
+    if (out_size == 0) return "";
+    if (!ControlField(json, len, "type", out, out_size)) out[0] = '\0';
+    return out;
+}
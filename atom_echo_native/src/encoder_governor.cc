@@ -0,0 +1,83 @@
+#include "encoder_governor.h"
+#include <esp_log.h>
+#include <sdkconfig.h>
+
+#ifndef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 240
+#endif
+
+void EncoderGovernor::Init(int frame_us, int max_complexity) {
+    stats_ = EncoderStats();
+    stats_.budget_us = (uint32_t)frame_us * ENC_GOV_BUDGET_PCT / 100;
+    for (auto& a : avg_us_) a = 0;
+    level_ = 0;
+    level_frames_ = 0;
+    overloaded_ = false;
+    ended_ = true;
+    SetMaxComplexity(max_complexity);
+}
+
+void EncoderGovernor::SetMaxComplexity(int max_complexity) {
+    if (max_complexity < 0) max_complexity = 0;
+    if (max_complexity > ENC_GOV_MAX_COMPLEXITY) max_complexity = ENC_GOV_MAX_COMPLEXITY;
+    max_level_ = max_complexity;  // A lower cap takes effect at the next frame
+}
+
+bool EncoderGovernor::OnFrame(uint32_t encode_us, int backlog) {
+    if (ended_) {
+        ended_ = false;
+        overloaded_ = false;
+        stats_.frames = 0;
+        stats_.max_us = 0;
+        stats_.backlogs = 0;
+    }
+    stats_.frames++;
+    if (encode_us > stats_.max_us) stats_.max_us = encode_us;
+    if (backlog > 0) stats_.backlogs++;
+
+    uint32_t& avg = avg_us_[level_];
+    avg = avg ? avg - avg / 8 + encode_us / 8 : encode_us;
+    level_frames_++;
+    stats_.complexity = level_;
+    stats_.avg_us = avg;
+    stats_.avg_cycles = avg * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+
+    int next = level_;
+    if (level_ > max_level_) {
+        next = max_level_;
+    } else if (backlog > 0 || (level_frames_ >= 4 && avg > stats_.budget_us)) {
+        // A waiting frame can't wait for the average to catch up
+        overloaded_ = true;
+        if (level_ > 0) next = level_ - 1;
+    }
+    if (next == level_) return false;
+    level_ = next;
+    level_frames_ = 0;
+    stats_.steps_down++;
+    return true;
+}
+
+bool EncoderGovernor::EndRecording() {
+    if (ended_) return false;
+    ended_ = true;
+    if (overloaded_ || level_ >= max_level_ || level_frames_ < ENC_GOV_MIN_FRAMES) return false;
+
+    uint32_t cur = avg_us_[level_];
+    uint32_t& up = avg_us_[level_ + 1];
+    uint32_t est = up ? up : cur + cur / 4;  // Not measured yet: assume +25%
+    if (est > stats_.budget_us * ENC_GOV_UP_PCT / 100) {
+        up -= up / 8;
+        return false;
+    }
+    level_++;
+    level_frames_ = 0;
+    stats_.steps_up++;
+    return true;
+}
+
+void EncoderGovernor::LogStats(const char* tag) const {
+    if (stats_.frames == 0) return;
+    ESP_LOGI(tag, "Opus enc: cx=%d frames=%lu avg=%luus (%lu cycles) max=%luus budget=%luus backlogs=%lu steps=+%lu/-%lu",
+             stats_.complexity, stats_.frames, stats_.avg_us, stats_.avg_cycles, stats_.max_us,
+             stats_.budget_us, stats_.backlogs, stats_.steps_up, stats_.steps_down);
+}
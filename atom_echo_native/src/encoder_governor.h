@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+// Chooses the Opus encoder complexity from what encoding actually costs.
+// Every frame's encode time is charged to the current level; a level whose
+// average exceeds the budget, or a frame left waiting in the encode queue,
+// steps down at once. Between recordings, a recording that stayed clear of
+// the budget earns one step up if the next level's cost (measured earlier,
+// or estimated) fits with margin. Times are wall clock on the codec task,
+// so preemption counts against the level too: the budget is the task's
+// headroom, not just codec work. The CPU is held at max while recording.
+// A level's remembered cost decays each time it is turned down, so one
+// transient overload doesn't lock it out for good.
+#define ENC_GOV_MAX_COMPLEXITY 10
+#define ENC_GOV_BUDGET_PCT     35   // Share of a frame period encoding may take
+#define ENC_GOV_UP_PCT         80   // Step up only if the next level fits this share of the budget
+#define ENC_GOV_MIN_FRAMES     16   // Frames at a level before it may step up (~1s)
+
+struct EncoderStats {
+    int complexity = 0;
+    uint32_t frames = 0;        // Encoded this recording
+    uint32_t avg_us = 0;        // Current level's running average
+    uint32_t max_us = 0;        // Slowest frame this recording
+    uint32_t avg_cycles = 0;    // avg_us at the CPU clock
+    uint32_t budget_us = 0;
+    uint32_t steps_up = 0;      // Since boot
+    uint32_t steps_down = 0;
+    uint32_t backlogs = 0;      // Frames that found the next one already waiting
+};
+
+class EncoderGovernor {
+public:
+    // frame_us: one frame period; max_complexity: upper bound (0 pins it)
+    void Init(int frame_us, int max_complexity);
+    void SetMaxComplexity(int max_complexity);
+    int complexity() const { return level_; }
+
+    // Charge one encoded frame. backlog: frames waiting in the encode queue
+    // afterwards. Returns true if the level dropped and the encoder must be
+    // reopened at complexity().
+    bool OnFrame(uint32_t encode_us, int backlog);
+    // End of a recording (tail frame encoded). Returns true if the level
+    // went up. stats() keep describing this recording until the next frame.
+    bool EndRecording();
+
+    const EncoderStats& stats() const { return stats_; }
+    void LogStats(const char* tag) const;
+
+private:
+    EncoderStats stats_;
+    uint32_t avg_us_[ENC_GOV_MAX_COMPLEXITY + 1] = {};  // 0 = not measured yet
+    int level_ = 0;
+    int max_level_ = 0;
+    int level_frames_ = 0;      // Frames at this level since it was chosen
+    bool overloaded_ = false;   // This recording hit the budget: no step up
+    bool ended_ = true;
+};
@@ -1,29 +1,37 @@
 #include "es8311_audio_codec.h"
 #include <esp_log.h>
+#include <esp_cpu.h>
+#include <esp_timer.h>
+#include <soc/soc_caps.h>
 #include <cassert>
 #include <cstring>
 
 #define TAG "Es8311AudioCodec"
 
+#define IO_TIMEOUT_MS 100  // Also bounds how long QuiesceIo() can wait
+
+#if ES8311_I2S_MONO_SLOTS
+#define I2S_SLOTS 1
+#else
+#define I2S_SLOTS 2
+// One codec per device; storage accounted for in CODEC_STATIC_BYTES.
+// One L/R frame per word, separate per direction (Read and Write run concurrently)
+static uint32_t rx_stereo_buf[ES8311_STEREO_CHUNK];
+static uint32_t tx_stereo_buf[ES8311_STEREO_CHUNK];
+#endif
+
 Es8311AudioCodec::Es8311AudioCodec(i2c_master_bus_handle_t i2c_bus, i2c_port_t i2c_port,
                                    int input_sample_rate, int output_sample_rate,
                                    gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws,
                                    gpio_num_t dout, gpio_num_t din,
-                                   uint8_t es8311_addr, bool use_mclk) {
+                                   uint8_t es8311_addr, bool use_mclk)
+    : mclk_(mclk), bclk_(bclk), ws_(ws), dout_(dout), din_(din) {
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
 
     assert(input_sample_rate_ == output_sample_rate_);
-    CreateDuplexChannels(mclk, bclk, ws, dout, din);
-
-    // I2S data interface
-    audio_codec_i2s_cfg_t i2s_cfg = {
-        .port = I2S_NUM_0,
-        .rx_handle = rx_handle_,
-        .tx_handle = tx_handle_,
-    };
-    data_if_ = audio_codec_new_i2s_data(&i2s_cfg);
-    assert(data_if_ != NULL);
+    CreateDuplexChannels();
+    CreateDataInterface();
 
     // I2C control interface
     audio_codec_i2c_cfg_t i2c_cfg = {
@@ -57,6 +65,7 @@ Es8311AudioCodec::Es8311AudioCodec(i2c_master_bus_handle_t i2c_bus, i2c_port_t i
 }
 
 Es8311AudioCodec::~Es8311AudioCodec() {
+    QuiesceIo();
     if (dev_) esp_codec_dev_delete(dev_);
     if (codec_if_) audio_codec_delete_codec_if(codec_if_);
     if (ctrl_if_) audio_codec_delete_ctrl_if(ctrl_if_);
@@ -64,13 +73,12 @@ Es8311AudioCodec::~Es8311AudioCodec() {
     if (data_if_) audio_codec_delete_data_if(data_if_);
 }
 
-void Es8311AudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk,
-                                            gpio_num_t ws, gpio_num_t dout, gpio_num_t din) {
+void Es8311AudioCodec::CreateDuplexChannels() {
     i2s_chan_config_t chan_cfg = {
         .id = I2S_NUM_0,
         .role = I2S_ROLE_MASTER,
-        .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
-        .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
+        .dma_desc_num = (uint32_t)dma_desc_num_,
+        .dma_frame_num = (uint32_t)dma_frame_num_,
         .auto_clear_after_cb = true,
         .auto_clear_before_cb = false,
         .intr_priority = 0,
@@ -86,18 +94,23 @@ void Es8311AudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk,
         .slot_cfg = {
             .data_bit_width = I2S_DATA_BIT_WIDTH_16BIT,
             .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,
+#if ES8311_I2S_MONO_SLOTS
+            .slot_mode = I2S_SLOT_MODE_MONO,
+            .slot_mask = I2S_STD_SLOT_LEFT,
+#else
             .slot_mode = I2S_SLOT_MODE_STEREO,
             .slot_mask = I2S_STD_SLOT_BOTH,
+#endif
             .ws_width = I2S_DATA_BIT_WIDTH_16BIT,
             .ws_pol = false,
             .bit_shift = true,
         },
         .gpio_cfg = {
-            .mclk = mclk,
-            .bclk = bclk,
-            .ws = ws,
-            .dout = dout,
-            .din = din,
+            .mclk = mclk_,
+            .bclk = bclk_,
+            .ws = ws_,
+            .dout = dout_,
+            .din = din_,
             .invert_flags = {
                 .mclk_inv = false,
                 .bclk_inv = false,
@@ -106,11 +119,62 @@ void Es8311AudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk,
         },
     };
 
+#if SOC_I2S_HW_VERSION_1 && ES8311_I2S_MONO_SLOTS
+    // ESP32 packs two 16-bit mono samples per FIFO word; keep them in order
+    std_cfg.slot_cfg.msb_right = true;
+#endif
+
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(tx_handle_, &std_cfg));
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(rx_handle_, &std_cfg));
+    RegisterRxCallbacks();
     ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
     ESP_ERROR_CHECK(i2s_channel_enable(rx_handle_));
-    ESP_LOGI(TAG, "I2S duplex channels created (%d Hz)", output_sample_rate_);
+    channels_enabled_ = true;
+    // TX + RX DMA; stereo slots would double this
+    int dma_bytes = 2 * dma_desc_num_ * dma_frame_num_ * I2S_SLOTS * (int)sizeof(int16_t);
+    ESP_LOGI(TAG, "I2S duplex channels created (%d Hz, %d slot%s, DMA %dx%d = %d bytes, saved %d vs stereo)",
+             output_sample_rate_, I2S_SLOTS, I2S_SLOTS > 1 ? "s" : "", dma_desc_num_, dma_frame_num_,
+             dma_bytes, dma_bytes * 2 / I2S_SLOTS - dma_bytes);
+}
+
+void Es8311AudioCodec::CreateDataInterface() {
+    audio_codec_i2s_cfg_t i2s_cfg = {
+        .port = I2S_NUM_0,
+        .rx_handle = rx_handle_,
+        .tx_handle = tx_handle_,
+    };
+    data_if_ = audio_codec_new_i2s_data(&i2s_cfg);
+    assert(data_if_ != NULL);
+}
+
+bool Es8311AudioCodec::SetDmaConfig(int desc_num, int frame_num) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (desc_num == dma_desc_num_ && frame_num == dma_frame_num_) return true;
+
+    QuiesceIo();
+
+    // The device and data interface are bound to the old channel handles
+    if (dev_) {
+        esp_codec_dev_close(dev_);
+        esp_codec_dev_delete(dev_);
+        dev_ = nullptr;
+    }
+    if (data_if_) {
+        audio_codec_delete_data_if(data_if_);
+        data_if_ = nullptr;
+    }
+    SetChannelsEnabled(false);
+    i2s_del_channel(tx_handle_);
+    i2s_del_channel(rx_handle_);
+    tx_handle_ = nullptr;
+    rx_handle_ = nullptr;
+
+    dma_desc_num_ = desc_num;
+    dma_frame_num_ = frame_num;
+    CreateDuplexChannels();
+    CreateDataInterface();
+    UpdateDeviceState();  // Reopen if input or output was enabled
+    return true;
 }
 
 void Es8311AudioCodec::UpdateDeviceState() {
@@ -119,6 +183,7 @@ void Es8311AudioCodec::UpdateDeviceState() {
         return;
     }
     if ((input_enabled_ || output_enabled_) && dev_ == nullptr) {
+        SetChannelsEnabled(true);
         esp_codec_dev_cfg_t dev_cfg = {
             .dev_type = ESP_CODEC_DEV_TYPE_IN_OUT,
             .codec_if = codec_if_,
@@ -129,7 +194,7 @@ void Es8311AudioCodec::UpdateDeviceState() {
 
         esp_codec_dev_sample_info_t fs = {
             .bits_per_sample = 16,
-            .channel = 1,
+            .channel = I2S_SLOTS,  // Match the slot layout CreateDuplexChannels() set up
             .channel_mask = 0,
             .sample_rate = (uint32_t)input_sample_rate_,
             .mclk_multiple = 0,
@@ -138,10 +203,73 @@ void Es8311AudioCodec::UpdateDeviceState() {
         // set_in_gain may not be supported on all codec versions; ignore error
         esp_codec_dev_set_in_gain(dev_, 30.0);
         ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(dev_, output_volume_));
+        io_ready_ = true;  // Publish only once fully open
     } else if (!input_enabled_ && !output_enabled_ && dev_ != nullptr) {
+        QuiesceIo();
         esp_codec_dev_close(dev_);
+        esp_codec_dev_delete(dev_);
         dev_ = nullptr;
     }
+    if (!input_enabled_ && !output_enabled_) {
+        SetChannelsEnabled(false);  // Let the CPU scale down / light-sleep
+    }
+}
+
+void Es8311AudioCodec::SetChannelsEnabled(bool enable) {
+    if (enable == channels_enabled_) return;
+    // esp_codec_dev may already have toggled them; INVALID_STATE is benign
+    if (enable) {
+        i2s_channel_enable(tx_handle_);
+        i2s_channel_enable(rx_handle_);
+    } else {
+        i2s_channel_disable(tx_handle_);
+        i2s_channel_disable(rx_handle_);
+    }
+    channels_enabled_ = enable;
+    ESP_LOGI(TAG, "I2S channels %s", enable ? "enabled" : "disabled");
+}
+
+bool Es8311AudioCodec::AcquireIo() {
+    // Count first, then check: QuiesceIo() clears io_ready_ before reading
+    // io_users_, so either it sees us or we see the cleared flag
+    io_users_.fetch_add(1);
+    if (io_ready_.load()) return true;
+    io_users_.fetch_sub(1);
+    io_refused_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void Es8311AudioCodec::QuiesceIo() {
+    io_ready_ = false;
+    io_quiesces_++;
+    if (io_users_.load() == 0) return;
+    int64_t t0 = esp_timer_get_time();
+    while (io_users_.load() > 0) {
+        io_quiesce_waits_++;
+        vTaskDelay(1);
+    }
+    uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+    io_drained_++;
+    if (us > io_drain_max_us_) io_drain_max_us_ = us;
+}
+
+CodecSwitchStats Es8311AudioCodec::switch_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CodecSwitchStats s;
+    s.quiesces = io_quiesces_;
+    s.drained = io_drained_;
+    s.drain_max_us = io_drain_max_us_;
+    s.refused = io_refused_.load();
+    s.io_users = io_users_.load();
+    return s;
+}
+
+void Es8311AudioCodec::ResetSwitchStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    io_quiesces_ = 0;
+    io_drained_ = 0;
+    io_drain_max_us_ = 0;
+    io_refused_ = 0;
 }
 
 void Es8311AudioCodec::SetOutputVolume(int volume) {
@@ -166,22 +294,103 @@ void Es8311AudioCodec::EnableOutput(bool enable) {
     UpdateDeviceState();
 }
 
+// Steady-state streaming goes straight to the I2S channels. The device stays
+// open for ES8311 register setup and hardware volume; esp_codec_dev_read/
+// write would only add a copy and format checks per 10ms chunk.
 int Es8311AudioCodec::Read(int16_t* dest, int samples) {
-    if (input_enabled_ && dev_) {
-        esp_err_t ret = esp_codec_dev_read(dev_, (void*)dest, samples * sizeof(int16_t));
-        if (ret != ESP_OK) {
-            // Silence the buffer on error (device closing, etc.)
-            memset(dest, 0, samples * sizeof(int16_t));
-        }
-    } else {
+    if (!input_enabled_ || !AcquireIo()) {
         memset(dest, 0, samples * sizeof(int16_t));
+        return 0;
+    }
+
+    uint32_t t0 = esp_cpu_get_cycle_count();
+    int got = 0;
+    uint32_t convert = 0;
+#if ES8311_I2S_MONO_SLOTS
+    size_t bytes = 0;
+    i2s_channel_read(rx_handle_, dest, samples * sizeof(int16_t), &bytes, pdMS_TO_TICKS(IO_TIMEOUT_MS));
+    got = bytes / sizeof(int16_t);
+#else
+    while (got < samples) {
+        int n = samples - got;
+        if (n > ES8311_STEREO_CHUNK) n = ES8311_STEREO_CHUNK;
+        size_t bytes = 0;
+        if (i2s_channel_read(rx_handle_, rx_stereo_buf, n * sizeof(uint32_t), &bytes,
+                             pdMS_TO_TICKS(IO_TIMEOUT_MS)) != ESP_OK) break;
+        int frames = bytes / sizeof(uint32_t);
+        uint32_t c0 = esp_cpu_get_cycle_count();
+        int16_t* out = dest + got;
+        for (int i = 0; i < frames; i++) {
+            out[i] = (int16_t)rx_stereo_buf[i];  // Left slot (first in memory)
+        }
+        convert += esp_cpu_get_cycle_count() - c0;
+        got += frames;
+        if (frames < n) break;
+    }
+#endif
+    uint32_t cycles = esp_cpu_get_cycle_count() - t0;
+    ReleaseIo();
+
+    io_reads_++;
+    read_cycles_ += cycles;
+    if (cycles > read_cycles_max_) read_cycles_max_ = cycles;
+    convert_cycles_ += convert;
+
+    if (got < samples) {
+        memset(dest + got, 0, (samples - got) * sizeof(int16_t));
     }
-    return samples;
+    return got;
 }
 
 int Es8311AudioCodec::Write(const int16_t* data, int samples) {
-    if (output_enabled_ && dev_) {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_write(dev_, (void*)data, samples * sizeof(int16_t)));
+    if (!output_enabled_ || !AcquireIo()) return 0;
+
+    io_writes_++;
+#if ES8311_I2S_MONO_SLOTS
+    size_t bytes = 0;
+    ESP_ERROR_CHECK_WITHOUT_ABORT(i2s_channel_write(tx_handle_, data, samples * sizeof(int16_t), &bytes,
+                                                    pdMS_TO_TICKS(IO_TIMEOUT_MS)));
+    ReleaseIo();
+    return bytes / sizeof(int16_t);
+#else
+    int written = 0;
+    while (written < samples) {
+        int n = samples - written;
+        if (n > ES8311_STEREO_CHUNK) n = ES8311_STEREO_CHUNK;
+        uint32_t c0 = esp_cpu_get_cycle_count();
+        const int16_t* in = data + written;
+        for (int i = 0; i < n; i++) {
+            uint32_t s = (uint16_t)in[i];
+            tx_stereo_buf[i] = s | (s << 16);  // Same sample on both slots
+        }
+        convert_cycles_ += esp_cpu_get_cycle_count() - c0;
+        size_t bytes = 0;
+        if (i2s_channel_write(tx_handle_, tx_stereo_buf, n * sizeof(uint32_t), &bytes,
+                              pdMS_TO_TICKS(IO_TIMEOUT_MS)) != ESP_OK) break;
+        written += bytes / sizeof(uint32_t);
     }
-    return samples;
+    ReleaseIo();
+    return written;
+#endif
+}
+
+void Es8311AudioCodec::LogIoStats(const char* tag) {
+    if (io_reads_ == 0 && io_writes_ == 0) return;
+    uint32_t blocks = io_reads_ + io_writes_;
+    ESP_LOGI(tag, "Codec I/O (%d slot%s): reads=%lu read cycles avg=%lu max=%lu, writes=%lu, convert avg=%lu cycles/block",
+             I2S_SLOTS, I2S_SLOTS > 1 ? "s" : "", io_reads_,
+             io_reads_ ? (uint32_t)(read_cycles_ / io_reads_) : 0, read_cycles_max_,
+             io_writes_, (uint32_t)(convert_cycles_ / blocks));
+    if (io_quiesce_waits_) {
+        ESP_LOGI(tag, "Codec I/O: device close waited %lu ticks for in-flight I/O", io_quiesce_waits_);
+    }
+}
+
+void Es8311AudioCodec::ResetIoStats() {
+    io_reads_ = 0;
+    io_writes_ = 0;
+    read_cycles_ = 0;
+    read_cycles_max_ = 0;
+    convert_cycles_ = 0;
+    io_quiesce_waits_ = 0;
 }
@@ -5,8 +5,34 @@
 #include <driver/gpio.h>
 #include <esp_codec_dev.h>
 #include <esp_codec_dev_defaults.h>
+#include <atomic>
 #include <mutex>
 
+// Run I2S with a single (left) slot so DMA carries no dead samples; the
+// ES8311 is mono in both directions. Set to 0 for stereo slots, where the
+// direct I/O path duplicates/drops the second slot in software.
+#ifndef ES8311_I2S_MONO_SLOTS
+#define ES8311_I2S_MONO_SLOTS 1
+#endif
+
+// Stereo-slot conversion scratch, in frames
+#define ES8311_STEREO_CHUNK 240
+
+// Statically allocated by Es8311AudioCodec (see memory_plan.h): one stereo
+// scratch per direction, since InputTask reads while OutputTask writes
+constexpr size_t CODEC_STATIC_BYTES =
+    ES8311_I2S_MONO_SLOTS ? 0 : 2 * ES8311_STEREO_CHUNK * sizeof(uint32_t);
+
+// Data-path switching counters (device open/close, DMA rebuilds) since
+// the last ResetSwitchStats(); the codec_stress control message reports them
+struct CodecSwitchStats {
+    uint32_t quiesces = 0;       // Closes/rebuilds that unpublished the data path
+    uint32_t drained = 0;        // ...of which found Read/Write calls in flight
+    uint32_t drain_max_us = 0;   // Longest wait for those calls to finish
+    uint32_t refused = 0;        // Read/Write calls turned away while unpublished
+    int io_users = 0;            // Calls in flight right now
+};
+
 class Es8311AudioCodec : public AudioCodec {
 public:
     Es8311AudioCodec(i2c_master_bus_handle_t i2c_bus, i2c_port_t i2c_port,
@@ -19,11 +45,26 @@ public:
     void SetOutputVolume(int volume) override;
     void EnableInput(bool enable) override;
     void EnableOutput(bool enable) override;
+    bool SetDmaConfig(int desc_num, int frame_num) override;
+    void LogIoStats(const char* tag) override;
+    void ResetIoStats() override;
+
+    CodecSwitchStats switch_stats();
+    void ResetSwitchStats();
 
 private:
-    void CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws,
-                              gpio_num_t dout, gpio_num_t din);
+    void CreateDuplexChannels();
+    void CreateDataInterface();
     void UpdateDeviceState();
+    // Enabled I2S channels hold the driver's PM lock, so idle = disabled
+    void SetChannelsEnabled(bool enable);
+
+    // Lock-free guard for Read/Write: succeeds only while the data path is
+    // published. Control paths (holding mutex_) unpublish, then wait for
+    // in-flight I/O to drain before closing the device or channels.
+    bool AcquireIo();
+    void ReleaseIo() { io_users_.fetch_sub(1); }
+    void QuiesceIo();
 
     int Read(int16_t* dest, int samples) override;
     int Write(const int16_t* data, int samples) override;
@@ -33,6 +74,23 @@ private:
     const audio_codec_if_t* codec_if_ = nullptr;
     const audio_codec_gpio_if_t* gpio_if_ = nullptr;
 
-    esp_codec_dev_handle_t dev_ = nullptr;
+    gpio_num_t mclk_, bclk_, ws_, dout_, din_;
+    bool channels_enabled_ = false;
+
+    esp_codec_dev_handle_t dev_ = nullptr;   // Owned by control paths (mutex_)
     std::mutex mutex_;
+    std::atomic<bool> io_ready_{false};     // dev_ open and channels valid
+    std::atomic<int> io_users_{0};          // Read/Write calls in flight
+    uint32_t io_quiesce_waits_ = 0;
+    uint32_t io_quiesces_ = 0;              // Switch counters, written under mutex_...
+    uint32_t io_drained_ = 0;
+    uint32_t io_drain_max_us_ = 0;
+    std::atomic<uint32_t> io_refused_{0};   // ...except this one (I/O tasks)
+
+    // Direct I/O cost (reads don't block once WaitForInput() returned)
+    uint32_t io_reads_ = 0;
+    uint32_t io_writes_ = 0;
+    uint64_t read_cycles_ = 0;
+    uint32_t read_cycles_max_ = 0;
+    uint64_t convert_cycles_ = 0;  // Mono<->stereo conversion, both directions
 };
@@ -0,0 +1,211 @@
+#include "flight_recorder.h"
+#include <freertos/FreeRTOS.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <mbedtls/base64.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "Flight"
+
+static const char* const kKinds[FLIGHT_KIND_COUNT] = {
+    "uplink", "downlink", "underrun", "drop_encode", "drop_decode", "drop_playback", "drop_uplink",
+};
+
+volatile bool flight_armed = false;
+
+// Writers are the codec, output, input and transport tasks; one short
+// critical section per record (header + at most one Opus packet)
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t* ring = nullptr;
+static uint32_t start = 0;         // Offset of the oldest whole record
+static uint32_t used = 0;          // Bytes of whole records from start
+static uint32_t records = 0;
+static uint32_t overwritten = 0;   // Records pushed out since the last dump
+
+static int underrun_trip = FLIGHT_UNDERRUN_TRIP;
+static int drop_trip = FLIGHT_DROP_TRIP;
+static int64_t window_start_us = 0;
+static int window_underruns = 0;
+static int window_drops = 0;
+static const char* trip_reason = nullptr;  // Set once tripped
+static int64_t trip_us = 0;
+static volatile bool frozen = false;
+
+static void ring_put(uint32_t pos, const void* src, size_t n) {
+    pos %= FLIGHT_RING_BYTES;
+    size_t first = FLIGHT_RING_BYTES - pos < n ? FLIGHT_RING_BYTES - pos : n;
+    memcpy(ring + pos, src, first);
+    memcpy(ring, (const uint8_t*)src + first, n - first);
+}
+
+static void ring_get(uint32_t pos, void* dst, size_t n) {
+    pos %= FLIGHT_RING_BYTES;
+    size_t first = FLIGHT_RING_BYTES - pos < n ? FLIGHT_RING_BYTES - pos : n;
+    memcpy(dst, ring + pos, first);
+    memcpy((uint8_t*)dst + first, ring, n - first);
+}
+
+// Caller holds lock
+static void reset_locked() {
+    start = used = records = overwritten = 0;
+    window_start_us = 0;
+    window_underruns = window_drops = 0;
+    trip_reason = nullptr;
+    trip_us = 0;
+    frozen = false;
+}
+
+// Caller holds lock
+static bool freeze_due_locked(int64_t now) {
+    if (trip_reason && !frozen && now - trip_us >= FLIGHT_POST_TRIGGER_MS * 1000LL) frozen = true;
+    return frozen;
+}
+
+void FlightWrite(FlightKind kind, uint32_t arg, int depth, const uint8_t* data, size_t len) {
+    if (!ring || frozen) return;
+    if (!data || len + sizeof(FlightRecord) > FLIGHT_RING_BYTES / 4) len = 0;
+    int64_t now = esp_timer_get_time();
+    FlightRecord r = {
+        .ts_us = (uint32_t)now,
+        .kind = kind,
+        .depth = (uint8_t)(depth < 0 ? 0 : depth > 255 ? 255 : depth),
+        .len = (uint16_t)len,
+        .arg = arg,
+    };
+    uint32_t size = sizeof(r) + len;
+    const char* tripped = nullptr;
+
+    portENTER_CRITICAL(&lock);
+    if (!freeze_due_locked(now)) {
+        while (used + size > FLIGHT_RING_BYTES) {
+            FlightRecord old;
+            ring_get(start, &old, sizeof(old));
+            start = (start + sizeof(old) + old.len) % FLIGHT_RING_BYTES;
+            used -= sizeof(old) + old.len;
+            records--;
+            overwritten++;
+        }
+        ring_put(start + used, &r, sizeof(r));
+        if (len) ring_put(start + used + sizeof(r), data, len);
+        used += size;
+        records++;
+
+        if (!trip_reason && kind >= FLIGHT_UNDERRUN) {
+            if (now - window_start_us > FLIGHT_TRIP_WINDOW_MS * 1000LL) {
+                window_start_us = now;
+                window_underruns = window_drops = 0;
+            }
+            if (kind == FLIGHT_UNDERRUN) window_underruns++;
+            else window_drops++;
+            if (underrun_trip && window_underruns >= underrun_trip) trip_reason = "underruns";
+            else if (drop_trip && window_drops >= drop_trip) trip_reason = "drops";
+            if (trip_reason) {
+                trip_us = now;
+                tripped = trip_reason;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (tripped) {
+        ESP_LOGW(TAG, "Tripped on %s: freezing in %dms", tripped, FLIGHT_POST_TRIGGER_MS);
+    }
+}
+
+bool FlightArm(int underrun_trips, int drop_trips) {
+    if (!ring) {
+        // Internal RAM: written from the audio tasks with interrupts masked
+        ring = (uint8_t*)heap_caps_malloc(FLIGHT_RING_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (!ring) {
+            ESP_LOGE(TAG, "No memory for the %d byte ring", FLIGHT_RING_BYTES);
+            return false;
+        }
+    }
+    portENTER_CRITICAL(&lock);
+    underrun_trip = underrun_trips;
+    drop_trip = drop_trips;
+    reset_locked();
+    portEXIT_CRITICAL(&lock);
+    flight_armed = true;
+    ESP_LOGI(TAG, "Armed: %d bytes, trips on %d underruns / %d drops in %dms",
+             FLIGHT_RING_BYTES, underrun_trips, drop_trips, FLIGHT_TRIP_WINDOW_MS);
+    return true;
+}
+
+void FlightDisarm() {
+    flight_armed = false;
+}
+
+void FlightFreeze(const char* reason) {
+    if (!ring) return;
+    portENTER_CRITICAL(&lock);
+    if (!trip_reason) {
+        trip_reason = reason;
+        trip_us = esp_timer_get_time();
+    }
+    frozen = true;
+    portEXIT_CRITICAL(&lock);
+}
+
+bool FlightDumpReady() {
+    if (!ring || !trip_reason) return false;
+    portENTER_CRITICAL(&lock);
+    bool ready = freeze_due_locked(esp_timer_get_time());
+    portEXIT_CRITICAL(&lock);
+    return ready;
+}
+
+int FlightDump(const TraceSendFn& send, const TraceClockFn& to_server) {
+    if (!ring) return 0;
+    FlightFreeze("manual");  // No writers while the ring is read out
+
+    const size_t buf_size = 128 + FLIGHT_DUMP_BYTES * 4 / 3 + 4;
+    char* buf = (char*)malloc(buf_size);
+    if (!buf) return 0;
+
+    // Meta: the host tool needs the kind table and a 64-bit "now" to unwrap
+    // timestamps; now_srv_us lines the dump up with server logs
+    int64_t now = esp_timer_get_time();
+    int64_t now_srv = to_server ? to_server(now) : 0;
+    int parts = (used + FLIGHT_DUMP_BYTES - 1) / FLIGHT_DUMP_BYTES;
+    int n = snprintf(buf, buf_size,
+                     "{\"type\":\"flight_meta\",\"reason\":\"%s\",\"now_us\":%lld,\"trip_us\":%lld,",
+                     trip_reason, (long long)now, (long long)trip_us);
+    if (now_srv) n += snprintf(buf + n, buf_size - n, "\"now_srv_us\":%lld,", (long long)now_srv);
+    n += snprintf(buf + n, buf_size - n, "\"bytes\":%lu,\"records\":%lu,\"parts\":%d,\"kinds\":[",
+                  (unsigned long)used, (unsigned long)records, parts);
+    for (int k = 0; k < FLIGHT_KIND_COUNT; k++) {
+        n += snprintf(buf + n, buf_size - n, "%s\"%s\"", k ? "," : "", kKinds[k]);
+    }
+    n += snprintf(buf + n, buf_size - n, "]}");
+    send(buf, n);
+
+    int sent = 0;
+    for (int p = 0; p < parts; p++) {
+        uint32_t off = p * FLIGHT_DUMP_BYTES;
+        uint32_t k = used - off < FLIGHT_DUMP_BYTES ? used - off : FLIGHT_DUMP_BYTES;
+        uint8_t chunk[FLIGHT_DUMP_BYTES];
+        ring_get(start + off, chunk, k);
+        n = snprintf(buf, buf_size, "{\"type\":\"flight_dump\",\"part\":%d,\"data\":\"", p);
+        size_t olen = 0;
+        mbedtls_base64_encode((unsigned char*)buf + n, buf_size - n - 2, &olen, chunk, k);
+        n += olen;
+        n += snprintf(buf + n, buf_size - n, "\"}");
+        if (!send(buf, n)) break;
+        sent += k;
+    }
+    n = snprintf(buf, buf_size, "{\"type\":\"flight_end\",\"bytes\":%d,\"overwritten\":%lu}",
+                 sent, (unsigned long)overwritten);
+    send(buf, n);
+    free(buf);
+
+    ESP_LOGI(TAG, "Dump (%s): %lu records, %d bytes (%lu overwritten)",
+             trip_reason, (unsigned long)records, sent, (unsigned long)overwritten);
+    portENTER_CRITICAL(&lock);
+    reset_locked();  // Record again from here
+    portEXIT_CRITICAL(&lock);
+    return sent;
+}
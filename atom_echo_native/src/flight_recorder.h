@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "trace.h"
+
+// Audio flight recorder: the last few seconds of uplink and downlink Opus
+// packets (as sent / as they arrived, with the queue depth at that moment)
+// plus underrun and drop events, in one fixed-size byte ring. The oldest
+// records are overwritten. When underruns or drops pass a threshold within
+// FLIGHT_TRIP_WINDOW_MS it records FLIGHT_POST_TRIGGER_MS more, then
+// freezes until dumped over the WebSocket; tools/flight_replay.py turns the
+// dump back into audio and a timeline. The ring is allocated on the first
+// FlightArm() and kept; while disarmed a hook costs one load and branch.
+#define FLIGHT_RING_BYTES       (24 * 1024)  // ~3.5s of 24kbps uplink + 32kbps downlink
+#define FLIGHT_UNDERRUN_TRIP    2            // Default thresholds within the window
+#define FLIGHT_DROP_TRIP        3
+#define FLIGHT_TRIP_WINDOW_MS   2000
+#define FLIGHT_POST_TRIGGER_MS  500          // What happened next is part of the story
+#define FLIGHT_DUMP_BYTES       288          // Ring bytes per flight_dump message (384 base64)
+
+// Names (kKinds in flight_recorder.cc) go out in flight_meta for the host tool
+enum FlightKind : uint8_t {
+    FLIGHT_UPLINK,          // Opus frame handed to the transport, depth: unacked uplink frames
+    FLIGHT_DOWNLINK,        // Opus frame arrived (len 0: lost, concealed), depth: downlink fill
+    FLIGHT_UNDERRUN,        // Playback resumed after running dry, arg: seq
+    FLIGHT_DROP_ENCODE,     // Mic frame dropped, encode queue full
+    FLIGHT_DROP_DECODE,     // Downlink frame dropped, decode queue full, arg: seq
+    FLIGHT_DROP_PLAYBACK,   // Decoded frame dropped, playback queue full, arg: seq
+    FLIGHT_DROP_UPLINK,     // Uplink buffered offline and overwritten
+    FLIGHT_KIND_COUNT,
+};
+
+struct FlightRecord {
+    uint32_t ts_us;   // esp_timer time, low 32 bits
+    uint8_t kind;     // FlightKind
+    uint8_t depth;    // Queue depth in frames (saturates at 255)
+    uint16_t len;     // Opus bytes following the header
+    uint32_t arg;     // Sequence number
+};
+static_assert(sizeof(FlightRecord) == 12, "flight record header must stay compact");
+
+extern volatile bool flight_armed;
+void FlightWrite(FlightKind kind, uint32_t arg, int depth, const uint8_t* data = nullptr, size_t len = 0);
+
+#define FLIGHT(kind, arg, depth, ...) \
+    do { if (flight_armed) FlightWrite((kind), (arg), (depth), ##__VA_ARGS__); } while (0)
+
+// Start recording (trip thresholds: counts within the window, 0 = never).
+// False if internal RAM is short for the ring.
+bool FlightArm(int underrun_trip = FLIGHT_UNDERRUN_TRIP, int drop_trip = FLIGHT_DROP_TRIP);
+void FlightDisarm();
+// Freeze now, as if tripped (server asked for a dump)
+void FlightFreeze(const char* reason);
+// Frozen and the post-trigger time is over: ready for FlightDump()
+bool FlightDumpReady();
+
+// Send the ring as JSON messages: flight_meta (why it froze, 64-bit "now"
+// on both clocks), flight_dump parts (base64 ring bytes, oldest first),
+// flight_end. Then clears the ring and records again if it was armed.
+int FlightDump(const TraceSendFn& send, const TraceClockFn& to_server = nullptr);
@@ -0,0 +1,43 @@
+#include "latency_profile.h"
+#include <cstring>
+
+static constexpr LatencyProfile kProfiles[] = {
+    // name        desc frame  enc dec  pb target credit
+    {"low",         4,  120,    2,  10,  4,  1,  3},   // Quiet home network
+    {"balanced",    6,  240,    4,  30, 20,  2,  4},   // Default
+    {"robust",      8,  240,    6,  40, 30,  4,  6},   // Busy / lossy WiFi
+};
+
+static constexpr bool ProfilesFitQueues() {
+    for (const auto& p : kProfiles) {
+        if (p.encode_queue_depth > LATENCY_MAX_ENCODE_DEPTH ||
+            p.decode_queue_depth > LATENCY_MAX_DECODE_DEPTH ||
+            p.playback_queue_depth > LATENCY_MAX_PLAYBACK_DEPTH ||
+            p.playback_target_depth > p.playback_queue_depth ||
+            p.credit_window < p.playback_target_depth || p.credit_window > p.decode_queue_depth) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(ProfilesFitQueues(), "latency profile exceeds LATENCY_MAX_* queue capacity");
+
+const LatencyProfile& DefaultLatencyProfile() {
+    return kProfiles[1];
+}
+
+const LatencyProfile* FindLatencyProfile(const char* name) {
+    if (!name) return nullptr;
+    for (const auto& p : kProfiles) {
+        if (strcmp(p.name, name) == 0) return &p;
+    }
+    return nullptr;
+}
+
+LatencyBudget GetLatencyBudget(const LatencyProfile& profile, int sample_rate, int frame_ms) {
+    LatencyBudget b;
+    b.dma_ms = sample_rate > 0 ? profile.dma_desc_num * profile.dma_frame_num * 1000 / sample_rate : 0;
+    b.uplink_ms = b.dma_ms + frame_ms + profile.encode_queue_depth * frame_ms;
+    b.downlink_ms = (profile.decode_queue_depth + profile.playback_queue_depth) * frame_ms + b.dma_ms;
+    return b;
+}
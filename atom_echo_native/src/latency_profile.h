@@ -0,0 +1,31 @@
+#pragma once
+
+// Named buffering presets: I2S DMA depth plus AudioService queue depths.
+// Queues are allocated once at the LATENCY_MAX_* capacity; a profile only
+// changes how full they are allowed to get.
+struct LatencyProfile {
+    const char* name;
+    int dma_desc_num;
+    int dma_frame_num;
+    int encode_queue_depth;
+    int decode_queue_depth;
+    int playback_queue_depth;
+    int playback_target_depth;  // Frames queued (decode + playback) that time-stretch steers toward
+    int credit_window;          // Downlink frames the server may have queued or in flight
+};
+
+#define LATENCY_MAX_ENCODE_DEPTH   6
+#define LATENCY_MAX_DECODE_DEPTH   40
+#define LATENCY_MAX_PLAYBACK_DEPTH 30
+
+// Worst-case buffering implied by a profile, in milliseconds
+struct LatencyBudget {
+    int dma_ms;       // One I2S direction (TX and RX are sized alike)
+    int uplink_ms;    // Mic → encoder: DMA + frame accumulation + encode queue
+    int downlink_ms;  // Network → speaker: decode + playback queues + DMA
+};
+
+const LatencyProfile& DefaultLatencyProfile();
+// Returns nullptr for unknown names
+const LatencyProfile* FindLatencyProfile(const char* name);
+LatencyBudget GetLatencyBudget(const LatencyProfile& profile, int sample_rate, int frame_ms);
@@ -0,0 +1,98 @@
+#include "loopback_probe.h"
+#include <esp_timer.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+LoopbackProbe::~LoopbackProbe() {
+    free(chirp_);
+    free(capture_);
+}
+
+bool LoopbackProbe::Init(int sample_rate) {
+    if (sample_rate <= 0 || chirp_) return false;
+    sample_rate_ = sample_rate;
+    chirp_samples_ = sample_rate * LOOPBACK_CHIRP_MS / 1000;
+    capture_capacity_ = sample_rate * LOOPBACK_CAPTURE_MS / 1000;
+    chirp_ = (int16_t*)malloc(chirp_samples_ * sizeof(int16_t));
+    capture_ = (int16_t*)malloc(capture_capacity_ * sizeof(int16_t));
+    if (!chirp_ || !capture_) return false;
+
+    // Linear sweep f0→f1 with 1ms raised-cosine edges (no click at either end)
+    const float T = (float)LOOPBACK_CHIRP_MS / 1000;
+    const float k = (LOOPBACK_CHIRP_F1_HZ - LOOPBACK_CHIRP_F0_HZ) / T;
+    const int taper = sample_rate / 1000;
+    for (int i = 0; i < chirp_samples_; i++) {
+        float t = (float)i / sample_rate;
+        float phase = 2.0f * (float)M_PI * (LOOPBACK_CHIRP_F0_HZ * t + 0.5f * k * t * t);
+        float env = 1.0f;
+        int edge = i < chirp_samples_ - 1 - i ? i : chirp_samples_ - 1 - i;
+        if (edge < taper) env = 0.5f - 0.5f * cosf((float)M_PI * edge / taper);
+        chirp_[i] = (int16_t)(LOOPBACK_CHIRP_LEVEL * env * sinf(phase));
+    }
+    BeginRun();
+    return true;
+}
+
+void LoopbackProbe::BeginRun() {
+    chunks_ = 0;
+    overrun_ = false;
+    played_us_ = 0;
+    captured_ = 0;
+}
+
+void LoopbackProbe::PushCapture(const int16_t* pcm, int samples, int64_t end_us, bool overrun) {
+    int have = captured_;
+    if (!capture_ || have >= capture_capacity_ || chunks_ >= LOOPBACK_MAX_CHUNKS) return;
+    if (end_us <= 0) end_us = esp_timer_get_time();
+
+    int n = samples < capture_capacity_ - have ? samples : capture_capacity_ - have;
+    memcpy(capture_ + have, pcm, n * sizeof(int16_t));
+    // The chunk's timestamp belongs to its last sample, even if we keep fewer
+    chunk_end_[chunks_] = have + samples;
+    chunk_us_[chunks_] = end_us;
+    chunks_ = chunks_ + 1;
+    if (overrun) overrun_ = true;
+    captured_ = have + n;
+}
+
+int64_t LoopbackProbe::SampleTime(int index) const {
+    for (int c = 0; c < chunks_; c++) {
+        if (index < chunk_end_[c]) {
+            return chunk_us_[c] - (int64_t)(chunk_end_[c] - 1 - index) * 1000000 / sample_rate_;
+        }
+    }
+    return 0;
+}
+
+int LoopbackProbe::Analyze(int* peak_ratio) {
+    if (peak_ratio) *peak_ratio = 0;
+    int lags = captured_ - chirp_samples_;
+    if (lags <= 0) return -1;
+
+    // Brute-force cross-correlation (~3M MACs for 300ms at 24kHz). Polarity
+    // through speaker and mic is unknown, so the peak is taken on |r|.
+    int64_t best = 0;
+    int best_lag = 0;
+    int64_t sum_abs = 0;
+    for (int lag = 0; lag < lags; lag++) {
+        const int16_t* x = capture_ + lag;
+        int64_t r = 0;
+        for (int i = 0; i < chirp_samples_; i++) {
+            r += (int32_t)x[i] * chirp_[i];
+        }
+        if (r < 0) r = -r;
+        sum_abs += r;
+        if (r > best) {
+            best = r;
+            best_lag = lag;
+        }
+    }
+    int64_t mean = sum_abs / lags;
+    int ratio = mean > 0 ? (int)(best / mean) : 0;
+    if (peak_ratio) *peak_ratio = ratio;
+
+    if (ratio < LOOPBACK_MIN_PEAK_RATIO || overrun_ || played_us_ <= 0) return -1;
+    int64_t latency = SampleTime(best_lag) - played_us_;
+    return latency > 0 ? (int)latency : -1;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+// Acoustic loopback probe: a linear chirp is played through the speaker
+// while the mic records, and cross-correlation finds where it landed.
+// Captured samples are mapped back to esp_timer time through the RX DMA
+// timestamps, so the result is true speaker→mic round trip including
+// both DMA rings, not just sample offsets.
+#define LOOPBACK_CHIRP_MS       20
+#define LOOPBACK_CHIRP_F0_HZ    1000
+#define LOOPBACK_CHIRP_F1_HZ    6000
+#define LOOPBACK_CHIRP_LEVEL    12000  // Peak amplitude
+#define LOOPBACK_CAPTURE_MS     300    // Per run; must cover pre-roll + worst-case latency
+#define LOOPBACK_MAX_CHUNKS     (LOOPBACK_CAPTURE_MS / 10 + 2)
+#define LOOPBACK_MAX_RUNS       10
+#define LOOPBACK_MIN_PEAK_RATIO 6      // Correlation peak / mean |xcorr| to count as a hit
+
+class LoopbackProbe {
+public:
+    LoopbackProbe() = default;
+    ~LoopbackProbe();
+
+    // Allocates the chirp and capture buffers (freed in the destructor)
+    bool Init(int sample_rate);
+    const int16_t* chirp() const { return chirp_; }
+    int chirp_samples() const { return chirp_samples_; }
+
+    // Start a run: clear the capture, then record until Full()
+    void BeginRun();
+    // Playback side: esp_timer time the chirp's first sample was handed to the codec
+    void MarkPlayed(int64_t us) { played_us_ = us; }
+    // Capture side: one raw chunk and the CaptureInfo time of its last sample
+    void PushCapture(const int16_t* pcm, int samples, int64_t end_us, bool overrun);
+    bool Full() const { return captured_ >= capture_capacity_; }
+
+    // Round-trip latency of the current run in us, or -1 if the chirp was
+    // not found (or a DMA overrun made the timing unreliable).
+    // peak_ratio receives the detection quality either way.
+    int Analyze(int* peak_ratio);
+
+private:
+    int64_t SampleTime(int index) const;
+
+    int sample_rate_ = 0;
+    int16_t* chirp_ = nullptr;
+    int chirp_samples_ = 0;
+    int16_t* capture_ = nullptr;
+    int capture_capacity_ = 0;
+    volatile int captured_ = 0;
+    volatile bool overrun_ = false;
+    volatile int64_t played_us_ = 0;
+
+    // Chunk boundaries: end index (exclusive) and time of its last sample
+    int chunk_end_[LOOPBACK_MAX_CHUNKS] = {};
+    int64_t chunk_us_[LOOPBACK_MAX_CHUNKS] = {};
+    volatile int chunks_ = 0;
+};
@@ -1,10 +1,16 @@
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
 #include <cmath>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/event_groups.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_pm.h>
+#include <esp_app_desc.h>
+#include <esp_sleep.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_netif.h>
@@ -12,10 +18,20 @@
 #include <driver/i2c_master.h>
 #include <driver/gpio.h>
 #include <driver/rmt_tx.h>
+#include <cJSON.h>
+#include <sdkconfig.h>
 
 #include "es8311_audio_codec.h"
 #include "audio_service.h"
 #include "ws_transport.h"
+#include "udp_audio.h"
+#include "wifi_station.h"
+#include "memory_plan.h"
+#include "audio_bench.h"
+#include "codec_stress.h"
+#include "trace.h"
+#include "flight_recorder.h"
+#include "control_message.h"
 
 #define TAG "main"
 
@@ -50,20 +66,19 @@
 #define SAMPLE_RATE 24000
 
 // ========== WiFi Config ==========
-// WiFi networks (tried in order)
-struct WiFiCredential { const char* ssid; const char* password; };
-static const WiFiCredential wifi_list[] = {
+// WiFi networks (last-good AP first, then ranked by RSSI)
+static const WifiCredential wifi_list[] = {
     {"your_wifi_ssid",  "your_wifi_password"},
     // Add more networks for automatic failover:
     // {"backup_ssid", "backup_password"},
 };
-static int wifi_index = 0;
-static int wifi_retry = 0;
-#define WIFI_MAX_RETRY 3
 #define BACKEND_IP    "192.168.x.x"  // IP of machine running voice_assistant.py
 
-// WebSocket URI
+// WebSocket URI. For wss:// (server started with TLS_CERT/TLS_KEY) paste
+// the server's certificate below; it is pinned as the only trusted one.
 #define WS_URI "ws://" BACKEND_IP ":8765"
+static const char ws_server_cert_pem[] =
+    "";  // "-----BEGIN CERTIFICATE-----\n...\n-----END CERTIFICATE-----\n"
 
 // ========== Globals ==========
 static i2c_master_bus_handle_t i2c_bus = nullptr;
@@ -71,11 +86,30 @@ static i2c_master_dev_handle_t pi4ioe_dev = nullptr;
 static Es8311AudioCodec* codec = nullptr;
 static AudioService* audio_svc = nullptr;
 static WsTransport* ws = nullptr;
-
-static volatile bool wifi_connected = false;
+static UdpAudio* udp = nullptr;
+static WifiStation* wifi = nullptr;
 
 // Processing state — blocks recording while LLM/TTS is active
 static volatile bool processing = false;
+// Latency profile requested by the server, applied once audio is idle
+static const LatencyProfile* volatile pending_latency_profile = nullptr;
+// Loopback latency test requested by the server (run count), run once idle
+static volatile int pending_loopback_runs = 0;
+// Kernel microbenchmark requested by the server (iterations), run once idle
+static volatile int pending_bench_iterations = 0;
+// Codec I/O switching stress run requested by the server (ms), run once idle
+static volatile int pending_codec_stress_ms = 0;
+// Trace dump requested by the server, sent once idle
+static volatile bool pending_trace_dump = false;
+// Downlink credit reports: period (0 = off, server paces blindly) and last grant
+#define CREDIT_INTERVAL_MS 60  // Default: one frame
+static volatile int credit_interval_ms = CREDIT_INTERVAL_MS;
+static uint32_t credit_limit_sent = 0;
+static int64_t credit_sent_ms = 0;
+// WiFi RSSI for uplink bitrate control, polled while recording
+#define UPLINK_RSSI_POLL_MS 1000
+static int link_rssi = 0;
+static int64_t link_rssi_ms = 0;
 
 // Notification sound queue (set by WS callback, consumed by main loop)
 // 0=none, 1=thinking, 2=tool_call, 3=tool_result
@@ -182,61 +216,67 @@ static void i2c_init() {
     ESP_LOGI(TAG, "  Probe PI4IOE (0x43): %s", ret == ESP_OK ? "FOUND" : esp_err_to_name(ret));
 }
 
-// ========== WiFi ==========
-static void wifi_try_next() {
-    wifi_retry++;
-    if (wifi_retry >= WIFI_MAX_RETRY) {
-        wifi_retry = 0;
-        wifi_index = (wifi_index + 1) % (sizeof(wifi_list) / sizeof(wifi_list[0]));
-    }
-    const auto& cred = wifi_list[wifi_index];
-    ESP_LOGW(TAG, "WiFi trying %s (attempt %d/%d)", cred.ssid, wifi_retry + 1, WIFI_MAX_RETRY);
-
-    wifi_config_t cfg = {};
-    strncpy((char*)cfg.sta.ssid, cred.ssid, sizeof(cfg.sta.ssid));
-    strncpy((char*)cfg.sta.password, cred.password, sizeof(cfg.sta.password));
-    esp_wifi_set_config(WIFI_IF_STA, &cfg);
-    esp_wifi_connect();
-}
-
-static void wifi_event_handler(void* arg, esp_event_base_t base,
-                               int32_t id, void* data) {
-    if (base == WIFI_EVENT) {
-        if (id == WIFI_EVENT_STA_START) {
-            esp_wifi_connect();
-        } else if (id == WIFI_EVENT_STA_DISCONNECTED) {
-            wifi_connected = false;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            wifi_try_next();
-        }
-    } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*)data;
-        ESP_LOGI(TAG, "WiFi connected to %s, IP: " IPSTR,
-                 wifi_list[wifi_index].ssid, IP2STR(&event->ip_info.ip));
-        wifi_connected = true;
-        wifi_retry = 0;
-    }
+// ========== Power Management ==========
+// DFS + automatic light sleep (CONFIG_PM_ENABLE + tickless idle). AudioService
+// holds a CPU lock while streaming and the I2S driver holds one while the
+// codec is open, so going idle means closing the codec output.
+#define PM_MIN_FREQ_MHZ    40    // XTAL
+#define IDLE_POWER_DOWN_MS 3000  // Quiet time before codec output + WiFi go low power
+#define MAIN_IDLE_POLL_MS  200   // Main loop period in low power (button/WS wake it early)
+
+static TaskHandle_t main_task = nullptr;
+static volatile int64_t btn_edge_us = 0;
+static bool low_power = false;
+
+static void IRAM_ATTR button_isr(void* arg) {
+    // Level interrupt: masked until the main loop sees the release.
+    // GPIO39 can glitch while the SAR ADC (WiFi) is powered; the main loop
+    // re-reads the level, so a false trigger only costs a wakeup.
+    gpio_intr_disable(BTN_PIN);
+    btn_edge_us = esp_timer_get_time();
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(main_task, &woken);
+    portYIELD_FROM_ISR(woken);
 }
 
-static void wifi_init() {
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+static void power_init() {
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t pm_cfg = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = PM_MIN_FREQ_MHZ,
+        .light_sleep_enable = true,
+    };
+    esp_err_t err = esp_pm_configure(&pm_cfg);
+    ESP_LOGI(TAG, "Power management %d-%d MHz + light sleep: %s",
+             PM_MIN_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, esp_err_to_name(err));
+#endif
+}
 
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
+static void button_init() {
+    main_task = xTaskGetCurrentTaskHandle();
+    gpio_set_direction(BTN_PIN, GPIO_MODE_INPUT);
+    gpio_set_intr_type(BTN_PIN, GPIO_INTR_LOW_LEVEL);
+    gpio_install_isr_service(0);
+    gpio_isr_handler_add(BTN_PIN, button_isr, nullptr);
+    // Same level wakes the chip from light sleep
+    gpio_wakeup_enable(BTN_PIN, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+}
 
-    wifi_config_t wifi_cfg = {};
-    strncpy((char*)wifi_cfg.sta.ssid, wifi_list[0].ssid, sizeof(wifi_cfg.sta.ssid));
-    strncpy((char*)wifi_cfg.sta.password, wifi_list[0].password, sizeof(wifi_cfg.sta.password));
+static void wake_main_loop() {
+    if (main_task) xTaskNotifyGive(main_task);
+}
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_cfg));
-    ESP_ERROR_CHECK(esp_wifi_start());
-    ESP_LOGI(TAG, "WiFi connecting to %s...", wifi_list[0].ssid);
+// Low power: codec output closed (drops the I2S PM lock), WiFi modem sleep.
+// OutputTask closes the output at its next idle check, so downlink audio
+// arriving in between can't lose a block; leaving low power cancels that if
+// it hasn't happened and restores WiFi. OutputTask/notifications reopen it.
+static void set_low_power(bool enable) {
+    if (enable == low_power) return;
+    low_power = enable;
+    audio_svc->SetOutputPowerDown(enable);
+    esp_wifi_set_ps(enable ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE);
+    ESP_LOGI(TAG, "Low power %s", enable ? "on" : "off");
 }
 
 // ========== Notification Sounds (gentle, low-volume) ==========
@@ -385,28 +425,346 @@ static void play_chime() {
     ESP_LOGI(TAG, "Chime done");
 }
 
-// ========== Main ==========
-extern "C" void app_main(void) {
-    ESP_LOGI(TAG, "Atom Echo Voice Assistant starting...");
+// ========== Control Messages ==========
+#define WS_RESUME_GRACE_MS 30000  // Matches the server's session resume window
+
+// {"type":"session","session":"1a2b3c4d","resumed":true,"rx_seq":120,"tls_resumed":true}
+// tls_resumed only over wss: whether the server took our saved TLS session.
+// All scalars, so no cJSON tree; tools/host/control_dispatch runs the same
+// lookups on the server's reply.
+static void handle_session(const char* json, size_t len) {
+    char resumed[8], rx_seq[12], tls_resumed[8];
+    bool is_resumed = ControlField(json, len, "resumed", resumed, sizeof(resumed)) &&
+                      strcmp(resumed, "true") == 0;
+    ESP_LOGI(TAG, "Server session %s (server has uplink up to seq %lu)",
+             is_resumed ? "resumed" : "new",
+             ControlField(json, len, "rx_seq", rx_seq, sizeof(rx_seq)) ? strtoul(rx_seq, nullptr, 10) : 0UL);
+    if (ControlField(json, len, "tls_resumed", tls_resumed, sizeof(tls_resumed))) {
+        ws->NoteTlsResumed(strcmp(tls_resumed, "true") == 0);
+    }
+}
+
+// {"type":"udp_offer","port":8766,"ssrc":305419896,"seq":120} — the server
+// streams downlink audio over UDP once our probe reaches it (udp_ready)
+static void handle_udp_offer(const char* json, size_t len) {
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (!root) return;
+    cJSON* port = cJSON_GetObjectItem(root, "port");
+    cJSON* ssrc = cJSON_GetObjectItem(root, "ssrc");
+    cJSON* seq = cJSON_GetObjectItem(root, "seq");
+    if (cJSON_IsNumber(port) && cJSON_IsNumber(ssrc)) {
+        udp->Open(BACKEND_IP, (uint16_t)port->valueint, (uint32_t)ssrc->valuedouble,
+                  cJSON_IsNumber(seq) ? (uint32_t)seq->valuedouble : ws->rx_seq());
+    }
+    cJSON_Delete(root);
+}
+
+// Per-session downlink report, so the server can compare WS and UDP delivery
+static void send_playback_stats(const PlaybackStats& st) {
+    bool via_udp = udp->IsReady();
+    const UdpAudioStats& us = udp->stats();
+    char msg[256];
+    int n = snprintf(msg, sizeof(msg),
+                     "{\"type\":\"playback_stats\",\"transport\":\"%s\",\"rx\":%d,\"plc\":%d,"
+                     "\"dropped\":%d,\"played\":%d,\"underruns\":%d,\"rx_gap_max_ms\":%d,"
+                     "\"udp_lost\":%lu,\"udp_late\":%lu}",
+                     via_udp ? "udp" : "ws", st.rx, st.concealed, st.dropped, st.played,
+                     st.underruns, st.rx_gap_max_ms,
+                     (unsigned long)us.lost, (unsigned long)us.late);
+    ws->SendJson(msg, n);
+    udp->LogStats(TAG);
+}
+
+// {"type":"audio_config","ns":true,"agc":true,"agc_target_dbfs":-18,...}
+static void handle_audio_config(const char* json, size_t len) {
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (!root) return;
+
+    cJSON* ns = cJSON_GetObjectItem(root, "ns");
+    if (cJSON_IsBool(ns)) audio_svc->EnableNoiseSuppression(cJSON_IsTrue(ns));
+
+    cJSON* agc = cJSON_GetObjectItem(root, "agc");
+    if (cJSON_IsBool(agc)) audio_svc->EnableAgc(cJSON_IsTrue(agc));
+
+    cJSON* tsm = cJSON_GetObjectItem(root, "tsm");
+    if (cJSON_IsBool(tsm)) audio_svc->EnableTimeStretch(cJSON_IsTrue(tsm));
+
+    cJSON* cx_max = cJSON_GetObjectItem(root, "opus_cx_max");
+    if (cJSON_IsNumber(cx_max)) audio_svc->SetEncoderMaxComplexity(cx_max->valueint);
+
+    cJSON* up_min = cJSON_GetObjectItem(root, "uplink_min_bps");
+    cJSON* up_max = cJSON_GetObjectItem(root, "uplink_max_bps");
+    if (cJSON_IsNumber(up_min) || cJSON_IsNumber(up_max)) {
+        audio_svc->SetUplinkBitrateLimits(cJSON_IsNumber(up_min) ? up_min->valueint : UPLINK_DEFAULT_MIN_BPS,
+                                          cJSON_IsNumber(up_max) ? up_max->valueint : UPLINK_DEFAULT_MAX_BPS);
+    }
+
+    cJSON* credit_ms = cJSON_GetObjectItem(root, "credit_ms");
+    if (cJSON_IsNumber(credit_ms) && credit_ms->valueint >= 0) credit_interval_ms = credit_ms->valueint;
+
+    AgcConfig cfg = audio_svc->agc_config();
+    bool agc_changed = false;
+    struct { const char* key; int* field; } agc_fields[] = {
+        {"agc_target_dbfs", &cfg.target_dbfs},
+        {"agc_max_gain_db", &cfg.max_gain_db},
+        {"agc_min_gain_db", &cfg.min_gain_db},
+        {"agc_attack_ms", &cfg.attack_ms},
+        {"agc_release_ms", &cfg.release_ms},
+        {"agc_limiter_dbfs", &cfg.limiter_dbfs},
+        {"agc_gate_dbfs", &cfg.noise_gate_dbfs},
+    };
+    for (const auto& f : agc_fields) {
+        cJSON* item = cJSON_GetObjectItem(root, f.key);
+        if (cJSON_IsNumber(item)) {
+            *f.field = item->valueint;
+            agc_changed = true;
+        }
+    }
+    if (agc_changed) audio_svc->SetAgcConfig(cfg);
+
+    ESP_LOGI(TAG, "Audio config: ns=%d tsm=%d agc_update=%d", audio_svc->noise_suppression_enabled(),
+             audio_svc->time_stretch_enabled(), agc_changed);
+    cJSON_Delete(root);
+}
+
+// {"type":"latency_profile","name":"low"} — deferred until not recording/processing
+static void handle_latency_profile(const char* json, size_t len) {
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (!root) return;
+    cJSON* name = cJSON_GetObjectItem(root, "name");
+    const LatencyProfile* profile = cJSON_IsString(name) ? FindLatencyProfile(name->valuestring) : nullptr;
+    if (profile) {
+        pending_latency_profile = profile;
+    } else {
+        ESP_LOGW(TAG, "Unknown latency profile");
+    }
+    cJSON_Delete(root);
+}
+
+static void apply_latency_profile(const LatencyProfile* profile) {
+    if (!audio_svc->SetLatencyProfile(*profile)) return;
+    LatencyBudget b = audio_svc->latency_budget();
+    char reply[160];
+    int n = snprintf(reply, sizeof(reply),
+                     "{\"type\":\"latency_profile\",\"name\":\"%s\",\"dma_ms\":%d,\"uplink_ms\":%d,\"downlink_ms\":%d,"
+                     "\"credit_window\":%d}",
+                     profile->name, b.dma_ms, b.uplink_ms, b.downlink_ms, profile->credit_window);
+    ws->SendJson(reply, n);
+}
+
+// {"type":"loopback_test","runs":5} — deferred like latency_profile
+static void handle_loopback_test(const char* json, size_t len) {
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (!root) return;
+    cJSON* runs = cJSON_GetObjectItem(root, "runs");
+    pending_loopback_runs = cJSON_IsNumber(runs) && runs->valueint > 0 ? runs->valueint : 5;
+    cJSON_Delete(root);
+}
+
+static void run_loopback_test(int runs) {
+    set_low_power(false);
+    led_set(40, 40, 40);  // White = measuring
+    LoopbackResult r;
+    bool ok = audio_svc->RunLoopbackTest(runs, &r);
+    led_set(0, 20, 40);
+    LatencyBudget b = audio_svc->latency_budget();
+    char reply[320];
+    int n = snprintf(reply, sizeof(reply),
+                     "{\"type\":\"loopback_result\",\"ok\":%s,\"profile\":\"%s\",\"dma_ms\":%d,"
+                     "\"runs\":%d,\"detected\":%d,\"latency_min_us\":%d,\"latency_mean_us\":%d,"
+                     "\"latency_max_us\":%d,\"jitter_us\":%d,\"peak_ratio_min\":%d}",
+                     ok ? "true" : "false", audio_svc->latency_profile().name, b.dma_ms,
+                     r.runs, r.detected, r.latency_min_us, r.latency_mean_us,
+                     r.latency_max_us, r.jitter_us, r.peak_ratio_min);
+    ws->SendJson(reply, n);
+}
+
+// {"type":"bench","iterations":20} — deferred like latency_profile
+static void handle_bench(const char* json, size_t len) {
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (!root) return;
+    cJSON* iterations = cJSON_GetObjectItem(root, "iterations");
+    pending_bench_iterations = cJSON_IsNumber(iterations) && iterations->valueint > 0 ? iterations->valueint : 20;
+    cJSON_Delete(root);
+}
+
+// {"type":"codec_stress","ms":5000} — deferred like bench
+static void handle_codec_stress(const char* json, size_t len) {
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (!root) return;
+    cJSON* ms = cJSON_GetObjectItem(root, "ms");
+    pending_codec_stress_ms = cJSON_IsNumber(ms) && ms->valueint > 0 ? ms->valueint : 5000;
+    cJSON_Delete(root);
+}
+
+static void run_codec_stress(int ms) {
+    set_low_power(false);
+    led_set(40, 40, 40);  // White = measuring
+    CodecStressResult r;
+    bool ok = RunCodecStress(codec, ms, &r);
+    led_set(0, 20, 40);
+    char reply[384];
+    int n = snprintf(reply, sizeof(reply),
+                     "{\"type\":\"codec_stress_result\",\"ok\":%s,\"ms\":%d,\"toggles\":%lu,"
+                     "\"rebuilds\":%lu,\"reads\":%lu,\"writes\":%lu,\"bad_reads\":%lu,"
+                     "\"tasks_stopped\":%s,\"recovered\":%s,\"quiesces\":%lu,\"drained\":%lu,"
+                     "\"drain_max_us\":%lu,\"refused\":%lu,\"io_users\":%d}",
+                     ok ? "true" : "false", r.duration_ms, r.toggles, r.rebuilds, r.reads, r.writes,
+                     r.bad_reads, r.tasks_stopped ? "true" : "false", r.recovered ? "true" : "false",
+                     r.sw.quiesces, r.sw.drained, r.sw.drain_max_us, r.sw.refused, r.sw.io_users);
+    ws->SendJson(reply, n);
+}
+
+// {"type":"trace","action":"start"|"stop"|"dump"} — start/stop act at once;
+// a dump is deferred like bench so it doesn't compete with streaming audio
+static void handle_trace(const char* json, size_t len) {
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (!root) return;
+    cJSON* action = cJSON_GetObjectItem(root, "action");
+    const char* a = cJSON_IsString(action) ? action->valuestring : "";
+    if (strcmp(a, "start") == 0) {
+        bool ok = TraceStart();
+        char reply[64];
+        int n = snprintf(reply, sizeof(reply), "{\"type\":\"trace_started\",\"ok\":%s}", ok ? "true" : "false");
+        ws->SendJson(reply, n);
+    } else if (strcmp(a, "stop") == 0) {
+        TraceStop();
+    } else if (strcmp(a, "dump") == 0) {
+        pending_trace_dump = true;
+    } else {
+        ESP_LOGW(TAG, "Unknown trace action: %s", a);
+    }
+    cJSON_Delete(root);
+}
+
+// {"type":"flight","action":"arm"|"disarm"|"dump","underruns":N,"drops":N}
+// — arm takes optional trip thresholds; dump freezes the recorder now and
+// the main loop sends it once idle, as it does after a trip
+static void handle_flight(const char* json, size_t len) {
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (!root) return;
+    cJSON* action = cJSON_GetObjectItem(root, "action");
+    const char* a = cJSON_IsString(action) ? action->valuestring : "";
+    if (strcmp(a, "arm") == 0) {
+        cJSON* underruns = cJSON_GetObjectItem(root, "underruns");
+        cJSON* drops = cJSON_GetObjectItem(root, "drops");
+        bool ok = FlightArm(cJSON_IsNumber(underruns) ? underruns->valueint : FLIGHT_UNDERRUN_TRIP,
+                            cJSON_IsNumber(drops) ? drops->valueint : FLIGHT_DROP_TRIP);
+        char reply[64];
+        int n = snprintf(reply, sizeof(reply), "{\"type\":\"flight_armed\",\"ok\":%s}", ok ? "true" : "false");
+        ws->SendJson(reply, n);
+    } else if (strcmp(a, "disarm") == 0) {
+        FlightDisarm();
+    } else if (strcmp(a, "dump") == 0) {
+        FlightFreeze("manual");
+    } else {
+        ESP_LOGW(TAG, "Unknown flight action: %s", a);
+    }
+    cJSON_Delete(root);
+}
+
+// One message per kernel: a single report for every kernel runs past 2KB,
+// and each message must fit WS_MAX_FRAME_BYTES to be buffered offline
+static void run_bench(int iterations) {
+    set_low_power(false);
+    led_set(40, 40, 40);  // White = measuring
+    auto* results = (BenchResult*)malloc(BENCH_MAX_KERNELS * sizeof(BenchResult));
+    if (!results) {
+        ESP_LOGE(TAG, "Bench: no memory");
+        led_set(0, 20, 40);
+        return;
+    }
+    const esp_app_desc_t* app = esp_app_get_description();
+    int count = RunAudioBench(iterations, codec->input_sample_rate(), SAMPLE_RATE, results, BENCH_MAX_KERNELS);
+    led_set(0, 20, 40);
+
+    char reply[256];
+    int n = snprintf(reply, sizeof(reply),
+                     "{\"type\":\"bench_result\",\"iterations\":%d,\"cpu_mhz\":%d,\"frame_ms\":%d,"
+                     "\"build\":\"%s %s %s\",\"kernels\":%d}",
+                     iterations, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, OPUS_FRAME_DURATION_MS,
+                     app->version, app->date, app->time, count);
+    ws->SendJson(reply, n);
+    for (int i = 0; i < count; i++) {
+        const BenchResult& r = results[i];
+        n = snprintf(reply, sizeof(reply),
+                     "{\"type\":\"bench_kernel\",\"index\":%d,\"name\":\"%s\",\"ok\":%s,"
+                     "\"iterations\":%d,\"cycles_avg\":%lu,\"cycles_min\":%lu,\"cycles_max\":%lu,"
+                     "\"stack\":%d,\"out_bytes\":%d}",
+                     i, r.name, r.ok ? "true" : "false", r.iterations,
+                     r.cycles_avg, r.cycles_min, r.cycles_max, r.stack_bytes, r.out_bytes);
+        ws->SendJson(reply, n);
+    }
+    free(results);
+}
+
+// ========== Boot ==========
+// Boot is a dependency graph rather than a fixed sequence: a step starts as
+// soon as its dependencies are done. Slow steps (WiFi association, chime,
+// Opus setup, WS handshake) finish in the background and report through
+// boot_events, so they overlap instead of adding up.
+enum BootStage {
+    BOOT_NVS,
+    BOOT_WIFI,   // Driver started; association runs in the background
+    BOOT_IO,     // LED, I2C bus, PI4IOE
+    BOOT_CODEC,
+    BOOT_CHIME,
+    BOOT_OPUS,
+    BOOT_AUDIO,  // AudioService running
+    BOOT_IP,
+    BOOT_WS,
+    BOOT_HELLO,
+    BOOT_STAGE_COUNT,
+};
 
-    // NVS init (required for WiFi)
+#define BOOT_BIT(stage)    ((EventBits_t)1 << (stage))
+#define BOOT_WS_TIMEOUT_MS 10000  // After IP; boot then finishes without the server
+
+struct BootStep {
+    const char* name;
+    EventBits_t deps;
+    void (*run)();  // nullptr: the stage is only waited for
+    bool async;     // run() just kicks it off; boot_done() comes later
+};
+
+static EventGroupHandle_t boot_events = nullptr;
+static int64_t boot_start_us[BOOT_STAGE_COUNT];
+static int64_t boot_done_us[BOOT_STAGE_COUNT];
+
+// Safe from any task; repeated calls (WiFi/WS reconnects) keep the first time
+static void boot_done(BootStage stage) {
+    if (!boot_done_us[stage]) boot_done_us[stage] = esp_timer_get_time();
+    xEventGroupSetBits(boot_events, BOOT_BIT(stage));
+}
+
+static bool audio_ready() {
+    return (xEventGroupGetBits(boot_events) & BOOT_BIT(BOOT_AUDIO)) != 0;
+}
+
+static void boot_nvs() {
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         ESP_ERROR_CHECK(nvs_flash_erase());
         ESP_ERROR_CHECK(nvs_flash_init());
     }
+}
+
+static void boot_wifi() {
+    wifi = new WifiStation(wifi_list, sizeof(wifi_list) / sizeof(wifi_list[0]));
+    wifi->SetConnectCallback([]() { boot_done(BOOT_IP); });
+    wifi->Start();
+}
 
-    // LED
+static void boot_io() {
     led_init();
     led_set(20, 20, 0);  // Yellow = starting
-
-    // I2C
     i2c_init();
-
     // PI4IOE I/O expander (controls speaker mute)
     pi4ioe_init();
     set_speaker_mute(true);
+}
 
+static void boot_codec() {
     // Audio codec (ES8311 via esp_codec_dev)
     codec = new Es8311AudioCodec(
         i2c_bus, I2C_NUM_1,
@@ -416,46 +774,222 @@ extern "C" void app_main(void) {
         ES8311_ADDR, false  // use_mclk = false
     );
     codec->SetOutputVolume(95);
+    audio_svc = new AudioService(codec);
     ESP_LOGI(TAG, "Codec initialized, free heap: %lu", esp_get_free_heap_size());
+}
 
-    // Play startup chime
+static void boot_chime_task(void* arg) {
     play_chime();
+    boot_done(BOOT_CHIME);
+    vTaskDelete(nullptr);
+}
 
-    // WiFi
-    wifi_init();
-    led_set(0, 40, 0);  // Green = connecting WiFi
+static void boot_chime() {
+    xTaskCreate(boot_chime_task, "boot_chime", 4096, nullptr, 5, nullptr);
+}
 
-    // Wait for WiFi
-    while (!wifi_connected) {
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
-    led_set(20, 20, 20);  // White = ready
-    ESP_LOGI(TAG, "WiFi ready. Free heap: %lu", esp_get_free_heap_size());
+static void boot_opus_task(void* arg) {
+    audio_svc->OpenOpus(SAMPLE_RATE);
+    boot_done(BOOT_OPUS);
+    vTaskDelete(nullptr);
+}
 
-    // Keep codec output always enabled — muting is done via hardware amp pin
+static void boot_opus() {
+    xTaskCreate(boot_opus_task, "boot_opus", 8192, nullptr, 3, nullptr);
+}
+
+static void boot_audio() {
+    // Codec output stays open while active — muting is done via hardware amp
+    // pin. OutputTask only closes it in low power (see set_low_power).
     codec->EnableOutput(true);
     set_speaker_mute(true);  // Start muted, OutputTask will unmute when playing
 
-    // Audio service (Opus encode/decode pipeline)
-    audio_svc = new AudioService(codec);
+    // Wire: encoded Opus from mic → send to server
+    audio_svc->SetSendCallback([](const uint8_t* data, size_t len) {
+        ws->SendAudio(data, len, audio_svc->uplink_bundle());
+    });
+
+    // Wire: end of the uplink stream → record_end, so the server can start
+    // STT on it instead of waiting. Runs on CodecTask right after the tail
+    // frame; Send flushes a held bundle first, so it lands after the audio.
+    // Carries what encoding cost at the governor's level and where the
+    // uplink rate settled.
+    audio_svc->SetStreamEndCallback([](uint32_t frames, uint32_t tail_us) {
+        const EncoderStats& enc = audio_svc->encoder_stats();
+        const UplinkRateStats& up = audio_svc->uplink_rate_stats();
+        char end[320];
+        int n = snprintf(end, sizeof(end),
+                         "{\"type\":\"record_end\",\"frames\":%lu,\"last_seq\":%lu,\"tail_ms\":%lu,"
+                         "\"opus_cx\":%d,\"enc_us\":%lu,\"enc_cycles\":%lu,"
+                         "\"enc_max_us\":%lu,\"enc_budget_us\":%lu,\"up_bps\":%d,\"up_bundle\":%d,"
+                         "\"send_avg_us\":%lu,\"send_max_us\":%lu,\"backlog_max\":%d,\"rssi\":%d}",
+                         (unsigned long)frames, (unsigned long)ws->tx_seq(), (unsigned long)(tail_us / 1000),
+                         enc.complexity, (unsigned long)enc.avg_us, (unsigned long)enc.avg_cycles,
+                         (unsigned long)enc.max_us, (unsigned long)enc.budget_us, up.bitrate, up.bundle,
+                         (unsigned long)up.send_avg_us, (unsigned long)up.send_max_us, up.backlog_max,
+                         up.rssi);
+        ws->SendJson(end, n);
+    });
+
+    // Wire: hardware amp mute control (fast ~10ms vs 50-100ms codec open/close)
+    audio_svc->SetMuteCallback([](bool mute) {
+        set_speaker_mute(mute);
+    });
+
+    audio_svc->Start(SAMPLE_RATE);
+    ESP_LOGI(TAG, "Audio service started. Free heap: %lu", esp_get_free_heap_size());
+
+    bool online = xEventGroupGetBits(boot_events) & BOOT_BIT(BOOT_IP);
+    if (online) led_set(20, 20, 20);  // White = WiFi ready
+    else led_set(0, 40, 0);           // Green = connecting WiFi
+}
+
+static void boot_ws() {
+    ws->Connect(WS_URI, ws_server_cert_pem);
+}
+
+// Downlink flow control: let the server send up to seq `limit`, i.e. the
+// profile's credit window minus frames queued here or still in flight.
+// Cumulative, so a lost or late report only delays the next grant.
+static void send_credit(bool force) {
+    uint32_t rx_seq = ws->rx_seq() > udp->rx_seq() ? ws->rx_seq() : udp->rx_seq();
+    int fill = audio_svc->DownlinkFill();
+    int window = audio_svc->latency_profile().credit_window;
+    uint32_t limit = rx_seq + (fill < window ? window - fill : 0);
+    if (!force && limit == credit_limit_sent) return;
+    char msg[96];
+    int n = snprintf(msg, sizeof(msg), "{\"type\":\"credit\",\"limit\":%lu,\"fill\":%d,\"window\":%d}",
+                     (unsigned long)limit, fill, window);
+    if (ws->SendJson(msg, n)) {
+        credit_limit_sent = limit;
+        credit_sent_ms = esp_timer_get_time() / 1000;
+    }
+}
+
+// Opens the server session, or resumes it after a reconnect; the server then
+// continues downlink after rx_seq and WsTransport flushes buffered uplink
+static void send_hello() {
+    // Downlink may have arrived on either channel
+    uint32_t rx_seq = ws->rx_seq() > udp->rx_seq() ? ws->rx_seq() : udp->rx_seq();
+    char hello[400];
+    int n = snprintf(hello, sizeof(hello),
+                     "{\"type\":\"hello\",\"audio\":{\"format\":\"opus\",\"sample_rate\":16000,\"channels\":1,\"frame_duration\":60},"
+                     "\"latency_profile\":\"%s\",\"session\":\"%s\",\"rx_seq\":%lu,\"played_seq\":%lu,\"tx_seq\":%lu,"
+                     "\"link\":{\"tls\":\"%s\",\"connect_ms\":%d,\"udp\":true}}",
+                     audio_svc->latency_profile().name, ws->session_id(),
+                     (unsigned long)rx_seq, (unsigned long)audio_svc->played_seq(),
+                     (unsigned long)ws->tx_seq(), ws->tls_mode(), ws->last_connect_ms());
+    ws->Resume(hello, n);
+    if (credit_interval_ms > 0) send_credit(true);
+}
+
+static void boot_hello() {
+    ESP_LOGI(TAG, "WebSocket connected to %s", WS_URI);
+    send_hello();
+}
+
+// Listed in dependency order (deps only point upwards)
+static const BootStep boot_steps[BOOT_STAGE_COUNT] = {
+    {"nvs",   0,                                        boot_nvs,   false},
+    {"wifi",  BOOT_BIT(BOOT_NVS),                       boot_wifi,  false},
+    {"io",    0,                                        boot_io,    false},
+    {"codec", BOOT_BIT(BOOT_IO),                        boot_codec, false},
+    {"chime", BOOT_BIT(BOOT_CODEC),                     boot_chime, true},
+    {"opus",  BOOT_BIT(BOOT_CODEC),                     boot_opus,  true},
+    {"audio", BOOT_BIT(BOOT_CHIME) | BOOT_BIT(BOOT_OPUS), boot_audio, false},
+    {"ip",    BOOT_BIT(BOOT_WIFI),                      nullptr,    true},
+    {"ws",    BOOT_BIT(BOOT_IP),                        boot_ws,    true},
+    {"hello", BOOT_BIT(BOOT_WS) | BOOT_BIT(BOOT_AUDIO), boot_hello, false},
+};
+
+static void boot_log_timeline() {
+    int64_t serial_us = 0;
+    ESP_LOGI(TAG, "Boot timeline (ms since power-on):");
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+        const char* name = boot_steps[i].name;
+        if (!boot_start_us[i]) {
+            ESP_LOGI(TAG, "  %-5s  not started", name);
+        } else if (!boot_done_us[i]) {
+            ESP_LOGI(TAG, "  %-5s %5d → pending", name, (int)(boot_start_us[i] / 1000));
+        } else {
+            int64_t took = boot_done_us[i] - boot_start_us[i];
+            serial_us += took;
+            ESP_LOGI(TAG, "  %-5s %5d → %5d  (%d ms)", name, (int)(boot_start_us[i] / 1000),
+                     (int)(boot_done_us[i] / 1000), (int)(took / 1000));
+        }
+    }
+    ESP_LOGI(TAG, "Ready at %d ms (stages sum to %d ms when run back to back)",
+             (int)(esp_timer_get_time() / 1000), (int)(serial_us / 1000));
+}
 
-    // WebSocket transport
+// Runs until every stage is done, or everything but the server handshake is
+// done and the server has not answered within BOOT_WS_TIMEOUT_MS of the IP
+static void boot_run() {
+    const EventBits_t all = BOOT_BIT(BOOT_STAGE_COUNT) - 1;
+    const EventBits_t required = all & ~(BOOT_BIT(BOOT_WS) | BOOT_BIT(BOOT_HELLO));
+    EventBits_t started = 0;
+
+    while (true) {
+        for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+            const BootStep& step = boot_steps[i];
+            if ((started & BOOT_BIT(i)) ||
+                (xEventGroupGetBits(boot_events) & step.deps) != step.deps) {
+                continue;
+            }
+            started |= BOOT_BIT(i);
+            boot_start_us[i] = esp_timer_get_time();
+            if (step.run) step.run();
+            if (!step.async) boot_done((BootStage)i);
+        }
+
+        EventBits_t done = xEventGroupGetBits(boot_events);
+        if ((done & all) == all) break;
+        if ((done & required) == required &&
+            esp_timer_get_time() - boot_done_us[BOOT_IP] > BOOT_WS_TIMEOUT_MS * 1000LL) {
+            ESP_LOGW(TAG, "WebSocket connection timeout");
+            break;
+        }
+        xEventGroupWaitBits(boot_events, all & ~done, pdFALSE, pdFALSE, pdMS_TO_TICKS(100));
+    }
+}
+
+// WS is created and wired before boot so it can connect the moment an IP
+// arrives. Audio-dependent callbacks drop traffic until BOOT_AUDIO.
+static void ws_init() {
     ws = new WsTransport();
+    udp = new UdpAudio();
 
     // Wire: received Opus from server → decode → play
-    ws->SetAudioCallback([](const uint8_t* data, size_t len) {
-        audio_svc->PushOpusForDecode(data, len);
+    ws->SetAudioCallback([](const uint8_t* data, size_t len, uint32_t seq) {
+        if (!audio_ready()) return;
+        audio_svc->PushOpusForDecode(data, len, seq);
+        if (low_power) wake_main_loop();  // Leave the slow poll so credits keep up
+    });
+    // Same for the optional datagram channel (len 0 = lost frame to conceal)
+    udp->SetAudioCallback([](const uint8_t* data, size_t len, uint32_t seq) {
+        if (!audio_ready()) return;
+        audio_svc->PushOpusForDecode(data, len, seq);
+        if (low_power) wake_main_loop();
     });
 
     // Wire: server JSON messages → LED state + notification sounds + processing lock
     ws->SetJsonCallback([](const char* json, size_t len) {
+        if (!audio_ready()) return;
         // Copy to null-terminated buffer for strstr
         char buf[256];
         size_t copy_len = len < sizeof(buf) - 1 ? len : sizeof(buf) - 1;
         memcpy(buf, json, copy_len);
         buf[copy_len] = '\0';
-
-        if (strstr(buf, "\"tts_start\"")) {
+        // Typed messages dispatch on the parsed "type": the server's JSON has
+        // spaces after the separators, so "\"type\":\"x\"" never matches
+        char type[24];
+        ControlType(json, len, type, sizeof(type));
+
+        if (strstr(buf, "\"uplink_ack\"")) {
+            // Every couple of frames while recording: parsed by hand
+            const char* seq = strstr(buf, "\"seq\":");
+            if (seq) ws->OnUplinkAck(strtoul(seq + 6, nullptr, 10));
+        } else if (strstr(buf, "\"tts_start\"")) {
             pending_notification = 0;  // Cancel any pending notification
             close_notif_output = true; // Tell main loop to close notification output
             led_set(0, 40, 40);  // Cyan = playing TTS
@@ -465,6 +999,27 @@ extern "C" void app_main(void) {
         } else if (strstr(buf, "\"stt\"")) {
             led_set(40, 40, 0);  // Yellow = got STT, waiting for LLM
             processing = true;   // Lock recording during processing
+        } else if (strstr(buf, "\"audio_config\"")) {
+            handle_audio_config(json, len);
+        } else if (strstr(buf, "\"latency_profile\"")) {
+            handle_latency_profile(json, len);
+        } else if (strcmp(type, "bench") == 0) {
+            handle_bench(json, len);
+        } else if (strcmp(type, "codec_stress") == 0) {
+            handle_codec_stress(json, len);
+        } else if (strcmp(type, "trace") == 0) {
+            handle_trace(json, len);
+        } else if (strcmp(type, "flight") == 0) {
+            handle_flight(json, len);
+        } else if (strstr(buf, "\"loopback_test\"")) {
+            handle_loopback_test(json, len);
+        } else if (strcmp(type, "session") == 0) {
+            handle_session(json, len);
+        } else if (strstr(buf, "\"udp_offer\"")) {
+            handle_udp_offer(json, len);
+        } else if (strstr(buf, "\"udp_ready\"")) {
+            udp->SetReady();
+            ESP_LOGI(TAG, "Downlink audio switched to UDP");
         } else if (strstr(buf, "\"status\"")) {
             // NanoBot streaming status events
             if (strstr(buf, "\"thinking\"")) {
@@ -478,58 +1033,54 @@ extern "C" void app_main(void) {
                 pending_notification = 3;
             }
         }
+        wake_main_loop();
     });
 
-    // Wire: WS disconnect → reset processing state so button works again
+    // Wire: WS disconnect → keep processing; the reply resumes after reconnect
+    // (main loop gives up after WS_RESUME_GRACE_MS)
     ws->SetDisconnectCallback([]() {
-        processing = false;
+        udp->Close();  // Re-offered with the next session reply
         pending_notification = 0;
         close_notif_output = false;
         led_set(20, 20, 20);  // White = disconnected/reconnecting
+        wake_main_loop();
     });
 
-    // Wire: encoded Opus from mic → send to server
-    audio_svc->SetSendCallback([](const uint8_t* data, size_t len) {
-        ws->SendAudio(data, len);
-    });
-
-    // Wire: hardware amp mute control (fast ~10ms vs 50-100ms codec open/close)
-    audio_svc->SetMuteCallback([](bool mute) {
-        set_speaker_mute(mute);
+    // Wire: WS (re)connect → boot stage, then main loop sends hello to resume
+    ws->SetConnectCallback([]() {
+        boot_done(BOOT_WS);
+        wake_main_loop();
     });
+}
 
-    // Start audio service
-    audio_svc->Start(SAMPLE_RATE);
-    ESP_LOGI(TAG, "Audio service started. Free heap: %lu", esp_get_free_heap_size());
+// ========== Main ==========
+extern "C" void app_main(void) {
+    ESP_LOGI(TAG, "Atom Echo Voice Assistant starting...");
 
-    // Connect WebSocket
-    ws->Connect(WS_URI);
+    power_init();
+    TraceRegisterTask(TRACE_TASK_MAIN);
 
-    // Wait for WS connection
-    for (int i = 0; i < 100 && !ws->IsConnected(); i++) {
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
-    if (ws->IsConnected()) {
-        ESP_LOGI(TAG, "WebSocket connected to %s", WS_URI);
-        // Send hello
-        const char* hello = "{\"type\":\"hello\",\"audio\":{\"format\":\"opus\",\"sample_rate\":16000,\"channels\":1,\"frame_duration\":60}}";
-        ws->SendJson(hello, strlen(hello));
-    } else {
-        ESP_LOGW(TAG, "WebSocket connection timeout");
-    }
+    boot_events = xEventGroupCreate();
+    ws_init();
+    boot_run();
     led_set(0, 20, 40);  // Cyan = connected
+    boot_log_timeline();
+    LogMemoryPlan(TAG);
 
     ESP_LOGI(TAG, "Ready. Free heap: %lu", esp_get_free_heap_size());
 
     // ========== Main Loop: Button handling ==========
-    gpio_set_direction(BTN_PIN, GPIO_MODE_INPUT);
+    button_init();
     bool btn_pressed = false;
+    int64_t ws_down_since_ms = 0;
+    int64_t idle_since_ms = esp_timer_get_time() / 1000;
     int loop_count = 0;
 
     // Track whether notification output is open (to avoid open/close thrash)
     bool notif_output_open = false;
 
     while (true) {
+        TRACE(TRACE_MAIN_WAKE, 0);
         bool btn = (gpio_get_level(BTN_PIN) == 0);  // Active low
 
         // Log button state every 2 seconds for first 20 seconds
@@ -538,9 +1089,19 @@ extern "C" void app_main(void) {
                      !btn ? 1 : 0, btn_pressed, audio_svc->IsRecording(), (int)processing);
         }
 
-        // --- Safety: reset processing if WS disconnected ---
-        if (processing && !ws->IsConnected()) {
-            ESP_LOGW(TAG, "WS disconnected while processing, resetting state");
+        // --- WS reconnected: resume the session, flush buffered uplink ---
+        int64_t loop_ms = esp_timer_get_time() / 1000;
+        if (ws->NeedsResume()) {
+            send_hello();
+            if (!processing) led_set(0, 20, 40);
+        }
+        if (ws->IsConnected()) ws_down_since_ms = 0;
+        else if (!ws_down_since_ms) ws_down_since_ms = loop_ms;
+
+        // --- Safety: reset processing if the session could not be resumed ---
+        if (processing && ws_down_since_ms && loop_ms - ws_down_since_ms >= WS_RESUME_GRACE_MS) {
+            ESP_LOGW(TAG, "WS down for %d ms while processing, resetting state",
+                     (int)(loop_ms - ws_down_since_ms));
             processing = false;
             pending_notification = 0;
             close_notif_output = false;
@@ -561,6 +1122,7 @@ extern "C" void app_main(void) {
             // Only play if not currently playing TTS (OutputTask handles that)
             if (!audio_svc->IsRecording()) {
                 if (!notif_output_open) {
+                    audio_svc->EnsureOutputOpen();  // May be closed in low power
                     set_speaker_mute(false);
                     play_silence_ms(20);  // stabilize PA
                     notif_output_open = true;
@@ -574,6 +1136,76 @@ extern "C" void app_main(void) {
             notif_output_open = false;
         }
 
+        // --- Apply a requested latency profile while audio is idle ---
+        const LatencyProfile* profile = pending_latency_profile;
+        if (profile && !processing && !notif_output_open && !audio_svc->IsRecording()) {
+            pending_latency_profile = nullptr;
+            apply_latency_profile(profile);
+        }
+
+        // --- Acoustic loopback test (blocks the loop for ~0.5s per run) ---
+        int loopback_runs = pending_loopback_runs;
+        if (loopback_runs > 0 && !processing && !notif_output_open &&
+            !audio_svc->IsRecording() && audio_svc->IsPlaybackIdle()) {
+            pending_loopback_runs = 0;
+            run_loopback_test(loopback_runs);
+        }
+
+        // --- Kernel microbenchmark (blocks the loop for a few seconds) ---
+        int bench_iterations = pending_bench_iterations;
+        if (bench_iterations > 0 && !processing && !notif_output_open &&
+            !audio_svc->IsRecording() && audio_svc->IsPlaybackIdle()) {
+            pending_bench_iterations = 0;
+            run_bench(bench_iterations);
+        }
+
+        // --- Codec switching stress run (blocks the loop for its duration) ---
+        int stress_ms = pending_codec_stress_ms;
+        if (stress_ms > 0 && !processing && !notif_output_open &&
+            !audio_svc->IsRecording() && audio_svc->IsPlaybackIdle()) {
+            pending_codec_stress_ms = 0;
+            run_codec_stress(stress_ms);
+        }
+
+        // --- Uplink: link state for the bitrate controller ---
+        if (audio_svc->IsRecording()) {
+            if (loop_ms - link_rssi_ms >= UPLINK_RSSI_POLL_MS) {
+                wifi_ap_record_t ap;
+                link_rssi = esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+                link_rssi_ms = loop_ms;
+            }
+            audio_svc->SetUplinkLinkState(link_rssi, ws->uplink_backlog());
+        }
+
+        // --- Clock sync: time_req bursts after hello, then periodic ---
+        if (ws->IsConnected() && !ws->NeedsResume()) ws->SyncClock();
+
+        // --- Downlink credit: report queue space as frames are played ---
+        if (credit_interval_ms > 0 && ws->IsConnected() && !ws->NeedsResume() &&
+            loop_ms - credit_sent_ms >= credit_interval_ms) {
+            send_credit(false);
+        }
+
+        // --- Downlink report for the playback session that just ended ---
+        PlaybackStats playback_stats;
+        if (audio_svc->TakePlaybackStats(&playback_stats)) send_playback_stats(playback_stats);
+
+        // --- Trace dump (~1s of WS text frames for full rings) ---
+        if (pending_trace_dump && !processing && !notif_output_open &&
+            !audio_svc->IsRecording() && audio_svc->IsPlaybackIdle()) {
+            pending_trace_dump = false;
+            TraceDump([](const char* j, size_t n) { return ws->SendJson(j, n); },
+                      [](int64_t us) { return ws->ToServerUs(us); });
+        }
+
+        // --- Flight recorder frozen (tripped or asked for): upload it once
+        // idle and live; buffered offline it would push out uplink audio ---
+        if (FlightDumpReady() && !processing && !notif_output_open && !audio_svc->IsRecording() &&
+            audio_svc->IsPlaybackIdle() && ws->IsConnected() && !ws->NeedsResume()) {
+            FlightDump([](const char* j, size_t n) { return ws->SendJson(j, n); },
+                       [](int64_t us) { return ws->ToServerUs(us); });
+        }
+
         // --- Button handling ---
         if (btn && !btn_pressed) {
             if (processing) {
@@ -590,7 +1222,11 @@ extern "C" void app_main(void) {
                     notif_output_open = false;
                 }
                 ESP_LOGI(TAG, "=== BUTTON PRESSED ===");
-                audio_svc->StartRecording();
+                TRACE(TRACE_BUTTON, 1);
+                set_low_power(false);
+                int64_t edge_us = btn_edge_us;
+                btn_edge_us = 0;
+                audio_svc->StartRecording(edge_us ? edge_us : esp_timer_get_time());
                 led_set(60, 0, 0);  // Red = recording
                 // Notify server
                 const char* start = "{\"type\":\"record_start\"}";
@@ -600,13 +1236,33 @@ extern "C" void app_main(void) {
             // Button release → stop recording
             btn_pressed = false;
             ESP_LOGI(TAG, "=== BUTTON RELEASED ===");
+            TRACE(TRACE_BUTTON, 0);
+            int64_t stop_srv_us = ws->ToServerUs(esp_timer_get_time());
             audio_svc->StopRecording();
             led_set(60, 30, 0);  // Orange = processing
-            // Notify server
-            const char* stop = "{\"type\":\"record_stop\"}";
-            ws->SendJson(stop, strlen(stop));
+            // Notify server; eos: the tail follows, then record_end. With
+            // clock sync, t_srv_us (release in server time) lets the server
+            // time the stop from the device's side.
+            char stop[96];
+            int n = stop_srv_us
+                ? snprintf(stop, sizeof(stop), "{\"type\":\"record_stop\",\"eos\":true,\"t_srv_us\":%lld}",
+                           (long long)stop_srv_us)
+                : snprintf(stop, sizeof(stop), "{\"type\":\"record_stop\",\"eos\":true}");
+            ws->SendJson(stop, n);
+        }
+
+        // --- Power: low power after a quiet period ---
+        bool idle = !btn_pressed && !processing && !notif_output_open &&
+                    pending_notification == 0 && audio_svc->IsPlaybackIdle();
+        int64_t now_ms = esp_timer_get_time() / 1000;
+        if (!idle) {
+            idle_since_ms = now_ms;
+            set_low_power(false);
+        } else if (now_ms - idle_since_ms >= IDLE_POWER_DOWN_MS) {
+            set_low_power(true);
         }
 
-        vTaskDelay(pdMS_TO_TICKS(20));
+        if (!btn) gpio_intr_enable(BTN_PIN);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(low_power ? MAIN_IDLE_POLL_MS : 20));
     }
 }
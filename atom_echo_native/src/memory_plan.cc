@@ -0,0 +1,15 @@
+#include "memory_plan.h"
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+void LogMemoryPlan(const char* tag) {
+    ESP_LOGI(tag, "Static RAM plan: audio=%u codec=%u transport=%u total=%u / budget %u (%u free)",
+             (unsigned)AUDIO_STATIC_BYTES, (unsigned)CODEC_STATIC_BYTES,
+             (unsigned)(WS_STATIC_BYTES + UDP_STATIC_BYTES),
+             (unsigned)MEMORY_STATIC_BYTES, (unsigned)MEMORY_STATIC_BUDGET_BYTES,
+             (unsigned)(MEMORY_STATIC_BUDGET_BYTES - MEMORY_STATIC_BYTES));
+    ESP_LOGI(tag, "Heap: free=%u min_free=%u largest_block=%u",
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+             (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+             (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
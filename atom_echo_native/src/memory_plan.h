@@ -0,0 +1,21 @@
+#pragma once
+
+#include "audio_service.h"
+#include "es8311_audio_codec.h"
+#include "ws_transport.h"
+#include "udp_audio.h"
+
+// Compile-time RAM plan for long-lived audio and transport memory. These
+// buffers are static so a fragmented heap can't fail startup or a reconnect;
+// the build stops if they outgrow the budget. The linker prints DRAM/IRAM
+// region usage and the build writes memory_report.txt (see CMakeLists.txt).
+#define MEMORY_STATIC_BUDGET_BYTES (64 * 1024)
+
+constexpr size_t MEMORY_STATIC_BYTES =
+    AUDIO_STATIC_BYTES + CODEC_STATIC_BYTES + WS_STATIC_BYTES + UDP_STATIC_BYTES;
+
+static_assert(MEMORY_STATIC_BYTES <= MEMORY_STATIC_BUDGET_BYTES,
+              "static audio/transport memory exceeds MEMORY_STATIC_BUDGET_BYTES");
+
+// Log the static plan next to current heap headroom
+void LogMemoryPlan(const char* tag);
@@ -0,0 +1,159 @@
+#include "noise_suppressor.h"
+#include <esp_log.h>
+#include <cmath>
+#include <cstring>
+
+// Frames used to seed the noise estimate after Reset()
+#define NS_WARMUP_FRAMES 16
+
+static inline int32_t mul_q15(int32_t a, int32_t b) {
+    return (int32_t)(((int64_t)a * b) >> 15);
+}
+
+// |re + j*im| ~= max + 3/8 * min (alpha-max-beta-min, <7% error)
+static inline int32_t approx_mag(int32_t re, int32_t im) {
+    if (re < 0) re = -re;
+    if (im < 0) im = -im;
+    return re > im ? re + ((im * 3) >> 3) : im + ((re * 3) >> 3);
+}
+
+bool NoiseSuppressor::Init(int sample_rate, int block_samples) {
+    if (block_samples <= 0 || block_samples > NS_MAX_HOP) return false;
+    hop_ = block_samples;
+    floor_q15_ = (int32_t)(32767.0f * powf(10.0f, -config_.max_attenuation_db / 20.0f));
+
+    // sqrt-Hann: w[n]^2 + w[n+hop]^2 == 1, so analysis * synthesis windows sum to unity
+    for (int n = 0; n < 2 * hop_; n++) {
+        window_[n] = (int16_t)(32767.0f * sinf((float)M_PI * (n + 0.5f) / (2 * hop_)));
+    }
+    for (int k = 0; k < NS_FFT_SIZE / 2; k++) {
+        cos_[k] = (int16_t)(32767.0f * cosf(2.0f * (float)M_PI * k / NS_FFT_SIZE));
+        sin_[k] = (int16_t)(32767.0f * sinf(2.0f * (float)M_PI * k / NS_FFT_SIZE));
+    }
+    Reset();
+    return true;
+}
+
+void NoiseSuppressor::Reset() {
+    memset(history_, 0, sizeof(history_));
+    memset(overlap_, 0, sizeof(overlap_));
+    memset(smooth_, 0, sizeof(smooth_));
+    memset(noise_, 0, sizeof(noise_));
+    for (int k = 0; k < NS_BINS; k++) gain_[k] = 32767;
+    warmup_ = 0;
+}
+
+// In-place radix-2 DIT forward FFT on int32 data with Q15 twiddles.
+// No per-stage scaling: 16-bit input grows to at most 16 + NS_FFT_BITS bits.
+void NoiseSuppressor::Fft(int32_t* re, int32_t* im) {
+    for (int i = 1, j = 0; i < NS_FFT_SIZE; i++) {
+        int bit = NS_FFT_SIZE >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            int32_t t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (int len = 2; len <= NS_FFT_SIZE; len <<= 1) {
+        int half = len >> 1;
+        int step = NS_FFT_SIZE / len;
+        for (int i = 0; i < NS_FFT_SIZE; i += len) {
+            for (int j = 0; j < half; j++) {
+                int32_t wr = cos_[j * step];
+                int32_t wi = -sin_[j * step];
+                int32_t xr = re[i + j + half];
+                int32_t xi = im[i + j + half];
+                int32_t tr = mul_q15(xr, wr) - mul_q15(xi, wi);
+                int32_t ti = mul_q15(xr, wi) + mul_q15(xi, wr);
+                re[i + j + half] = re[i + j] - tr;
+                im[i + j + half] = im[i + j] - ti;
+                re[i + j] += tr;
+                im[i + j] += ti;
+            }
+        }
+    }
+}
+
+void NoiseSuppressor::Process(int16_t* pcm, int samples) {
+    if (samples != hop_) return;
+
+    // Windowed analysis frame: previous hop + current hop, zero-padded
+    for (int n = 0; n < hop_; n++) {
+        re_[n] = mul_q15(history_[n], window_[n]);
+        re_[n + hop_] = mul_q15(pcm[n], window_[n + hop_]);
+    }
+    memset(re_ + 2 * hop_, 0, (NS_FFT_SIZE - 2 * hop_) * sizeof(int32_t));
+    memset(im_, 0, sizeof(im_));
+    memcpy(history_, pcm, hop_ * sizeof(int16_t));
+
+    Fft(re_, im_);
+
+    bool warming = warmup_ < NS_WARMUP_FRAMES;
+    int64_t noise_sum = 0;
+    for (int k = 0; k < NS_BINS; k++) {
+        int32_t mag = approx_mag(re_[k], im_[k]);
+
+        // Noise tracking on the smoothed magnitude: seed with an average,
+        // follow dips quickly, adapt to noise-like levels, and creep up
+        // very slowly when speech is likely present in the bin
+        int32_t& sm = smooth_[k];
+        int32_t& noise = noise_[k];
+        sm += (mag - sm) >> 2;
+        if (warming) {
+            noise += (mag - noise) / (int32_t)(warmup_ + 1);
+        } else if (sm < noise) {
+            noise += (sm - noise) >> 2;
+        } else if (sm < 3 * noise) {
+            noise += ((sm - noise) >> 6) + 1;
+        } else {
+            noise += ((sm - noise) >> 12) + 1;
+        }
+        noise_sum += noise;
+
+        // Spectral subtraction gain with floor and temporal smoothing;
+        // onsets (gain rising) pass through immediately
+        int32_t sub = (int32_t)(((int64_t)noise * config_.over_subtraction_q8) >> 8);
+        int32_t g = floor_q15_;
+        if (mag > sub) {
+            g = (int32_t)(((int64_t)(mag - sub) << 15) / mag);
+            if (g < floor_q15_) g = floor_q15_;
+            if (g > 32767) g = 32767;
+        }
+        if (g < gain_[k]) {
+            g = gain_[k] + mul_q15(g - gain_[k], 32767 - config_.gain_smoothing_q15);
+        }
+        gain_[k] = (int16_t)g;
+
+        re_[k] = mul_q15(re_[k], g);
+        im_[k] = mul_q15(im_[k], g);
+        if (k > 0 && k < NS_FFT_SIZE / 2) {
+            re_[NS_FFT_SIZE - k] = mul_q15(re_[NS_FFT_SIZE - k], g);
+            im_[NS_FFT_SIZE - k] = mul_q15(im_[NS_FFT_SIZE - k], g);
+        }
+    }
+    if (warming) warmup_++;
+
+    // Inverse FFT via conjugation; only the real part is needed
+    for (int n = 0; n < NS_FFT_SIZE; n++) im_[n] = -im_[n];
+    Fft(re_, im_);
+
+    // Synthesis window + overlap-add (output is delayed by one hop)
+    for (int n = 0; n < hop_; n++) {
+        int32_t head = mul_q15(re_[n] >> NS_FFT_BITS, window_[n]);
+        int32_t tail = mul_q15(re_[n + hop_] >> NS_FFT_BITS, window_[n + hop_]);
+        int32_t y = overlap_[n] + head;
+        if (y > 32767) y = 32767;
+        else if (y < -32768) y = -32768;
+        pcm[n] = (int16_t)y;
+        overlap_[n] = tail;
+    }
+
+    stats_.frames++;
+    stats_.noise_floor = (int32_t)(noise_sum / NS_BINS);
+}
+
+void NoiseSuppressor::LogStats(const char* tag) const {
+    if (stats_.frames == 0) return;
+    ESP_LOGI(tag, "NS: frames=%lu noise_floor=%ld", stats_.frames, stats_.noise_floor);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+#include "audio_stage.h"
+
+// FFT size and maximum hop (block) size for the suppressor.
+// Analysis window is 2 * hop (50% overlap, sqrt-Hann), zero-padded to NS_FFT_SIZE.
+#define NS_FFT_SIZE  512
+#define NS_FFT_BITS  9
+#define NS_MAX_HOP   (NS_FFT_SIZE / 2)
+#define NS_BINS      (NS_FFT_SIZE / 2 + 1)
+
+struct NsConfig {
+    int max_attenuation_db = 18;  // Spectral floor (limits musical noise)
+    int over_subtraction_q8 = 512; // Noise over-estimation factor (Q8, 2.0x)
+    int gain_smoothing_q15 = 16384; // Temporal gain smoothing (Q15, 0.5)
+};
+
+struct NsStats {
+    uint32_t frames = 0;
+    int32_t noise_floor = 0;      // Mean noise magnitude estimate across bins
+};
+
+// Fixed-point spectral-subtraction noise suppressor.
+// Process() works in-place on hop-sized blocks and delays the signal by one hop.
+class NoiseSuppressor : public AudioStage {
+public:
+    NoiseSuppressor() = default;
+
+    const char* name() const override { return "ns"; }
+    // block_samples is the hop and must be <= NS_MAX_HOP (10ms at 24kHz = 240)
+    bool Init(int sample_rate, int block_samples) override;
+    void Process(int16_t* pcm, int samples) override;
+    void Reset() override;
+
+    // Takes effect on the next Init()
+    void SetConfig(const NsConfig& cfg) { config_ = cfg; }
+
+    int hop() const { return hop_; }
+    const NsStats& stats() const { return stats_; }
+    void ResetStats() { stats_ = NsStats(); }
+    void LogStats(const char* tag) const;
+
+private:
+    void Fft(int32_t* re, int32_t* im);
+
+    NsConfig config_;
+    NsStats stats_;
+    int hop_ = 0;
+    int32_t floor_q15_ = 0;
+    uint32_t warmup_ = 0;
+
+    int16_t window_[2 * NS_MAX_HOP];        // sqrt-Hann, Q15
+    int16_t cos_[NS_FFT_SIZE / 2];          // Twiddles, Q15
+    int16_t sin_[NS_FFT_SIZE / 2];
+    int16_t history_[NS_MAX_HOP];           // Previous input hop
+    int32_t overlap_[NS_MAX_HOP];           // Overlap-add tail
+    int32_t smooth_[NS_BINS];               // Time-smoothed magnitude
+    int32_t noise_[NS_BINS];                // Noise magnitude estimate
+    int16_t gain_[NS_BINS];                 // Smoothed suppression gain, Q15
+    int32_t re_[NS_FFT_SIZE];
+    int32_t im_[NS_FFT_SIZE];
+};
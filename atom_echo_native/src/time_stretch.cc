@@ -0,0 +1,147 @@
+#include "time_stretch.h"
+#include <esp_log.h>
+#include <cstring>
+
+bool TimeStretch::Init(int sample_rate) {
+    if (sample_rate <= 0 || sample_rate > TSM_MAX_SAMPLE_RATE) return false;
+    sample_rate_ = sample_rate;
+    overlap_ = sample_rate * TSM_OVERLAP_MS / 1000;
+    seek_ = sample_rate * TSM_SEEK_MS / 1000;
+    for (int i = 0; i < overlap_; i++) {
+        fade_[i] = (int16_t)(i * 32767 / overlap_);
+    }
+    Reset();
+    return true;
+}
+
+void TimeStretch::Reset() {
+    len_ = 0;
+    read_ = 0;
+    ideal_q8_ = 0;
+}
+
+void TimeStretch::SetRatePct(int pct) {
+    if (pct > TSM_MAX_RATE_PCT) pct = TSM_MAX_RATE_PCT;
+    if (pct < -TSM_MAX_RATE_PCT) pct = -TSM_MAX_RATE_PCT;
+    rate_pct_ = pct;
+}
+
+// Keep enough history behind the read position for a stretch step to seek
+// backwards; everything older is shifted out
+void TimeStretch::Compact() {
+    int oldest = read_ < (ideal_q8_ >> 8) ? read_ : (ideal_q8_ >> 8);
+    int shift = oldest - 2 * seek_ - overlap_;
+    if (shift <= 0) return;
+    memmove(buf_, buf_ + shift, (len_ - shift) * sizeof(int16_t));
+    len_ -= shift;
+    read_ -= shift;
+    ideal_q8_ -= shift << 8;
+}
+
+// Segment start in [lo, hi] whose first overlap_ samples best match the
+// natural continuation at read_ (normalized cross-correlation). Coarse pass
+// on every other lag and sample, then refined at full resolution.
+int TimeStretch::Seek(int lo, int hi) const {
+    const int16_t* tail = buf_ + read_;
+    auto score = [&](int s, int step) {
+        const int16_t* seg = buf_ + s;
+        int64_t c = 0, e = 1;
+        for (int i = 0; i < overlap_; i += step) {
+            c += (int32_t)tail[i] * seg[i];
+            e += (int32_t)seg[i] * seg[i];
+        }
+        return c > 0 ? (float)c * (float)c / (float)e : -(float)c * (float)c / (float)e;
+    };
+
+    int best = lo;
+    float best_score = score(lo, 2);
+    for (int s = lo + 2; s <= hi; s += 2) {
+        float sc = score(s, 2);
+        if (sc > best_score) {
+            best_score = sc;
+            best = s;
+        }
+    }
+    int center = best;
+    best_score = score(center, 1);
+    for (int s = center - 1; s <= center + 1; s += 2) {
+        if (s < lo || s > hi) continue;
+        float sc = score(s, 1);
+        if (sc > best_score) {
+            best_score = sc;
+            best = s;
+        }
+    }
+    return best;
+}
+
+int TimeStretch::Process(const int16_t* in, int count, int16_t* out, int max_out) {
+    if (overlap_ == 0) return 0;
+    if (count > 0) {
+        Compact();
+        int n = count < TSM_BUF_SAMPLES - len_ ? count : TSM_BUF_SAMPLES - len_;
+        memcpy(buf_ + len_, in, n * sizeof(int16_t));
+        len_ += n;
+        stats_.samples_in += n;
+    }
+
+    const int L = overlap_;
+    int produced = 0;
+    while (produced + L <= max_out) {
+        if (rate_pct_ == 0) {
+            if (read_ + L > len_) break;
+            memcpy(out + produced, buf_ + read_, L * sizeof(int16_t));
+            read_ += L;
+            ideal_q8_ = read_ << 8;
+            produced += L;
+            continue;
+        }
+
+        // Nominal start of the next segment; ideal_q8_ advances rate * L per step
+        int32_t d_q8 = L * rate_pct_ * 256 / 100;
+        int p = (ideal_q8_ + d_q8) >> 8;
+        int lo = p - seek_ < 0 ? 0 : p - seek_;
+        int hi = p + seek_;
+        if (hi + L > len_ || read_ + L > len_) break;  // Wait for lookahead
+
+        // The natural continuation is a perfect match whenever it is in range;
+        // only search (splice) once the nominal position has drifted past it
+        int s = read_;
+        if (s < lo || s > hi) {
+            s = Seek(lo, hi);
+            stats_.seeks++;
+        }
+
+        const int16_t* tail = buf_ + read_;
+        const int16_t* seg = buf_ + s;
+        for (int i = 0; i < L; i++) {
+            int32_t w = fade_[i];
+            out[produced + i] = (int16_t)((tail[i] * (32768 - w) + seg[i] * w) >> 15);
+        }
+        read_ = s + L;
+        ideal_q8_ += (L << 8) + d_q8;
+        produced += L;
+        stats_.steps++;
+    }
+    stats_.samples_out += produced;
+    return produced;
+}
+
+int TimeStretch::Flush(int16_t* out, int max_out) {
+    int n = len_ - read_;
+    if (n > max_out) n = max_out;
+    if (n > 0) {
+        memcpy(out, buf_ + read_, n * sizeof(int16_t));
+        read_ += n;
+        stats_.samples_out += n;
+    }
+    if (read_ >= len_) Reset();
+    return n > 0 ? n : 0;
+}
+
+void TimeStretch::LogStats(const char* tag) const {
+    if (stats_.samples_in == 0 || sample_rate_ == 0) return;
+    int delta_ms = (int)(((int64_t)stats_.samples_out - stats_.samples_in) * 1000 / sample_rate_);
+    ESP_LOGI(tag, "TSM: in=%lu out=%lu (%+dms) steps=%lu seeks=%lu",
+             stats_.samples_in, stats_.samples_out, delta_ms, stats_.steps, stats_.seeks);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+// WSOLA time-scale modification for the playback path. Output is built
+// from 10ms crossfaded segments; each new segment is taken from near the
+// nominal input position (advanced by rate * 10ms per step), at the offset
+// whose waveform best matches the natural continuation of the previous one.
+// At rate 1.0 it is a plain copy. Unlike an AudioStage, the output length
+// differs from the input, so it runs before the playback chain.
+#define TSM_OVERLAP_MS    10     // Segment hop = crossfade length
+#define TSM_SEEK_MS       5      // Search radius (covers a 100Hz pitch period)
+#define TSM_MAX_RATE_PCT  4      // Max speed change either way
+#define TSM_MAX_SAMPLE_RATE 24000
+#define TSM_OVERLAP_MAX   (TSM_MAX_SAMPLE_RATE * TSM_OVERLAP_MS / 1000)
+#define TSM_BUF_SAMPLES   4096   // History + lookahead + one 60ms block at 24kHz
+
+struct TsmStats {
+    uint32_t samples_in = 0;
+    uint32_t samples_out = 0;
+    uint32_t steps = 0;          // Segments produced while scaling
+    uint32_t seeks = 0;          // Steps that needed a waveform search (splices)
+};
+
+class TimeStretch {
+public:
+    TimeStretch() = default;
+
+    bool Init(int sample_rate);
+    // Drop buffered audio (after Flush(), or when playback stops)
+    void Reset();
+
+    // Playback speed in percent: +4 plays 4% faster (compresses), -4 slower.
+    // Clamped to ±TSM_MAX_RATE_PCT; 0 = pass-through.
+    void SetRatePct(int pct);
+    int rate_pct() const { return rate_pct_; }
+
+    // Consume `count` samples and write up to max_out samples. Up to two
+    // segments plus the seek radius stay buffered as lookahead.
+    int Process(const int16_t* in, int count, int16_t* out, int max_out);
+    // Emit everything still buffered unchanged (end of stream), then Reset()
+    int Flush(int16_t* out, int max_out);
+    int buffered() const { return len_ - read_; }
+
+    const TsmStats& stats() const { return stats_; }
+    void ResetStats() { stats_ = TsmStats(); }
+    void LogStats(const char* tag) const;
+
+private:
+    int Seek(int lo, int hi) const;
+    void Compact();
+
+    TsmStats stats_;
+    int sample_rate_ = 0;
+    int overlap_ = 0;            // L: samples per step
+    int seek_ = 0;               // Δ: search radius in samples
+    int rate_pct_ = 0;
+
+    int16_t buf_[TSM_BUF_SAMPLES];
+    int len_ = 0;                // Valid samples in buf_
+    int read_ = 0;               // Natural continuation of the last segment
+    int32_t ideal_q8_ = 0;       // Where read_ would be at the exact rate (Q8)
+    int16_t fade_[TSM_OVERLAP_MAX];  // Crossfade-in weights, Q15
+};
@@ -0,0 +1,180 @@
+#include "trace.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <mbedtls/base64.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+#define TAG "Trace"
+
+static_assert((TRACE_RING_RECORDS & (TRACE_RING_RECORDS - 1)) == 0, "TRACE_RING_RECORDS must be a power of two");
+
+// Phase follows the Chrome trace format: B/E = span, i = instant, C = counter
+struct TraceEventInfo {
+    const char* name;
+    char phase;
+};
+
+static const TraceEventInfo kEvents[TRACE_EVENT_COUNT] = {
+    {"rx_dma", 'i'},
+    {"mic_read", 'i'},
+    {"enc_queue", 'C'},
+    {"enc_drop", 'i'},
+    {"encode", 'B'},
+    {"encode", 'E'},
+    {"ws_tx", 'i'},
+    {"ws_rx_audio", 'i'},
+    {"dec_queue", 'C'},
+    {"dec_drop", 'i'},
+    {"decode", 'B'},
+    {"decode", 'E'},
+    {"pb_queue", 'C'},
+    {"pb_drop", 'i'},
+    {"pb_queue", 'C'},
+    {"spk_write", 'B'},
+    {"spk_write", 'E'},
+    {"underrun", 'i'},
+    {"amp", 'C'},
+    {"main_wake", 'i'},
+    {"button", 'C'},
+};
+
+static const char* const kTasks[TRACE_TASK_COUNT] = {
+    "other", "isr", "main", "audio_in", "audio_out", "opus_codec", "websocket",
+};
+
+std::atomic<bool> trace_enabled{false};
+
+static TraceRecord* rings[portNUM_PROCESSORS];
+static std::atomic<uint32_t> heads[portNUM_PROCESSORS];  // Records ever written per core
+static std::atomic<int> writers{0};                      // TraceWrite calls in flight, all cores
+static TaskHandle_t task_handles[TRACE_TASK_COUNT];
+
+static inline uint8_t current_task() {
+    if (xPortInIsrContext()) return TRACE_TASK_ISR;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (int i = TRACE_TASK_MAIN; i < TRACE_TASK_COUNT; i++) {
+        if (task_handles[i] == self) return i;
+    }
+    return TRACE_TASK_OTHER;
+}
+
+// IRAM: also called from the I2S RX ISR
+void IRAM_ATTR TraceWrite(TraceEvent ev, uint32_t arg) {
+    // Count first, then re-check: TraceDump() clears trace_enabled before
+    // reading writers, so either it waits for us or we see tracing off
+    writers.fetch_add(1);
+    int core = xPortGetCoreID();
+    TraceRecord* ring = rings[core];
+    if (!trace_enabled.load() || !ring) {
+        writers.fetch_sub(1);
+        return;
+    }
+    uint32_t i = heads[core].fetch_add(1, std::memory_order_relaxed) & (TRACE_RING_RECORDS - 1);
+    TraceRecord& r = ring[i];
+    r.ts_us = (uint32_t)esp_timer_get_time();
+    r.task = current_task();
+    r.event = ev;
+    r.arg = (uint16_t)arg;
+    writers.fetch_sub(1);
+}
+
+void TraceRegisterTask(TraceTask task) {
+    if (task < TRACE_TASK_MAIN || task >= TRACE_TASK_COUNT) return;
+    task_handles[task] = xTaskGetCurrentTaskHandle();
+}
+
+bool TraceStart() {
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        if (rings[c]) continue;
+        // Internal RAM so the ISR can write while the flash cache is off
+        rings[c] = (TraceRecord*)heap_caps_calloc(TRACE_RING_RECORDS, sizeof(TraceRecord),
+                                                  MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (!rings[c]) {
+            ESP_LOGE(TAG, "No memory for trace ring (core %d)", c);
+            return false;
+        }
+    }
+    for (auto& h : heads) h = 0;
+    trace_enabled = true;
+    ESP_LOGI(TAG, "Tracing on: %d records/core", TRACE_RING_RECORDS);
+    return true;
+}
+
+void TraceStop() {
+    trace_enabled = false;
+}
+
+int TraceDump(const TraceSendFn& send, const TraceClockFn& to_server) {
+    bool was_enabled = trace_enabled.exchange(false);
+    // A writer is a few instructions from done, but may be a task this one
+    // preempted on the same core: yield rather than spin
+    while (writers.load() > 0) vTaskDelay(1);
+
+    const size_t buf_size = 256 + TRACE_DUMP_RECORDS * sizeof(TraceRecord) * 4 / 3 + 4;
+    char* buf = (char*)malloc(buf_size);
+    if (!buf) return 0;
+
+    // Meta: the host tool needs the name tables and a 64-bit "now" to unwrap
+    // timestamps. Every message stays under WS_MAX_FRAME_BYTES so it can be
+    // buffered across a reconnect.
+    int64_t now = esp_timer_get_time();
+    int64_t now_srv = to_server ? to_server(now) : 0;
+    int n = snprintf(buf, buf_size, "{\"type\":\"trace_meta\",\"now_us\":%lld,\"cores\":%d,",
+                     (long long)now, portNUM_PROCESSORS);
+    if (now_srv) n += snprintf(buf + n, buf_size - n, "\"now_srv_us\":%lld,", (long long)now_srv);
+    n += snprintf(buf + n, buf_size - n, "\"tasks\":[");
+    for (int t = 0; t < TRACE_TASK_COUNT; t++) {
+        n += snprintf(buf + n, buf_size - n, "%s\"%s\"", t ? "," : "", kTasks[t]);
+    }
+    n += snprintf(buf + n, buf_size - n, "]}");
+    send(buf, n);
+    n = snprintf(buf, buf_size, "{\"type\":\"trace_events\",\"events\":[");
+    for (int e = 0; e < TRACE_EVENT_COUNT; e++) {
+        n += snprintf(buf + n, buf_size - n, "%s[\"%s\",\"%c\"]", e ? "," : "", kEvents[e].name, kEvents[e].phase);
+    }
+    n += snprintf(buf + n, buf_size - n, "]}");
+    send(buf, n);
+
+    int sent = 0;
+    uint32_t overwritten = 0;
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        if (!rings[c]) continue;
+        uint32_t head = heads[c];
+        uint32_t count = head < TRACE_RING_RECORDS ? head : TRACE_RING_RECORDS;
+        overwritten += head - count;
+        int parts = (count + TRACE_DUMP_RECORDS - 1) / TRACE_DUMP_RECORDS;
+        for (int p = 0; p < parts; p++) {
+            uint32_t first = head - count + p * TRACE_DUMP_RECORDS;
+            uint32_t k = count - p * TRACE_DUMP_RECORDS;
+            if (k > TRACE_DUMP_RECORDS) k = TRACE_DUMP_RECORDS;
+            TraceRecord chunk[TRACE_DUMP_RECORDS];
+            for (uint32_t j = 0; j < k; j++) {
+                chunk[j] = rings[c][(first + j) & (TRACE_RING_RECORDS - 1)];
+            }
+            n = snprintf(buf, buf_size, "{\"type\":\"trace_dump\",\"core\":%d,\"part\":%d,\"parts\":%d,\"data\":\"",
+                         c, p, parts);
+            size_t olen = 0;
+            mbedtls_base64_encode((unsigned char*)buf + n, buf_size - n - 2, &olen,
+                                  (const unsigned char*)chunk, k * sizeof(TraceRecord));
+            n += olen;
+            n += snprintf(buf + n, buf_size - n, "\"}");
+            if (!send(buf, n)) break;
+            sent += k;
+        }
+    }
+    n = snprintf(buf, buf_size, "{\"type\":\"trace_end\",\"records\":%d,\"overwritten\":%lu}",
+                 sent, (unsigned long)overwritten);
+    send(buf, n);
+    free(buf);
+
+    ESP_LOGI(TAG, "Trace dump: %d records (%lu overwritten)", sent, (unsigned long)overwritten);
+    for (auto& h : heads) h = 0;  // Next dump covers only what follows
+    trace_enabled = was_enabled;
+    return sent;
+}
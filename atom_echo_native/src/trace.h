@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Low-overhead event tracer. Each core writes 8-byte records into its own
+// ring (lock-free: one atomic increment per event), so hooks in the audio
+// tasks and the RX DMA ISR don't perturb timing the way ESP_LOGI does.
+// Rings are allocated on the first TraceStart() and kept; while tracing is
+// off a hook costs one load and branch. tools/trace2chrome.py converts a
+// dump into Chrome/Perfetto trace JSON.
+#define TRACE_RING_RECORDS   1024  // Per core, power of two (8KB)
+#define TRACE_DUMP_RECORDS   32    // Records per trace_dump message (~420 bytes of JSON)
+
+enum TraceTask : uint8_t {
+    TRACE_TASK_OTHER,
+    TRACE_TASK_ISR,
+    TRACE_TASK_MAIN,
+    TRACE_TASK_INPUT,
+    TRACE_TASK_OUTPUT,
+    TRACE_TASK_CODEC,
+    TRACE_TASK_WS,
+    TRACE_TASK_COUNT,
+};
+
+// Keep in step with the name/phase table in trace.cc
+enum TraceEvent : uint8_t {
+    TRACE_RX_DMA,           // RX descriptor done (ISR), arg: frames ready
+    TRACE_MIC_READ,         // arg: samples read
+    TRACE_ENC_QUEUE,        // PCM block queued for encode, arg: queue depth
+    TRACE_ENC_DROP,
+    TRACE_ENCODE_BEGIN,
+    TRACE_ENCODE_END,       // arg: encoded bytes
+    TRACE_WS_TX,            // arg: bytes
+    TRACE_WS_RX_AUDIO,      // arg: seq (low 16 bits)
+    TRACE_DEC_QUEUE,        // arg: queue depth
+    TRACE_DEC_DROP,
+    TRACE_DECODE_BEGIN,
+    TRACE_DECODE_END,       // arg: samples
+    TRACE_PB_QUEUE,         // arg: queue depth
+    TRACE_PB_DROP,
+    TRACE_PB_DEQUEUE,       // arg: frames still queued
+    TRACE_SPK_WRITE_BEGIN,  // arg: samples
+    TRACE_SPK_WRITE_END,
+    TRACE_UNDERRUN,
+    TRACE_AMP,              // arg: 1 = unmuted
+    TRACE_MAIN_WAKE,
+    TRACE_BUTTON,           // arg: 1 = pressed
+    TRACE_EVENT_COUNT,
+};
+
+struct TraceRecord {
+    uint32_t ts_us;   // esp_timer time, low 32 bits
+    uint8_t task;     // TraceTask
+    uint8_t event;    // TraceEvent
+    uint16_t arg;
+};
+static_assert(sizeof(TraceRecord) == 8, "trace record must stay compact");
+
+extern std::atomic<bool> trace_enabled;
+void TraceWrite(TraceEvent ev, uint32_t arg);
+
+#define TRACE(ev, arg) do { if (trace_enabled) TraceWrite((ev), (arg)); } while (0)
+
+// Tag the calling task so its events carry its TraceTask id
+void TraceRegisterTask(TraceTask task);
+
+// Start/stop recording. Start allocates the rings on first use and returns
+// false if internal RAM is short.
+bool TraceStart();
+void TraceStop();
+
+// Send the rings as JSON messages: trace_meta, trace_events, trace_dump
+// parts (base64 records per core), trace_end. Recording pauses for the
+// duration (after any TraceWrite in flight on either core, ISR included,
+// has finished) and the rings are cleared afterwards. to_server maps esp_timer
+// time to server time (0 if unknown); trace_meta then carries both clocks.
+using TraceSendFn = std::function<bool(const char* json, size_t len)>;
+using TraceClockFn = std::function<int64_t(int64_t device_us)>;
+int TraceDump(const TraceSendFn& send, const TraceClockFn& to_server = nullptr);
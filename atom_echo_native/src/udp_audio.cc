@@ -0,0 +1,183 @@
+#include "udp_audio.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <cerrno>
+#include <cstring>
+
+#define TAG "UdpAudio"
+
+// One receiver per device; storage accounted for in UDP_STATIC_BYTES
+static StackType_t rx_stack[UDP_TASK_STACK_SIZE];
+static StaticTask_t rx_tcb;
+static StaticSemaphore_t parked_buf;
+
+// lwIP has no pipe or eventfd here, so RxTask is woken out of select() by a
+// datagram to itself on a loopback socket, as esp_http_server does
+bool UdpAudio::OpenWakeSocket() {
+    int w = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (w < 0) return false;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(w, (sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(w, (sockaddr*)&addr, &len) != 0 ||
+        connect(w, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(w);
+        return false;
+    }
+    wake_sock_ = w;
+    return true;
+}
+
+void UdpAudio::Wake() {
+    uint8_t b = 0;
+    send(wake_sock_, &b, 1, 0);
+}
+
+bool UdpAudio::Open(const char* host, uint16_t port, uint32_t ssrc, uint32_t seq) {
+    Close();
+    if (wake_sock_ < 0 && !OpenWakeSocket()) {
+        ESP_LOGE(TAG, "Wake socket failed: %d", errno);
+        return false;
+    }
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        ESP_LOGE(TAG, "Not an IPv4 address: %s", host);
+        return false;
+    }
+    int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s < 0) {
+        ESP_LOGE(TAG, "socket() failed: %d", errno);
+        return false;
+    }
+    // connect() so only the server's datagrams are delivered
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        ESP_LOGE(TAG, "connect() failed: %d", errno);
+        close(s);
+        return false;
+    }
+
+    ssrc_ = ssrc;
+    rx_seq_ = seq;
+    synced_ = false;
+    sock_ = s;
+    SendProbe();
+
+    if (!task_) {
+        parked_ = xSemaphoreCreateBinaryStatic(&parked_buf);
+        // Same priority as the websocket client task, which it stands in for
+        task_ = xTaskCreateStatic(RxTask, "udp_audio", UDP_TASK_STACK_SIZE, this, 5, rx_stack, &rx_tcb);
+    } else {
+        xTaskNotifyGive(task_);
+    }
+    ESP_LOGI(TAG, "Offered %s:%u ssrc=%08lx, probing", host, port, (unsigned long)ssrc);
+    return true;
+}
+
+void UdpAudio::Close() {
+    ready_ = false;
+    int s = sock_;
+    if (s < 0) return;
+    // RxTask may be in select()/recv() on s, and a closed fd number can be
+    // handed out again at once. Unpublish it, wake RxTask and close only
+    // once it has parked without a socket.
+    xSemaphoreTake(parked_, 0);
+    sock_ = -1;
+    Wake();
+    xSemaphoreTake(parked_, portMAX_DELAY);
+    close(s);
+}
+
+void UdpAudio::SendProbe() {
+    // Header only, carrying the offered SSRC: tells the server our address
+    uint8_t h[UDP_RTP_HEADER_BYTES] = {0x80, UDP_RTP_PAYLOAD_OPUS};
+    h[8] = ssrc_ >> 24;
+    h[9] = ssrc_ >> 16;
+    h[10] = ssrc_ >> 8;
+    h[11] = ssrc_;
+    int s = sock_;
+    if (s >= 0) send(s, h, sizeof(h), 0);
+    last_probe_us_ = esp_timer_get_time();
+}
+
+void UdpAudio::HandlePacket(const uint8_t* p, int len) {
+    if (len <= UDP_RTP_HEADER_BYTES || (p[0] & 0xC0) != 0x80 || (p[1] & 0x7F) != UDP_RTP_PAYLOAD_OPUS) return;
+    uint32_t ssrc = ((uint32_t)p[8] << 24) | ((uint32_t)p[9] << 16) | ((uint32_t)p[10] << 8) | p[11];
+    if (ssrc != ssrc_) return;  // Stale stream from an earlier offer
+
+    // Extend the 16-bit sequence around the last frame received
+    uint16_t s16 = ((uint16_t)p[2] << 8) | p[3];
+    uint32_t last = rx_seq_;
+    uint32_t seq = last + (int16_t)(s16 - (uint16_t)last);
+
+    if (synced_ && (int32_t)(seq - last) <= 0) {
+        stats_.late++;
+        return;
+    }
+    if (synced_ && seq != last + 1) {
+        uint32_t gap = seq - last - 1;
+        stats_.lost += gap;
+        if (gap <= UDP_MAX_CONCEAL_FRAMES) {
+            for (uint32_t k = 1; k <= gap; k++) {
+                if (on_audio_) on_audio_(nullptr, 0, last + k);
+            }
+            stats_.concealed += gap;
+        } else {
+            ESP_LOGW(TAG, "Lost %lu frames before seq %lu, resyncing", (unsigned long)gap, (unsigned long)seq);
+        }
+    }
+    synced_ = true;
+    rx_seq_ = seq;
+    stats_.received++;
+    if (on_audio_) on_audio_(p + UDP_RTP_HEADER_BYTES, len - UDP_RTP_HEADER_BYTES, seq);
+}
+
+void UdpAudio::LogStats(const char* tag) {
+    if (stats_.received == 0 && stats_.lost == 0) return;
+    ESP_LOGI(tag, "UDP: received=%lu lost=%lu concealed=%lu late=%lu",
+             (unsigned long)stats_.received, (unsigned long)stats_.lost,
+             (unsigned long)stats_.concealed, (unsigned long)stats_.late);
+    stats_ = UdpAudioStats();
+}
+
+void UdpAudio::RxTask(void* arg) {
+    auto* self = (UdpAudio*)arg;
+    uint8_t buf[UDP_RTP_HEADER_BYTES + 512];
+
+    while (true) {
+        int s = self->sock_;
+        if (s < 0) {
+            // No stream: let Close() have the socket, then sleep with no
+            // timeout until Open() hands over the next one
+            xSemaphoreGive(self->parked_);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        // Probe until the server has our address, then only keep it fresh:
+        // an idle stream wakes the CPU once per keepalive, not per probe
+        int64_t since_ms = (esp_timer_get_time() - self->last_probe_us_) / 1000;
+        int64_t wait_ms = (self->ready_ ? UDP_KEEPALIVE_MS : UDP_PROBE_INTERVAL_MS) - since_ms;
+        if (wait_ms <= 0) {
+            self->SendProbe();
+            continue;
+        }
+        const int w = self->wake_sock_;
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(s, &fds);
+        FD_SET(w, &fds);
+        timeval tv = {(time_t)(wait_ms / 1000), (suseconds_t)(wait_ms % 1000 * 1000)};
+        if (select((s > w ? s : w) + 1, &fds, nullptr, nullptr, &tv) <= 0) continue;
+        if (FD_ISSET(w, &fds)) {
+            while (recv(w, buf, sizeof(buf), MSG_DONTWAIT) > 0) {}  // Just a wakeup: re-read sock_
+        }
+        if (FD_ISSET(s, &fds)) {
+            int n = recv(s, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n > 0 && s == self->sock_) self->HandlePacket(buf, n);
+        }
+    }
+}
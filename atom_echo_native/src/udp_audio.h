@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// Optional downlink audio over UDP. The WebSocket stays the control channel
+// and negotiates it: udp_offer (port, ssrc, seq) → probe datagrams → udp_ready.
+// Packets are RTP-style: 12-byte header (V=2, payload type, 16-bit seq,
+// 48kHz timestamp, SSRC) + one Opus frame. Nothing is retransmitted: a gap
+// is handed to the decoder as lost frames to conceal and late packets are
+// dropped, so a lost packet costs one frame of PLC instead of stalling the
+// whole burst behind a TCP retransmit.
+#define UDP_RTP_HEADER_BYTES    12
+#define UDP_RTP_PAYLOAD_OPUS    111
+#define UDP_MAX_CONCEAL_FRAMES  3      // Longer gaps resync without concealment
+#define UDP_PROBE_INTERVAL_MS   500    // Until udp_ready
+#define UDP_KEEPALIVE_MS        15000  // Keeps NAT/firewall state open; RxTask's only timer once ready
+#define UDP_TASK_STACK_SIZE     3072
+
+// Statically allocated by UdpAudio (see memory_plan.h)
+constexpr size_t UDP_STATIC_BYTES = UDP_TASK_STACK_SIZE + sizeof(StaticTask_t) + sizeof(StaticSemaphore_t);
+
+struct UdpAudioStats {
+    uint32_t received = 0;
+    uint32_t lost = 0;        // Missing from the sequence
+    uint32_t concealed = 0;   // Lost frames handed to the decoder for PLC
+    uint32_t late = 0;        // Arrived after a newer packet (dropped)
+};
+
+class UdpAudio {
+public:
+    // len == 0: frame `seq` was lost and should be concealed
+    using AudioCallback = std::function<void(const uint8_t* data, size_t len, uint32_t seq)>;
+
+    void SetAudioCallback(AudioCallback cb) { on_audio_ = cb; }
+
+    // Receive stream `ssrc` from host:port (IPv4 literal) and probe until the
+    // server answers with udp_ready. seq is the server's last downlink seq,
+    // used to extend the 16-bit RTP sequence. A new offer replaces the old one.
+    bool Open(const char* host, uint16_t port, uint32_t ssrc, uint32_t seq);
+    // Stops the receiver (waits for RxTask to let go of the socket), then
+    // closes the socket. Call from the task that calls Open().
+    void Close();
+    void SetReady() { ready_ = true; }
+    bool IsReady() const { return ready_ && sock_ >= 0; }
+
+    uint32_t rx_seq() const { return rx_seq_; }  // Last downlink frame received
+    const UdpAudioStats& stats() const { return stats_; }
+    void LogStats(const char* tag);  // Then reset
+
+private:
+    static void RxTask(void* arg);
+    bool OpenWakeSocket();
+    void Wake();
+    void SendProbe();
+    void HandlePacket(const uint8_t* p, int len);
+
+    AudioCallback on_audio_;
+    TaskHandle_t task_ = nullptr;
+    SemaphoreHandle_t parked_ = nullptr;  // Given by RxTask once it holds no socket
+    int wake_sock_ = -1;          // Loopback datagram socket: a byte on it wakes RxTask's select()
+    volatile int sock_ = -1;
+    volatile bool ready_ = false;
+    uint32_t ssrc_ = 0;
+    volatile uint32_t rx_seq_ = 0;
+    bool synced_ = false;         // First packet of this offer seen
+    int64_t last_probe_us_ = 0;
+    UdpAudioStats stats_;
+};
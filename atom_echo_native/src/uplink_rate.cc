@@ -0,0 +1,99 @@
+#include "uplink_rate.h"
+#include <esp_log.h>
+
+// Bitrate ladder and frames per message at each level
+static const struct { int bps; int bundle; } kLevels[] = {
+    {6000, 3}, {8000, 3}, {12000, 2}, {16000, 1}, {20000, 1}, {24000, 1}, {32000, 1},
+};
+static constexpr int kLevelCount = sizeof(kLevels) / sizeof(kLevels[0]);
+
+void UplinkRateController::Init(int frame_us, int min_bps, int max_bps) {
+    stats_ = UplinkRateStats();
+    congested_us_ = (uint32_t)frame_us * UPLINK_CONGESTED_SEND_PCT / 100;
+    clear_us_ = (uint32_t)frame_us * UPLINK_CLEAR_SEND_PCT / 100;
+    hold_ = 0;
+    clear_run_ = 0;
+    congested_ = false;
+    weak_ = false;
+    SetLimits(min_bps, max_bps);
+    level_ = max_level_;
+    stats_.bitrate = bitrate();
+    stats_.bundle = bundle();
+}
+
+void UplinkRateController::SetLimits(int min_bps, int max_bps) {
+    int lo = 0, hi = kLevelCount - 1;
+    while (lo < kLevelCount - 1 && kLevels[lo].bps < min_bps) lo++;
+    while (hi > 0 && kLevels[hi].bps > max_bps) hi--;
+    if (hi < lo) hi = lo;
+    min_level_ = lo;
+    max_level_ = hi;
+    // Moved inside the new range at the next frame
+}
+
+void UplinkRateController::SetRssi(int rssi_dbm) {
+    stats_.rssi = rssi_dbm;
+    if (rssi_dbm == 0) return;
+    if (rssi_dbm < UPLINK_RSSI_WEAK_DBM) weak_ = true;
+    else if (rssi_dbm > UPLINK_RSSI_WEAK_DBM + UPLINK_RSSI_HYST_DB) weak_ = false;
+}
+
+int UplinkRateController::Ceiling() const {
+    int top = max_level_;
+    if (weak_) {
+        while (top > min_level_ && kLevels[top].bps > UPLINK_WEAK_MAX_BPS) top--;
+    }
+    return top;
+}
+
+int UplinkRateController::bitrate() const { return kLevels[level_].bps; }
+int UplinkRateController::bundle() const { return kLevels[level_].bundle; }
+
+bool UplinkRateController::OnFrame(uint32_t send_us, int backlog) {
+    uint32_t& avg = stats_.send_avg_us;
+    avg = avg - avg / 4 + send_us / 4;
+    if (send_us > stats_.send_max_us) stats_.send_max_us = send_us;
+    if (backlog > stats_.backlog_max) stats_.backlog_max = backlog;
+    if (hold_ > 0) hold_--;
+
+    congested_ = avg > congested_us_ || backlog >= UPLINK_CONGESTED_BACKLOG;
+    int top = Ceiling();
+    int next = level_;
+    if (level_ > top) {
+        next = top;
+    } else if (level_ < min_level_) {
+        next = min_level_;
+    } else if (congested_) {
+        clear_run_ = 0;
+        if (hold_ == 0 && level_ > min_level_) {
+            next = level_ - 1;
+            hold_ = UPLINK_DOWN_HOLD_FRAMES;
+        }
+    } else if (avg < clear_us_ && backlog == 0) {
+        if (++clear_run_ >= UPLINK_UP_CLEAR_FRAMES && level_ < top) {
+            next = level_ + 1;
+            clear_run_ = 0;
+        }
+    } else {
+        clear_run_ = 0;  // In between: hold the level
+    }
+    if (next == level_) return false;
+
+    if (next > level_) stats_.steps_up++;
+    else stats_.steps_down++;
+    level_ = next;
+    stats_.bitrate = bitrate();
+    stats_.bundle = bundle();
+    return true;
+}
+
+void UplinkRateController::ResetRecordingStats() {
+    stats_.send_max_us = 0;
+    stats_.backlog_max = 0;
+}
+
+void UplinkRateController::LogStats(const char* tag) const {
+    ESP_LOGI(tag, "Uplink rate: %dbps bundle=%d send avg=%luus max=%luus backlog_max=%d rssi=%d steps=+%lu/-%lu",
+             stats_.bitrate, stats_.bundle, stats_.send_avg_us, stats_.send_max_us, stats_.backlog_max,
+             stats_.rssi, stats_.steps_up, stats_.steps_down);
+}
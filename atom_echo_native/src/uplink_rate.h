@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+
+// Uplink Opus bitrate, and frames per WebSocket message, from how the link
+// copes. Measured per frame: how long the send call blocked (TCP
+// backpressure shows up as a slow send) and how many frames wait behind it
+// in the encode queue and the transport's offline buffer. A congested frame
+// steps one level down at once, then holds so the effect can show; a long
+// clean run steps one level up. The gap between the congested and clear
+// thresholds is the hysteresis. RSSI only caps the ceiling: a weak signal
+// is a hint, the send path is the measurement. The lowest levels bundle
+// frames, trading uplink latency for fewer per-message headers and less
+// WiFi airtime per frame.
+#define UPLINK_CONGESTED_SEND_PCT 30     // Average send blocking, share of a frame period...
+#define UPLINK_CONGESTED_BACKLOG  2      // ...or frames waiting: congested
+#define UPLINK_CLEAR_SEND_PCT     10     // Below this with nothing waiting: clear
+#define UPLINK_DOWN_HOLD_FRAMES   5      // Between step downs (~300ms)
+#define UPLINK_UP_CLEAR_FRAMES    25     // Clear frames in a row before a step up (~1.5s)
+#define UPLINK_RSSI_WEAK_DBM      -75    // Below: ceiling capped at UPLINK_WEAK_MAX_BPS
+#define UPLINK_RSSI_HYST_DB       4      // Cap lifts above UPLINK_RSSI_WEAK_DBM + this
+#define UPLINK_WEAK_MAX_BPS       12000
+#define UPLINK_DEFAULT_MIN_BPS    8000
+#define UPLINK_DEFAULT_MAX_BPS    24000  // The former fixed rate: good links are unchanged
+#define UPLINK_MAX_BUNDLE         3
+
+struct UplinkRateStats {
+    int bitrate = 0;
+    int bundle = 1;               // Frames per message
+    uint32_t send_avg_us = 0;     // Running average of send blocking per frame
+    uint32_t send_max_us = 0;     // Since ResetRecordingStats()
+    int backlog_max = 0;          // Since ResetRecordingStats()
+    int rssi = 0;                 // Last reported, 0 = unknown
+    uint32_t steps_up = 0;        // Since boot
+    uint32_t steps_down = 0;
+};
+
+class UplinkRateController {
+public:
+    // frame_us: one frame period. Limits snap inward to the bitrate ladder.
+    void Init(int frame_us, int min_bps, int max_bps);
+    void SetLimits(int min_bps, int max_bps);
+    void SetRssi(int rssi_dbm);
+
+    // One frame handed to the transport: send_us it blocked for, backlog
+    // frames still waiting. Returns true if bitrate() or bundle() changed.
+    bool OnFrame(uint32_t send_us, int backlog);
+    bool congested() const { return congested_; }
+
+    int bitrate() const;
+    int bundle() const;
+
+    void ResetRecordingStats();
+    const UplinkRateStats& stats() const { return stats_; }
+    void LogStats(const char* tag) const;
+
+private:
+    int Ceiling() const;  // Top level allowed now (limits and RSSI)
+
+    UplinkRateStats stats_;
+    uint32_t congested_us_ = 0;
+    uint32_t clear_us_ = 0;
+    int level_ = 0;
+    int min_level_ = 0;
+    int max_level_ = 0;
+    int hold_ = 0;                // Frames until another step down is allowed
+    int clear_run_ = 0;
+    bool congested_ = false;
+    bool weak_ = false;           // RSSI cap in force
+};
@@ -0,0 +1,279 @@
+#include "wifi_station.h"
+#include <esp_log.h>
+#include <esp_wifi.h>
+#include <esp_netif.h>
+#include <nvs.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "WifiStation"
+
+#define WIFI_MAX_RETRY       3     // Attempts per candidate before moving on
+#define WIFI_RETRY_DELAY_MS  500
+#define WIFI_RESCAN_DELAY_MS 2000  // After every candidate failed
+#define WIFI_SCAN_MAX_APS    20
+#define WIFI_NVS_NAMESPACE   "wifi"
+#define WIFI_NVS_KEY         "last_ap"
+
+// Retry timer → event loop, so all state changes happen on the event task
+ESP_EVENT_DEFINE_BASE(WIFI_STATION_EVENT);
+enum { WIFI_STATION_RETRY };
+
+// Last-good AP as stored in NVS
+struct CachedAp {
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+};
+
+WifiStation::WifiStation(const WifiCredential* networks, int count)
+    : networks_(networks), count_(count) {}
+
+const char* WifiStation::ssid() const {
+    return connected_ ? networks_[connected_ap_.index].ssid : "";
+}
+
+void WifiStation::Start() {
+    start_us_ = esp_timer_get_time();
+
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &EventHandler, this));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &EventHandler, this));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_STATION_EVENT, WIFI_STATION_RETRY, &EventHandler, this));
+
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = RetryTimer;
+    timer_args.arg = this;
+    timer_args.name = "wifi_retry";
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &retry_timer_));
+
+    Candidate cached;
+    if (LoadCache(&cached)) {
+        candidates_[0] = cached;
+        candidate_count_ = 1;
+        from_cache_ = true;
+        ESP_LOGI(TAG, "Fast connect: cached %s on channel %d", networks_[cached.index].ssid, cached.channel);
+    }
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_start());
+}
+
+void WifiStation::EventHandler(void* arg, esp_event_base_t base, int32_t id, void* data) {
+    auto* self = (WifiStation*)arg;
+    if (base == WIFI_EVENT) {
+        if (id == WIFI_EVENT_STA_START) {
+            if (self->candidate_count_ > 0) self->ConnectCandidate();
+            else self->StartScan();
+        } else if (id == WIFI_EVENT_SCAN_DONE) {
+            self->OnScanDone();
+        } else if (id == WIFI_EVENT_STA_CONNECTED) {
+            auto* ev = (wifi_event_sta_connected_t*)data;
+            Candidate& ap = self->connected_ap_;
+            ap.index = self->candidates_[self->candidate_pos_].index;
+            memcpy(ap.bssid, ev->bssid, sizeof(ap.bssid));
+            ap.channel = ev->channel;
+        } else if (id == WIFI_EVENT_STA_DISCONNECTED) {
+            self->OnDisconnected(((wifi_event_sta_disconnected_t*)data)->reason);
+        }
+    } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        self->OnGotIp((ip_event_got_ip_t*)data);
+    } else if (base == WIFI_STATION_EVENT) {
+        // Scheduled retry: next candidate, or rescan once all have failed
+        if (self->candidate_pos_ < self->candidate_count_) self->ConnectCandidate();
+        else self->StartScan();
+    }
+}
+
+void WifiStation::RetryTimer(void* arg) {
+    esp_event_post(WIFI_STATION_EVENT, WIFI_STATION_RETRY, nullptr, 0, 0);
+}
+
+void WifiStation::ScheduleRetry(int delay_ms) {
+    esp_timer_stop(retry_timer_);
+    esp_timer_start_once(retry_timer_, (uint64_t)delay_ms * 1000);
+}
+
+void WifiStation::StartScan() {
+    candidate_count_ = 0;
+    candidate_pos_ = 0;
+    attempts_ = 0;
+    from_cache_ = false;
+    scan_start_us_ = esp_timer_get_time();
+    esp_err_t err = esp_wifi_scan_start(nullptr, false);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Scan start failed: %s", esp_err_to_name(err));
+        ScheduleRetry(WIFI_RESCAN_DELAY_MS);
+    }
+}
+
+void WifiStation::OnScanDone() {
+    uint16_t n = WIFI_SCAN_MAX_APS;
+    auto* recs = (wifi_ap_record_t*)calloc(n, sizeof(wifi_ap_record_t));
+    if (!recs) {
+        esp_wifi_clear_ap_list();
+        ScheduleRetry(WIFI_RESCAN_DELAY_MS);
+        return;
+    }
+    esp_wifi_scan_get_ap_records(&n, recs);
+
+    // Strongest BSSID of each configured network
+    const int max_candidates = sizeof(candidates_) / sizeof(candidates_[0]);
+    candidate_count_ = 0;
+    for (int i = 0; i < count_ && candidate_count_ < max_candidates; i++) {
+        const wifi_ap_record_t* best = nullptr;
+        for (int j = 0; j < n; j++) {
+            if (strcmp((const char*)recs[j].ssid, networks_[i].ssid) == 0 &&
+                (!best || recs[j].rssi > best->rssi)) {
+                best = &recs[j];
+            }
+        }
+        if (best) {
+            Candidate& c = candidates_[candidate_count_++];
+            c.index = i;
+            memcpy(c.bssid, best->bssid, sizeof(c.bssid));
+            c.channel = best->primary;
+            c.rssi = best->rssi;
+        }
+    }
+    free(recs);
+
+    std::sort(candidates_, candidates_ + candidate_count_,
+              [](const Candidate& a, const Candidate& b) { return a.rssi > b.rssi; });
+
+    int scan_ms = (int)((esp_timer_get_time() - scan_start_us_) / 1000);
+    if (candidate_count_ == 0) {
+        // Nothing visible (hidden SSID?): plain connects in list order
+        ESP_LOGW(TAG, "Scan: %d APs in %d ms, no configured network seen", n, scan_ms);
+        for (int i = 0; i < count_ && i < max_candidates; i++) {
+            candidates_[i] = Candidate{i, {}, 0, 0};
+        }
+        candidate_count_ = count_ < max_candidates ? count_ : max_candidates;
+    } else {
+        ESP_LOGI(TAG, "Scan: %d APs in %d ms, best %s (%d dBm, ch %d), %d candidate(s)",
+                 n, scan_ms, networks_[candidates_[0].index].ssid, candidates_[0].rssi,
+                 candidates_[0].channel, candidate_count_);
+    }
+    candidate_pos_ = 0;
+    attempts_ = 0;
+    ConnectCandidate();
+}
+
+void WifiStation::ConnectCandidate() {
+    const Candidate& c = candidates_[candidate_pos_];
+    const WifiCredential& cred = networks_[c.index];
+
+    wifi_config_t cfg = {};
+    strncpy((char*)cfg.sta.ssid, cred.ssid, sizeof(cfg.sta.ssid));
+    strncpy((char*)cfg.sta.password, cred.password, sizeof(cfg.sta.password));
+    if (c.channel) {
+        // Known AP: skip the driver's own all-channel scan
+        cfg.sta.bssid_set = true;
+        memcpy(cfg.sta.bssid, c.bssid, sizeof(cfg.sta.bssid));
+        cfg.sta.channel = c.channel;
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &cfg);
+
+    attempts_++;
+    ESP_LOGI(TAG, "Connecting to %s%s (attempt %d/%d)", cred.ssid,
+             c.channel ? " by BSSID" : "", attempts_, WIFI_MAX_RETRY);
+    esp_wifi_connect();
+}
+
+void WifiStation::OnDisconnected(uint8_t reason) {
+    bool was_connected = connected_;
+    connected_ = false;
+
+    if (was_connected) {
+        // Dropout: go straight back to the same AP before scanning
+        dropout_us_ = esp_timer_get_time();
+        ESP_LOGW(TAG, "Link to %s lost (reason %d)", networks_[connected_ap_.index].ssid, reason);
+        candidates_[0] = connected_ap_;
+        candidate_count_ = 1;
+        candidate_pos_ = 0;
+        attempts_ = 0;
+        from_cache_ = false;
+        ConnectCandidate();
+        return;
+    }
+
+    ESP_LOGW(TAG, "Connect failed (reason %d)", reason);
+    if (from_cache_) {
+        // Cached AP gone or moved: one scan instead of retrying blind
+        StartScan();
+        return;
+    }
+    if (attempts_ >= WIFI_MAX_RETRY) {
+        attempts_ = 0;
+        candidate_pos_++;
+    }
+    ScheduleRetry(candidate_pos_ < candidate_count_ ? WIFI_RETRY_DELAY_MS : WIFI_RESCAN_DELAY_MS);
+}
+
+void WifiStation::OnGotIp(const ip_event_got_ip_t* event) {
+    connected_ = true;
+    attempts_ = 0;
+    from_cache_ = false;
+
+    int64_t now = esp_timer_get_time();
+    const char* name = networks_[connected_ap_.index].ssid;
+    if (dropout_us_) {
+        ESP_LOGI(TAG, "Recovered %s in %d ms, IP: " IPSTR, name,
+                 (int)((now - dropout_us_) / 1000), IP2STR(&event->ip_info.ip));
+        dropout_us_ = 0;
+    } else {
+        ESP_LOGI(TAG, "Connected to %s, IP: " IPSTR " (%d ms after WiFi start, %d ms after boot)",
+                 name, IP2STR(&event->ip_info.ip),
+                 (int)((now - start_us_) / 1000), (int)(now / 1000));
+    }
+    SaveCache();
+    if (on_connect_) on_connect_();
+}
+
+bool WifiStation::LoadCache(Candidate* out) {
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) return false;
+    CachedAp ap = {};
+    size_t len = sizeof(ap);
+    esp_err_t err = nvs_get_blob(nvs, WIFI_NVS_KEY, &ap, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK || len != sizeof(ap) || ap.channel == 0) return false;
+
+    ap.ssid[sizeof(ap.ssid) - 1] = '\0';
+    for (int i = 0; i < count_; i++) {
+        if (strcmp(networks_[i].ssid, ap.ssid) == 0) {
+            out->index = i;
+            memcpy(out->bssid, ap.bssid, sizeof(out->bssid));
+            out->channel = ap.channel;
+            out->rssi = 0;
+            return true;
+        }
+    }
+    return false;  // Network no longer configured
+}
+
+void WifiStation::SaveCache() {
+    CachedAp ap = {};
+    strncpy(ap.ssid, networks_[connected_ap_.index].ssid, sizeof(ap.ssid) - 1);
+    memcpy(ap.bssid, connected_ap_.bssid, sizeof(ap.bssid));
+    ap.channel = connected_ap_.channel;
+
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) return;
+    // Skip the flash write when nothing changed (the common case)
+    CachedAp old = {};
+    size_t len = sizeof(old);
+    if (nvs_get_blob(nvs, WIFI_NVS_KEY, &old, &len) != ESP_OK || len != sizeof(old) ||
+        memcmp(&old, &ap, sizeof(ap)) != 0) {
+        nvs_set_blob(nvs, WIFI_NVS_KEY, &ap, sizeof(ap));
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_timer.h>
+
+struct WifiCredential { const char* ssid; const char* password; };
+
+// STA connection manager. Boot connects straight to the last-good AP
+// (SSID/BSSID/channel cached in NVS); if that fails, one scan ranks the
+// configured networks by RSSI and they are tried strongest first.
+// Retries are scheduled with an esp_timer, never by blocking the event task.
+class WifiStation {
+public:
+    using ConnectCallback = std::function<void()>;
+
+    WifiStation(const WifiCredential* networks, int count);
+
+    // Called from the event task each time an IP is obtained
+    void SetConnectCallback(ConnectCallback cb) { on_connect_ = cb; }
+
+    // Init netif/event loop/WiFi and start connecting (non-blocking)
+    void Start();
+    bool IsConnected() const { return connected_; }
+    const char* ssid() const;
+
+private:
+    struct Candidate {
+        int index;          // Into networks_
+        uint8_t bssid[6];
+        uint8_t channel;    // 0 = unknown (plain SSID connect)
+        int8_t rssi;
+    };
+
+    static void EventHandler(void* arg, esp_event_base_t base, int32_t id, void* data);
+    static void RetryTimer(void* arg);
+
+    void StartScan();
+    void OnScanDone();
+    void ConnectCandidate();
+    void ScheduleRetry(int delay_ms);
+    void OnDisconnected(uint8_t reason);
+    void OnGotIp(const ip_event_got_ip_t* event);
+    bool LoadCache(Candidate* out);
+    void SaveCache();
+
+    const WifiCredential* networks_;
+    int count_;
+    ConnectCallback on_connect_;
+
+    Candidate candidates_[8];
+    int candidate_count_ = 0;
+    int candidate_pos_ = 0;
+    int attempts_ = 0;          // On the current candidate
+    bool from_cache_ = false;   // Current candidate came from NVS
+
+    Candidate connected_ap_ = {};
+    volatile bool connected_ = false;
+    int64_t start_us_ = 0;
+    int64_t scan_start_us_ = 0;
+    int64_t dropout_us_ = 0;    // When the last established link dropped (0 = none)
+    esp_timer_handle_t retry_timer_ = nullptr;
+};
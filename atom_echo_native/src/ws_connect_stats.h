@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+// Connect timing per kind of TLS handshake, from the client's
+// BEFORE_CONNECT to CONNECTED (TCP + TLS + WebSocket upgrade). The device
+// only knows whether it offered its saved session; esp_transport_ssl does
+// not expose the mbedTLS context to check whether the server took it, so
+// the server reports that in its session reply.
+struct WsConnectStats {
+    uint32_t full_count = 0;        // No saved session to offer
+    uint32_t full_ms_total = 0;
+    uint32_t offered_count = 0;     // Offered the saved session, taken or not
+    uint32_t offered_ms_total = 0;
+    uint32_t resumed_count = 0;     // Offers the server confirmed it resumed
+    uint32_t rejected_count = 0;    // Offers the server answered with a full handshake
+    bool awaiting_result = false;   // Current connection's offer not judged yet
+
+    void OnConnected(bool offered, int ms) {
+        if (offered) {
+            offered_count++;
+            offered_ms_total += ms;
+        } else {
+            full_count++;
+            full_ms_total += ms;
+        }
+        awaiting_result = offered;
+    }
+
+    // The server's tls_resumed for the current connection. False if there
+    // is nothing to judge: no offer was made, or it was already counted.
+    bool OnTlsResult(bool resumed) {
+        if (!awaiting_result) return false;
+        awaiting_result = false;
+        if (resumed) resumed_count++;
+        else rejected_count++;
+        return true;
+    }
+};
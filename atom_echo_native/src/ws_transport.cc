@@ -1,16 +1,40 @@
 #include "ws_transport.h"
 #include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <esp_transport_ssl.h>
+#include <esp_transport_ws.h>
+#include <sdkconfig.h>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+#include "trace.h"
+#include "flight_recorder.h"
+
 #define TAG "WsTransport"
 
-WsTransport::WsTransport() {}
+// One transport per device; storage accounted for in WS_STATIC_BYTES
+static uint8_t pending_storage[WS_UPLINK_BUFFER_BYTES];
+static StaticRingbuffer_t pending_buf;
+static StaticSemaphore_t tx_lock_buf;
+
+WsTransport::WsTransport() {
+    snprintf(session_id_, sizeof(session_id_), "%08lx", (unsigned long)esp_random());
+    tx_lock_ = xSemaphoreCreateMutexStatic(&tx_lock_buf);
+    pending_ = xRingbufferCreateStatic(WS_UPLINK_BUFFER_BYTES, RINGBUF_TYPE_NOSPLIT,
+                                       pending_storage, &pending_buf);
+}
 
 WsTransport::~WsTransport() {
     Disconnect();
+    if (wss_) esp_transport_destroy(wss_);
+    if (ssl_) esp_transport_destroy(ssl_);
+    if (pending_) vRingbufferDelete(pending_);
+    if (tx_lock_) vSemaphoreDelete(tx_lock_);
 }
 
-bool WsTransport::Connect(const char* uri) {
+bool WsTransport::Connect(const char* uri, const char* cert_pem) {
     esp_websocket_client_config_t cfg = {};
     cfg.uri = uri;
     cfg.buffer_size = 8192;
@@ -19,6 +43,35 @@ bool WsTransport::Connect(const char* uri) {
     cfg.reconnect_timeout_ms = 5000;     // reconnect after 5s if disconnected
     cfg.pingpong_timeout_sec = 300;      // 5 min ping/pong timeout
 
+    if (strncmp(uri, "wss://", 6) == 0) {
+        if (!cert_pem || !cert_pem[0]) {
+            ESP_LOGE(TAG, "wss:// needs a pinned server certificate");
+            return false;
+        }
+        if (!wss_) {
+            // The client's built-in wss transport can't keep a TLS session,
+            // so hand it an external one with session tickets enabled
+            ssl_ = esp_transport_ssl_init();
+            if (!ssl_) return false;
+            esp_transport_ssl_set_cert_data(ssl_, cert_pem, strlen(cert_pem));
+            // The pinned cert is the only trust anchor, so the server is
+            // authenticated by its key; the name check would tie us to one IP
+            esp_transport_ssl_skip_common_name_check(ssl_);
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+            esp_transport_ssl_session_tickets_enable(ssl_);
+#else
+            ESP_LOGW(TAG, "CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS off: every reconnect is a full handshake");
+#endif
+            wss_ = esp_transport_ws_init(ssl_);
+            if (!wss_) return false;
+            esp_transport_set_default_port(wss_, 443);
+            // An external transport skips the client's URI settings
+            const char* path = strchr(uri + 6, '/');
+            esp_transport_ws_set_path(wss_, path ? path : "/");
+        }
+        cfg.ext_transport = wss_;
+    }
+
     client_ = esp_websocket_client_init(&cfg);
     if (!client_) {
         ESP_LOGE(TAG, "Failed to init WebSocket client");
@@ -49,16 +102,241 @@ bool WsTransport::IsConnected() const {
     return connected_ && client_ && esp_websocket_client_is_connected(client_);
 }
 
-bool WsTransport::SendAudio(const uint8_t* data, size_t len) {
-    if (!IsConnected()) return false;
-    int sent = esp_websocket_client_send_bin(client_, (const char*)data, len, pdMS_TO_TICKS(1000));
+bool WsTransport::SendNow(PendingKind kind, const uint8_t* data, size_t len) {
+    int sent = kind == PENDING_AUDIO
+        ? esp_websocket_client_send_bin(client_, (const char*)data, len, pdMS_TO_TICKS(1000))
+        : esp_websocket_client_send_text(client_, (const char*)data, len, pdMS_TO_TICKS(1000));
+    TRACE(TRACE_WS_TX, len);
     return sent >= 0;
 }
 
+bool WsTransport::Enqueue(PendingKind kind, const uint8_t* data, size_t len) {
+    uint8_t item[1 + WS_MAX_FRAME_BYTES];
+    if (!pending_ || len + 1 > sizeof(item)) return false;
+    item[0] = kind;
+    memcpy(item + 1, data, len);
+    // Full: drop the oldest items until the new one fits
+    while (xRingbufferSend(pending_, item, len + 1, 0) != pdTRUE) {
+        size_t old_len = 0;
+        void* old = xRingbufferReceive(pending_, &old_len, 0);
+        if (!old) return false;
+        vRingbufferReturnItem(pending_, old);
+        pending_count_--;
+        pending_dropped_++;
+        FLIGHT(FLIGHT_DROP_UPLINK, tx_seq_, pending_count_);
+    }
+    pending_count_++;
+    return true;
+}
+
+// Goes straight out only when nothing is buffered ahead of it
+bool WsTransport::SendLocked(PendingKind kind, const uint8_t* data, size_t len) {
+    bool live = session_ready_ && IsConnected() && pending_count_ == 0;
+    return (live && SendNow(kind, data, len)) || Enqueue(kind, data, len);
+}
+
+bool WsTransport::FlushBundleLocked() {
+    if (bundle_frames_ == 0) return true;
+    bool ok = SendLocked(PENDING_AUDIO, bundle_, bundle_len_);
+    bundle_frames_ = 0;
+    bundle_len_ = 0;
+    return ok;
+}
+
+// Frames held for bundling go ahead of anything sent after them
+bool WsTransport::Send(PendingKind kind, const uint8_t* data, size_t len) {
+    xSemaphoreTake(tx_lock_, portMAX_DELAY);
+    bool ok = FlushBundleLocked();
+    ok = SendLocked(kind, data, len) && ok;
+    xSemaphoreGive(tx_lock_);
+    return ok;
+}
+
+static void put_seq(uint8_t* p, uint32_t seq) {
+    p[0] = seq >> 24;
+    p[1] = seq >> 16;
+    p[2] = seq >> 8;
+    p[3] = seq;
+}
+
+bool WsTransport::SendAudio(const uint8_t* data, size_t len, int bundle) {
+    if (!data || len == 0) {
+        xSemaphoreTake(tx_lock_, portMAX_DELAY);
+        bool ok = FlushBundleLocked();
+        xSemaphoreGive(tx_lock_);
+        return ok;
+    }
+    if (len + WS_SEQ_HEADER_BYTES > WS_MAX_FRAME_BYTES) return false;
+    if (len + WS_SEQ_HEADER_BYTES + 2 > WS_MAX_FRAME_BYTES) bundle = 1;
+
+    xSemaphoreTake(tx_lock_, portMAX_DELAY);
+    uint32_t seq = ++tx_seq_;
+    FLIGHT(FLIGHT_UPLINK, seq, uplink_backlog(), data, len);
+    bool ok = true;
+    if (bundle <= 1) {
+        uint8_t frame[WS_MAX_FRAME_BYTES];
+        put_seq(frame, seq);
+        memcpy(frame + WS_SEQ_HEADER_BYTES, data, len);
+        ok = FlushBundleLocked();
+        ok = SendLocked(PENDING_AUDIO, frame, len + WS_SEQ_HEADER_BYTES) && ok;
+    } else {
+        if (bundle_len_ + 2 + len > WS_MAX_FRAME_BYTES) ok = FlushBundleLocked();
+        if (bundle_frames_ == 0) {
+            put_seq(bundle_, seq | WS_SEQ_BUNDLE_FLAG);
+            bundle_len_ = WS_SEQ_HEADER_BYTES;
+        }
+        bundle_[bundle_len_++] = len >> 8;
+        bundle_[bundle_len_++] = len;
+        memcpy(bundle_ + bundle_len_, data, len);
+        bundle_len_ += len;
+        if (++bundle_frames_ >= bundle) ok = FlushBundleLocked() && ok;
+    }
+    xSemaphoreGive(tx_lock_);
+    return ok;
+}
+
 bool WsTransport::SendJson(const char* json, size_t len) {
+    return Send(PENDING_JSON, (const uint8_t*)json, len);
+}
+
+// One item per lock hold so the codec task is never blocked for the whole
+// flush. An item that fails to send stays held as head_ and goes first next time.
+int WsTransport::FlushPending() {
+    int flushed = 0;
+    while (true) {
+        xSemaphoreTake(tx_lock_, portMAX_DELAY);
+        if (!head_ && pending_) head_ = (uint8_t*)xRingbufferReceive(pending_, &head_len_, 0);
+        if (!head_) {
+            xSemaphoreGive(tx_lock_);
+            break;
+        }
+        bool ok = SendNow((PendingKind)head_[0], head_ + 1, head_len_ - 1);
+        if (ok) {
+            vRingbufferReturnItem(pending_, head_);
+            head_ = nullptr;
+            pending_count_--;
+            flushed++;
+        } else {
+            session_ready_ = false;
+        }
+        xSemaphoreGive(tx_lock_);
+        if (!ok) break;
+    }
+    return flushed;
+}
+
+bool WsTransport::Resume(const char* hello, size_t len) {
     if (!IsConnected()) return false;
-    int sent = esp_websocket_client_send_text(client_, json, len, pdMS_TO_TICKS(1000));
-    return sent >= 0;
+    xSemaphoreTake(tx_lock_, portMAX_DELAY);
+    bool ok = SendNow(PENDING_JSON, (const uint8_t*)hello, len);
+    session_ready_ = ok;
+    if (ok) {
+        portENTER_CRITICAL(&clock_lock_);
+        clock_.Restart();
+        portEXIT_CRITICAL(&clock_lock_);
+    }
+    int dropped = pending_dropped_;
+    pending_dropped_ = 0;
+    xSemaphoreGive(tx_lock_);
+    if (!ok) return false;
+
+    int flushed = FlushPending();
+    ESP_LOGI(TAG, "Session %s ready: flushed %d buffered messages (%d dropped while offline)",
+             session_id_, flushed, dropped);
+    return true;
+}
+
+void WsTransport::OnUplinkAck(uint32_t seq) {
+    if ((int32_t)(seq - acked_seq_) > 0) acked_seq_ = seq;
+    acks_seen_ = true;
+}
+
+int WsTransport::uplink_backlog() const {
+    if (!acks_seen_) return pending_count_;
+    int unacked = (int32_t)(tx_seq_ - acked_seq_) - bundle_frames_;  // Held frames aren't queued yet
+    return unacked > WS_UPLINK_ACK_SLACK ? unacked - WS_UPLINK_ACK_SLACK : 0;
+}
+
+// Only sent live: buffered, t1 would be stale by the time it went out. Held
+// frames go first so t1 is stamped right before the request itself.
+bool WsTransport::SyncClock() {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&clock_lock_);
+    bool due = clock_.Due(now);
+    portEXIT_CRITICAL(&clock_lock_);
+    if (!due || !session_ready_ || !IsConnected()) return false;
+
+    xSemaphoreTake(tx_lock_, portMAX_DELAY);
+    bool ok = FlushBundleLocked() && pending_count_ == 0;
+    if (ok) {
+        char req[64];
+        int n = snprintf(req, sizeof(req), "{\"type\":\"time_req\",\"t1\":%lld}",
+                         (long long)esp_timer_get_time());
+        ok = SendNow(PENDING_JSON, (const uint8_t*)req, n);
+    }
+    xSemaphoreGive(tx_lock_);
+    portENTER_CRITICAL(&clock_lock_);
+    clock_.OnRequestSent(now);  // A failed request waits its turn too
+    portEXIT_CRITICAL(&clock_lock_);
+    return ok;
+}
+
+// {"type":"time_resp","t1":..,"t2":..,"t3":..}, parsed by hand
+void WsTransport::OnTimeResponse(const char* json, size_t len, int64_t t4) {
+    char buf[128];
+    size_t n = len < sizeof(buf) - 1 ? len : sizeof(buf) - 1;
+    memcpy(buf, json, n);
+    buf[n] = '\0';
+    int64_t t[3] = {};
+    const char* keys[3] = {"\"t1\":", "\"t2\":", "\"t3\":"};
+    for (int i = 0; i < 3; i++) {
+        const char* v = strstr(buf, keys[i]);
+        if (v) t[i] = strtoll(v + strlen(keys[i]), nullptr, 10);
+    }
+    portENTER_CRITICAL(&clock_lock_);
+    clock_.OnSample(t[0], t[1], t[2], t4);
+    ClockSyncStats stats = clock_.stats();
+    portEXIT_CRITICAL(&clock_lock_);
+    if (stats.samples % CLOCK_SYNC_WINDOW == 0) {
+        ESP_LOGI(TAG, "Clock sync: offset=%lldus rtt=%luus (±%luus) last_rtt=%luus skew=%ldppb samples=%lu rejected=%lu",
+                 (long long)stats.offset_us, (unsigned long)stats.rtt_us, (unsigned long)(stats.rtt_us / 2),
+                 (unsigned long)stats.last_rtt_us, (long)stats.skew_ppb, (unsigned long)stats.samples,
+                 (unsigned long)stats.rejected);
+    }
+}
+
+bool WsTransport::clock_synced() const {
+    portENTER_CRITICAL(&clock_lock_);
+    bool synced = clock_.synced();
+    portEXIT_CRITICAL(&clock_lock_);
+    return synced;
+}
+
+int64_t WsTransport::ToServerUs(int64_t device_us) const {
+    portENTER_CRITICAL(&clock_lock_);
+    int64_t us = clock_.ToServerUs(device_us);
+    portEXIT_CRITICAL(&clock_lock_);
+    return us;
+}
+
+ClockSyncStats WsTransport::clock_stats() const {
+    portENTER_CRITICAL(&clock_lock_);
+    ClockSyncStats stats = clock_.stats();
+    portEXIT_CRITICAL(&clock_lock_);
+    return stats;
+}
+
+const char* WsTransport::tls_mode() const {
+    if (!wss_) return "off";
+    return tls_offering_ ? "offered" : "full";
+}
+
+void WsTransport::NoteTlsResumed(bool resumed) {
+    WsConnectStats& st = connect_stats_;
+    if (!wss_ || !st.OnTlsResult(resumed)) return;  // Nothing offered: a full handshake either way
+    ESP_LOGI(TAG, "TLS session %s by the server (offered %lu: resumed %lu, rejected %lu)",
+             resumed ? "resumed" : "rejected", (unsigned long)st.offered_count,
+             (unsigned long)st.resumed_count, (unsigned long)st.rejected_count);
 }
 
 void WsTransport::EventHandler(void* arg, esp_event_base_t base, int32_t id, void* data) {
@@ -66,26 +344,56 @@ void WsTransport::EventHandler(void* arg, esp_event_base_t base, int32_t id, voi
     auto* event = (esp_websocket_event_data_t*)data;
 
     switch (id) {
-    case WEBSOCKET_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "Connected");
+    case WEBSOCKET_EVENT_BEFORE_CONNECT:
+        self->connect_start_us_ = esp_timer_get_time();
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        self->tls_offering_ = self->wss_ && self->tls_session_saved_;
+#endif
+        break;
+
+    case WEBSOCKET_EVENT_CONNECTED: {
+        int ms = self->connect_start_us_ ? (int)((esp_timer_get_time() - self->connect_start_us_) / 1000) : 0;
+        self->last_connect_ms_ = ms;
+        if (self->wss_) {
+            WsConnectStats& st = self->connect_stats_;
+            st.OnConnected(self->tls_offering_, ms);
+            self->tls_session_saved_ = true;
+            ESP_LOGI(TAG, "Connected: %dms (tls %s) — full %lu avg %lums, offered %lu avg %lums",
+                     ms, self->tls_mode(),
+                     (unsigned long)st.full_count, (unsigned long)(st.full_count ? st.full_ms_total / st.full_count : 0),
+                     (unsigned long)st.offered_count,
+                     (unsigned long)(st.offered_count ? st.offered_ms_total / st.offered_count : 0));
+        } else {
+            ESP_LOGI(TAG, "Connected: %dms", ms);
+        }
+        TraceRegisterTask(TRACE_TASK_WS);  // Event handler runs in the client's task
         self->connected_ = true;
+        if (self->on_connect_) self->on_connect_();
         break;
+    }
 
     case WEBSOCKET_EVENT_DISCONNECTED:
         ESP_LOGW(TAG, "Disconnected");
         self->connected_ = false;
+        self->session_ready_ = false;
         if (self->on_disconnect_) self->on_disconnect_();
         break;
 
     case WEBSOCKET_EVENT_DATA:
-        if (event->op_code == 0x02 && event->data_len > 0) {
-            // Binary = Opus audio
+        if (event->op_code == 0x02 && event->data_len > WS_SEQ_HEADER_BYTES) {
+            // Binary = sequence number + Opus audio
+            auto* p = (const uint8_t*)event->data_ptr;
+            uint32_t seq = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+            self->rx_seq_ = seq;
             if (self->on_audio_) {
-                self->on_audio_((const uint8_t*)event->data_ptr, event->data_len);
+                self->on_audio_(p + WS_SEQ_HEADER_BYTES, event->data_len - WS_SEQ_HEADER_BYTES, seq);
             }
         } else if (event->op_code == 0x01 && event->data_len > 0) {
-            // Text = JSON control
-            if (self->on_json_) {
+            // Text = JSON control; clock replies are timed here, first thing
+            int64_t t4 = esp_timer_get_time();
+            if (event->data_len < 128 && memmem(event->data_ptr, event->data_len, "\"time_resp\"", 11)) {
+                self->OnTimeResponse(event->data_ptr, event->data_len, t4);
+            } else if (self->on_json_) {
                 self->on_json_(event->data_ptr, event->data_len);
             }
         }
@@ -3,12 +3,41 @@
 #include <cstdint>
 #include <cstddef>
 #include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/ringbuf.h>
 #include <esp_websocket_client.h>
+#include <esp_transport.h>
 
+#include "clock_sync.h"
+#include "ws_connect_stats.h"
+
+// Binary frames carry a 4-byte big-endian sequence number before the Opus
+// payload, in both directions. Sequence numbers start at 1 per session.
+#define WS_SEQ_HEADER_BYTES   4
+#define WS_MAX_FRAME_BYTES    (WS_SEQ_HEADER_BYTES + 512)  // Also bounds buffered JSON
+// Uplink may bundle consecutive frames in one message: the first frame's
+// seq with this bit set, then per frame a 2-byte big-endian length + Opus data
+#define WS_SEQ_BUNDLE_FLAG    0x80000000u
+// The server acks uplink every couple of frames; this many unacked frames
+// are just ack cadence and round trip, anything beyond is queued somewhere
+#define WS_UPLINK_ACK_SLACK   3
+// Uplink held while the link is down (~2.5s of 24kbps Opus); oldest dropped first
+#define WS_UPLINK_BUFFER_BYTES 8192
+
+// Statically allocated by WsTransport (see memory_plan.h). The websocket
+// client's own task and buffers are allocated by esp_websocket_client.
+constexpr size_t WS_STATIC_BYTES =
+    WS_UPLINK_BUFFER_BYTES + sizeof(StaticRingbuffer_t) + sizeof(StaticSemaphore_t);
+
+// WebSocket link with a resumable session. The session id lives for one boot;
+// after a reconnect the owner sends hello (with session id and sequence
+// numbers) through Resume(), which then flushes uplink buffered meanwhile.
 class WsTransport {
 public:
-    using AudioCallback = std::function<void(const uint8_t* data, size_t len)>;
+    using AudioCallback = std::function<void(const uint8_t* data, size_t len, uint32_t seq)>;
     using JsonCallback = std::function<void(const char* json, size_t len)>;
+    using ConnectCallback = std::function<void()>;
     using DisconnectCallback = std::function<void()>;
 
     WsTransport();
@@ -16,21 +45,103 @@ public:
 
     void SetAudioCallback(AudioCallback cb) { on_audio_ = cb; }
     void SetJsonCallback(JsonCallback cb) { on_json_ = cb; }
+    void SetConnectCallback(ConnectCallback cb) { on_connect_ = cb; }
     void SetDisconnectCallback(DisconnectCallback cb) { on_disconnect_ = cb; }
 
-    bool Connect(const char* uri);
+    // wss:// requires cert_pem: the server's own (self-signed) certificate,
+    // pinned as the only trust anchor. The TLS session is cached across
+    // reconnects so they resume instead of redoing the full handshake.
+    bool Connect(const char* uri, const char* cert_pem = nullptr);
     void Disconnect();
     bool IsConnected() const;
+    // Connected but hello not sent yet on this connection
+    bool NeedsResume() const { return IsConnected() && !session_ready_; }
+
+    // Send hello, then flush buffered uplink in order
+    bool Resume(const char* hello, size_t len);
 
-    bool SendAudio(const uint8_t* data, size_t len);
+    // Buffered while the session is not ready; false only if dropped.
+    // bundle > 1 holds frames back and sends that many per message; a call
+    // with len 0, or any other message, sends what is held first.
+    bool SendAudio(const uint8_t* data, size_t len, int bundle = 1);
     bool SendJson(const char* json, size_t len);
+    // Server confirmed uplink up to seq (uplink_ack)
+    void OnUplinkAck(uint32_t seq);
+    // Uplink frames queued beyond WS_UPLINK_ACK_SLACK, including those in
+    // the TCP send buffer where a slow send can't show them. Without acks
+    // from the server, only what is buffered offline.
+    int uplink_backlog() const;
+
+    // Clock sync with the server over the control channel: sends
+    // {"type":"time_req","t1":..} when one is due (burst after Resume(),
+    // then periodic) and times the time_resp on arrival. Call often once
+    // the session is ready; false if nothing went out.
+    bool SyncClock();
+    bool clock_synced() const;
+    // esp_timer time (us) as server Unix time (us); 0 until synced
+    int64_t ToServerUs(int64_t device_us) const;
+    ClockSyncStats clock_stats() const;
+
+    const char* session_id() const { return session_id_; }
+    uint32_t rx_seq() const { return rx_seq_; }  // Last downlink frame received
+    uint32_t tx_seq() const { return tx_seq_; }  // Last uplink frame queued
+
+    // "off" (ws://), "full" or "offered" for the current connection
+    const char* tls_mode() const;
+    // Server's word on whether this connection's TLS session was resumed
+    void NoteTlsResumed(bool resumed);
+    int last_connect_ms() const { return last_connect_ms_; }
+    const WsConnectStats& connect_stats() const { return connect_stats_; }
 
 private:
+    enum PendingKind : uint8_t { PENDING_AUDIO, PENDING_JSON };
+
     static void EventHandler(void* arg, esp_event_base_t base, int32_t id, void* data);
 
+    // Caller holds tx_lock_
+    bool SendNow(PendingKind kind, const uint8_t* data, size_t len);
+    bool Enqueue(PendingKind kind, const uint8_t* data, size_t len);
+    bool SendLocked(PendingKind kind, const uint8_t* data, size_t len);
+    bool FlushBundleLocked();
+    bool Send(PendingKind kind, const uint8_t* data, size_t len);
+    int FlushPending();
+    // time_resp received at t4 (esp_timer us)
+    void OnTimeResponse(const char* json, size_t len, int64_t t4);
+
     esp_websocket_client_handle_t client_ = nullptr;
     AudioCallback on_audio_;
     JsonCallback on_json_;
+    ConnectCallback on_connect_;
     DisconnectCallback on_disconnect_;
     bool connected_ = false;
+
+    // wss: websocket-over-ssl transport owned here (not by the client) so
+    // the saved TLS session outlives each connection
+    esp_transport_handle_t ssl_ = nullptr;
+    esp_transport_handle_t wss_ = nullptr;
+    bool tls_session_saved_ = false;  // A handshake has completed at least once
+    bool tls_offering_ = false;       // Current attempt offers the saved session
+    int64_t connect_start_us_ = 0;
+    int last_connect_ms_ = 0;
+    WsConnectStats connect_stats_;
+
+    char session_id_[9] = {};
+    volatile bool session_ready_ = false;
+    volatile uint32_t rx_seq_ = 0;
+    uint32_t tx_seq_ = 0;
+    volatile uint32_t acked_seq_ = 0;
+    volatile bool acks_seen_ = false;
+
+    SemaphoreHandle_t tx_lock_ = nullptr;  // Keeps buffered and live sends in order
+    RingbufHandle_t pending_ = nullptr;    // Kind byte + frame/JSON per item
+    uint8_t* head_ = nullptr;              // Item being flushed, still held
+    size_t head_len_ = 0;
+    int pending_count_ = 0;
+    int pending_dropped_ = 0;              // Since the last Resume()
+    uint8_t bundle_[WS_MAX_FRAME_BYTES];   // Uplink frames held for one message
+    size_t bundle_len_ = 0;
+    int bundle_frames_ = 0;
+
+    ClockSync clock_;                      // Fed on the client task, read anywhere
+    mutable portMUX_TYPE clock_lock_ = portMUX_INITIALIZER_UNLOCKED;
 };
@@ -0,0 +1,172 @@
+"""
+Replay an Atom Echo flight recorder dump on the host.
+
+The server saves the device's flight_meta / flight_dump / flight_end
+messages as one JSON object per line (FLIGHT_DIR). This prints the timeline
+around the trip (packet arrival gaps, queue depths, underruns and drops,
+relative to the trip) and decodes the recorded Opus back into WAV files:
+<dump>-uplink.wav (16kHz mic) and <dump>-downlink.wav (24kHz as played,
+lost frames concealed the way the device's decoder does).
+
+Usage: python tools/flight_replay.py flight-20260101-120000.jsonl [--bucket-ms 250] [--no-audio]
+"""
+
+import argparse
+import base64
+import json
+import struct
+import sys
+import time
+import wave
+
+try:
+    import opuslib
+except ImportError:  # Timeline only
+    opuslib = None
+
+HEADER = struct.Struct("<IBBHI")  # ts_us (low 32 bits), kind, depth, len, arg — matches FlightRecord
+UPLINK_RATE = 16000
+DOWNLINK_RATE = 24000
+FRAME_MS = 60
+
+
+def load(path: str):
+    meta, parts = None, {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            msg = json.loads(line)
+            t = msg.get("type")
+            if t == "flight_meta":
+                meta, parts = msg, {}
+            elif t == "flight_dump":
+                parts[msg["part"]] = base64.b64decode(msg["data"])
+    if meta is None:
+        sys.exit(f"{path}: missing flight_meta")
+    data = b"".join(parts[p] for p in sorted(parts))
+    if len(parts) != meta.get("parts", len(parts)):
+        print(f"warning: {meta['parts'] - len(parts)} dump parts missing, the tail is cut short")
+    return meta, data
+
+
+def parse(meta: dict, data: bytes) -> list[dict]:
+    now = meta["now_us"]
+    now_low = now & 0xFFFFFFFF
+    kinds = meta["kinds"]
+    records, off = [], 0
+    while off + HEADER.size <= len(data):
+        ts, kind, depth, n, arg = HEADER.unpack_from(data, off)
+        payload = data[off + HEADER.size:off + HEADER.size + n]
+        off += HEADER.size + n
+        if len(payload) < n:
+            break  # Cut short by a missing part
+        # Records are older than the dump, so unwrap backwards from now_us
+        full = now - ((now_low - ts) & 0xFFFFFFFF)
+        name = kinds[kind] if kind < len(kinds) else f"kind{kind}"
+        records.append({"t_us": full, "kind": name, "depth": depth, "seq": arg, "opus": payload})
+    return records
+
+
+def timeline(meta: dict, records: list[dict], bucket_ms: int):
+    trip = meta["trip_us"]
+    print(f"Froze on {meta['reason']}; {len(records)} records, "
+          f"{(records[-1]['t_us'] - records[0]['t_us']) / 1000:.0f}ms "
+          f"({(records[0]['t_us'] - trip) / 1000:+.0f} to {(records[-1]['t_us'] - trip) / 1000:+.0f}ms around the trip)")
+    if "now_srv_us" in meta:
+        t = (meta["now_srv_us"] - (meta["now_us"] - trip)) / 1e6
+        print(f"Trip at server time {time.strftime('%H:%M:%S', time.localtime(t))}.{int(t % 1 * 1e6):06d}")
+
+    print("\nEvents:")
+    for r in records:
+        if r["kind"] not in ("uplink", "downlink"):
+            print(f"  {(r['t_us'] - trip) / 1000:+8.1f}ms  {r['kind']:<14} seq={r['seq']} depth={r['depth']}")
+
+    print(f"\nPer {bucket_ms}ms (ms relative to the trip):")
+    print(f"  {'t_ms':>7} {'up':>3} {'up_q':>4} {'down':>4} {'lost':>4} {'down_q':>6} {'gap_max':>7} events")
+    start = records[0]["t_us"]
+    last_down = None
+    bucket: dict = {}
+
+    def flush(b0):
+        if not bucket:
+            return
+        print(f"  {(b0 - trip) / 1000:+7.0f} {bucket.get('up', 0):3d} {bucket.get('up_q', 0):4d} "
+              f"{bucket.get('down', 0):4d} {bucket.get('lost', 0):4d} {bucket.get('down_q', 0):6d} "
+              f"{bucket.get('gap', 0) / 1000:7.0f} {' '.join(bucket.get('events', []))}")
+
+    b0 = start
+    for r in records:
+        while r["t_us"] >= b0 + bucket_ms * 1000:
+            flush(b0)
+            bucket = {}
+            b0 += bucket_ms * 1000
+        if r["kind"] == "uplink":
+            bucket["up"] = bucket.get("up", 0) + 1
+            bucket["up_q"] = max(bucket.get("up_q", 0), r["depth"])
+        elif r["kind"] == "downlink":
+            bucket["down"] = bucket.get("down", 0) + 1
+            if not r["opus"]:
+                bucket["lost"] = bucket.get("lost", 0) + 1
+            bucket["down_q"] = max(bucket.get("down_q", 0), r["depth"])
+            if last_down is not None:
+                bucket["gap"] = max(bucket.get("gap", 0), r["t_us"] - last_down)
+            last_down = r["t_us"]
+        else:
+            bucket.setdefault("events", []).append(r["kind"])
+    flush(b0)
+
+
+def decode(records: list[dict], kind: str, rate: int, path: str):
+    frame = rate * FRAME_MS // 1000
+    dec = opuslib.Decoder(rate, 1)
+    pcm, prev, frames, concealed = bytearray(), None, 0, 0
+    for r in records:
+        if r["kind"] != kind:
+            continue
+        if prev is not None and 1 < r["seq"] - prev <= 3:
+            for _ in range(r["seq"] - prev - 1):  # Missing from the recording: conceal like the device
+                pcm += dec.decode(b"", frame)
+                concealed += 1
+        prev = r["seq"] or prev
+        try:
+            pcm += dec.decode(r["opus"], frame)  # Empty: lost in transport, concealed
+        except opuslib.OpusError as e:
+            print(f"{kind} seq {r['seq']}: {e}")
+            continue
+        frames += 1
+        concealed += 0 if r["opus"] else 1
+    if not frames:
+        return
+    with wave.open(path, "wb") as w:
+        w.setnchannels(1)
+        w.setsampwidth(2)
+        w.setframerate(rate)
+        w.writeframes(bytes(pcm))
+    print(f"{path}: {frames} frames ({concealed} concealed), {len(pcm) / 2 / rate:.2f}s")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("dump", help="JSONL file saved by voice_assistant.py")
+    ap.add_argument("--bucket-ms", type=int, default=250, help="timeline resolution")
+    ap.add_argument("--no-audio", action="store_true", help="skip decoding to WAV")
+    args = ap.parse_args()
+
+    meta, data = load(args.dump)
+    records = parse(meta, data)
+    if not records:
+        sys.exit(f"{args.dump}: no records")
+    timeline(meta, records, args.bucket_ms)
+    if not args.no_audio:
+        print()
+        if opuslib is None:
+            sys.exit("opuslib not installed: no audio written (--no-audio for the timeline only)")
+        base = args.dump.rsplit(".", 1)[0]
+        decode(records, "uplink", UPLINK_RATE, f"{base}-uplink.wav")
+        decode(records, "downlink", DOWNLINK_RATE, f"{base}-downlink.wav")
+
+
+if __name__ == "__main__":
+    main()
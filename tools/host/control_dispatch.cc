@@ -0,0 +1,100 @@
+// ControlType/ControlField on server control messages as the server really
+// writes them. voice_assistant.py's send_json and aiohttp's ws.send_json
+// both use json.dumps defaults, i.e. {"type": "bench", "iterations": 20}
+// with a space after ':' and ','; the payloads below are copied from
+// json.dumps output. Compact JSON, key order, nesting and look-alike text
+// inside string values are covered too. The session reply is also run
+// through WsConnectStats the way handle_session and NoteTlsResumed do, so
+// the TLS resumed/rejected counters move on the real reply.
+
+#include "control_message.h"
+#include "ws_connect_stats.h"
+
+#include <cstdio>
+#include <cstring>
+
+static bool ok = true;
+
+static void expect_type(const char* json, const char* want) {
+    char type[24];
+    const char* got = ControlType(json, strlen(json), type, sizeof(type));
+    bool pass = strcmp(got, want) == 0;
+    printf("%-4s type=%-14s %s\n", pass ? "ok" : "FAIL", got, json);
+    ok &= pass;
+}
+
+static void expect_field(const char* json, const char* key, const char* want) {
+    char value[32];
+    bool found = ControlField(json, strlen(json), key, value, sizeof(value));
+    bool pass = want ? found && strcmp(value, want) == 0 : !found;
+    printf("%-4s %s=%-9s %s\n", pass ? "ok" : "FAIL", key, found ? value : "(none)", json);
+    ok &= pass;
+}
+
+// handle_session -> NoteTlsResumed on one connection's reply
+static void session_reply(WsConnectStats& st, const char* json) {
+    char type[24], tls[8];
+    if (strcmp(ControlType(json, strlen(json), type, sizeof(type)), "session") != 0) return;
+    if (ControlField(json, strlen(json), "tls_resumed", tls, sizeof(tls))) st.OnTlsResult(strcmp(tls, "true") == 0);
+}
+
+static void expect_tls(const WsConnectStats& st, uint32_t resumed, uint32_t rejected, const char* what) {
+    bool pass = st.resumed_count == resumed && st.rejected_count == rejected;
+    printf("%-4s resumed=%lu rejected=%lu after %s\n", pass ? "ok" : "FAIL",
+           (unsigned long)st.resumed_count, (unsigned long)st.rejected_count, what);
+    ok &= pass;
+}
+
+int main() {
+    // json.dumps({"type": "bench", "iterations": 20})
+    expect_type("{\"type\": \"bench\", \"iterations\": 20}", "bench");
+    expect_field("{\"type\": \"bench\", \"iterations\": 20}", "iterations", "20");
+    // voice_assistant.py: trace start on hello, dump after each reply
+    expect_type("{\"type\": \"trace\", \"action\": \"start\"}", "trace");
+    expect_field("{\"type\": \"trace\", \"action\": \"dump\"}", "action", "dump");
+    // Flight recorder: armed on hello (optional trip thresholds), dumped on demand
+    expect_type("{\"type\": \"flight\", \"action\": \"arm\"}", "flight");
+    expect_field("{\"type\": \"flight\", \"action\": \"arm\", \"underruns\": 2, \"drops\": 3}", "drops", "3");
+    expect_field("{\"type\": \"flight\", \"action\": \"dump\"}", "action", "dump");
+    // voice_assistant.py after hello with CODEC_STRESS set
+    expect_type("{\"type\": \"codec_stress\", \"ms\": 5000}", "codec_stress");
+    expect_field("{\"type\": \"codec_stress\", \"ms\": 5000}", "ms", "5000");
+    // Session reply over wss: json.dumps of voice_assistant.py's reply dict
+    const char* taken = "{\"type\": \"session\", \"session\": \"1a2b3c4d\", \"resumed\": true, "
+                        "\"rx_seq\": 120, \"tls_resumed\": true}";
+    const char* refused = "{\"type\": \"session\", \"session\": \"1a2b3c4d\", \"resumed\": true, "
+                          "\"rx_seq\": 120, \"tls_resumed\": false}";
+    expect_type(taken, "session");
+    expect_field(taken, "tls_resumed", "true");
+    expect_field(refused, "tls_resumed", "false");
+    expect_field("{\"type\": \"session\", \"session\": \"1a2b3c4d\", \"resumed\": false, \"rx_seq\": 0}",
+                 "tls_resumed", nullptr);  // Plain ws://
+    WsConnectStats st;
+    st.OnConnected(false, 900);  // First connect: nothing saved to offer
+    session_reply(st, refused);
+    expect_tls(st, 0, 0, "full handshake");
+    st.OnConnected(true, 300);
+    session_reply(st, taken);
+    expect_tls(st, 1, 0, "offer taken");
+    session_reply(st, taken);  // A repeated reply on the same connection counts once
+    expect_tls(st, 1, 0, "repeated reply");
+    st.OnConnected(true, 800);
+    session_reply(st, refused);
+    expect_tls(st, 1, 1, "offer refused");
+    // Compact, as the firmware itself writes
+    expect_type("{\"type\":\"bench\",\"iterations\":20}", "bench");
+    // Key order and whitespace don't matter
+    expect_type("{\n  \"iterations\": 20,\n  \"type\": \"bench\"\n}", "bench");
+    // Only the top-level "type" counts, and text inside values is not a key
+    expect_type("{\"args\": {\"type\": \"bench\"}, \"type\": \"stt\"}", "stt");
+    expect_type("{\"text\": \"\\\"type\\\": \\\"bench\\\"\", \"type\": \"stt\"}", "stt");
+    expect_type("{\"list\": [{\"type\": \"bench\"}], \"text\": \"x\"}", "");
+    // Too long for the buffer, or not a scalar: no match rather than a prefix
+    expect_type("{\"type\": \"a_type_name_longer_than_the_buffer\"}", "");
+    expect_field("{\"type\": \"bench\", \"opts\": {\"n\": 1}}", "opts", nullptr);
+    expect_type("", "");
+    expect_type("{\"type\": \"bench\"", "bench");  // Cut short after the value: still read
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
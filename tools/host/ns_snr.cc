@@ -0,0 +1,119 @@
+// NoiseSuppressor SNR check on a synthetic noisy signal.
+//
+// Clean "speech" is a harmonic tone with a gliding pitch and a syllable-rate
+// envelope, on for one second and off for the next; white Gaussian noise is
+// added at a given input SNR. The suppressor runs the way InputTask runs it
+// (24kHz, 10ms hops) and the output is compared with the clean signal,
+// shifted by the one-hop delay. The first two seconds seed the noise
+// estimate and are not scored.
+//
+// Reported per input SNR: SNR in/out over the speech seconds, and the noise
+// left in the pauses. Fails if the speech SNR gains less than MIN_GAIN_DB at
+// 5dB input, or if a 0dB floor (no attenuation) is not a clean passthrough.
+
+#include "noise_suppressor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#define RATE         24000
+#define HOP          240
+#define SECONDS      8
+#define SCORE_FROM   (2 * RATE)
+#define MIN_GAIN_DB  6.0
+
+static std::vector<int16_t> clean_signal() {
+    std::vector<int16_t> x(SECONDS * RATE);
+    double phase = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        bool voiced = (i / RATE) % 2;
+        double t = (double)i / RATE;
+        double env = voiced ? fabs(sin(2 * M_PI * 3 * t)) : 0;   // ~6 syllables/s
+        double f0 = 140 + 30 * sin(2 * M_PI * 0.7 * t);         // Pitch glide
+        phase += 2 * M_PI * f0 / RATE;
+        double s = sin(phase) + 0.6 * sin(2 * phase) + 0.4 * sin(3 * phase) + 0.2 * sin(5 * phase);
+        x[i] = (int16_t)(env * 7000 * s);
+    }
+    return x;
+}
+
+static double power(const std::vector<double>& v) {
+    double p = 0;
+    for (double e : v) p += e * e;
+    return p;
+}
+
+static std::vector<int16_t> run(const std::vector<int16_t>& in, const NsConfig& cfg) {
+    static NoiseSuppressor ns;  // ~10KB of state
+    ns.SetConfig(cfg);
+    ns.Init(RATE, HOP);
+    std::vector<int16_t> y = in;
+    for (size_t o = 0; o + HOP <= y.size(); o += HOP) ns.Process(&y[o], HOP);
+    return y;
+}
+
+// Speech SNR of out (delay samples late) against clean, and the level left in the pauses
+static void score(const std::vector<int16_t>& clean, const std::vector<int16_t>& out, int delay,
+                  double* speech_snr, double* pause_db) {
+    std::vector<double> sig, err_voiced, err_pause;
+    for (size_t i = SCORE_FROM; i + delay < out.size(); i++) {
+        double e = out[i + delay] - clean[i];
+        if ((i / RATE) % 2) {
+            sig.push_back(clean[i]);
+            err_voiced.push_back(e);
+        } else {
+            err_pause.push_back(out[i + delay]);
+        }
+    }
+    *speech_snr = 10 * log10(power(sig) / power(err_voiced));
+    *pause_db = 10 * log10(power(err_pause) / err_pause.size() / (32768.0 * 32768.0));
+}
+
+int main() {
+    bool ok = true;
+    std::vector<int16_t> clean = clean_signal();
+
+    // No attenuation allowed: output is the input one hop late
+    NsConfig pass;
+    pass.max_attenuation_db = 0;
+    std::vector<int16_t> y = run(clean, pass);
+    double err = 0;
+    for (size_t i = 0; i + HOP < clean.size(); i++) err += pow(y[i + HOP] - clean[i], 2);
+    double err_rms = sqrt(err / clean.size());
+    printf("passthrough: rms error %.2f LSB\n", err_rms);
+    if (err_rms > 4) ok = false;
+
+    double clean_p = 0;
+    size_t voiced = 0;
+    for (size_t i = 0; i < clean.size(); i++) {
+        if ((i / RATE) % 2) {
+            clean_p += (double)clean[i] * clean[i];
+            voiced++;
+        }
+    }
+    clean_p /= voiced;
+
+    printf("%8s %9s %10s %8s %12s %12s\n", "snr_in", "speech_in", "speech_out", "gain", "pause_in", "pause_out");
+    for (int snr_db : {0, 5, 10, 20}) {
+        std::mt19937 rng(snr_db + 1);
+        std::normal_distribution<double> noise(0, sqrt(clean_p / pow(10, snr_db / 10.0)));
+        std::vector<int16_t> noisy(clean.size());
+        for (size_t i = 0; i < clean.size(); i++) {
+            noisy[i] = (int16_t)std::max(-32768.0, std::min(32767.0, clean[i] + noise(rng)));
+        }
+        y = run(noisy, NsConfig());
+
+        double snr_in, snr_out, pause_in, pause_out;
+        score(clean, noisy, 0, &snr_in, &pause_in);
+        score(clean, y, HOP, &snr_out, &pause_out);
+        printf("%6ddB %7.1fdB %8.1fdB %+6.1fdB %8.1fdBFS %8.1fdBFS\n",
+               snr_db, snr_in, snr_out, snr_out - snr_in, pause_in, pause_out);
+        if (snr_db == 5 && snr_out - snr_in < MIN_GAIN_DB) ok = false;
+    }
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+// TimeStretch checks: output-length ratio and the playback fill controller.
+//
+// Ratio: a synthetic voiced signal goes through at a fixed rate in 60ms
+// blocks, the way PlayDecoded feeds it. Output/input must be 1/(1 + rate)
+// within RATIO_TOL at -4%, 0 and +4%.
+//
+// Fill: a live stream (one 60ms frame per sender frame time, no credit
+// pacing) arrives in order over a jittery link: a random per-frame delay
+// plus an occasional stall that releases its backlog as a burst. The sender
+// clock runs DRIFT_PCT off the speaker's, so without a controller the queue
+// either grows without bound or keeps running dry. The device side mirrors
+// OutputTask: the next frame is dequeued once the DMA has room, the fill it
+// sees is what is left queued, and the rate is (fill - target) * gain as in
+// PlayDecoded. Scored after a warm-up: the fill seen per frame (mean, share
+// within ±1 frame of the target, max) and underruns (speaker starved). Plain
+// playback runs on the same trace for comparison. Fails if, with
+// time-stretch, the mean fill strays more than one frame from the target, a
+// frame is dropped, or it underruns more often than there were stalls: a
+// stall longer than the target buffer may starve the speaker, ordinary
+// jitter may not.
+
+#include "time_stretch.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <vector>
+
+#define RATE           24000
+#define FRAME          1440                 // 60ms at 24kHz
+#define CHUNK          (2 * TSM_OVERLAP_MAX)  // AUDIO_TSM_CHUNK_SAMPLES
+#define RATIO_TOL      0.005
+#define GAIN_PCT       2                    // PLAYBACK_TSM_GAIN_PCT
+#define TARGET         2                    // "balanced" playback_target_depth
+#define DMA_SAMPLES    (6 * 240)            // "balanced" I2S DMA, desc x frame
+#define QUEUE_MAX      (30 + 20)            // decode + playback queue depth
+#define SIM_SECONDS    300
+#define WARMUP_SECONDS 20
+#define JITTER_MS      15                   // Mean of the exponential per-frame delay
+#define STALL_EVERY_S  20                   // Mean time between stalls
+#define STALL_MS       250
+#define DRIFT_PCT      1.0
+
+static int16_t voiced(long i) {
+    double t = (double)i / RATE;
+    double env = 0.3 + 0.7 * fabs(sin(2 * M_PI * 3 * t));
+    // Pitch gliding 140±30Hz; phase integrated in closed form so any frame can be generated
+    double phase = 2 * M_PI * (140 * t - 30 / (2 * M_PI * 0.7) * cos(2 * M_PI * 0.7 * t));
+    double s = sin(phase) + 0.6 * sin(2 * phase) + 0.4 * sin(3 * phase) + 0.2 * sin(5 * phase);
+    return (int16_t)(env * 7000 * s);
+}
+
+static void frame_at(long index, int16_t* pcm) {
+    for (int i = 0; i < FRAME; i++) pcm[i] = voiced(index * FRAME + i);
+}
+
+static bool check_ratio(int pct) {
+    static TimeStretch ts;  // ~8KB of buffer
+    ts.Init(RATE);
+    ts.ResetStats();
+    ts.SetRatePct(pct);
+    int16_t in[FRAME], out[CHUNK];
+    for (long f = 0; f < 10 * RATE / FRAME; f++) {
+        frame_at(f, in);
+        int n = ts.Process(in, FRAME, out, CHUNK);
+        while (n > 0) n = ts.Process(nullptr, 0, out, CHUNK);
+    }
+    const TsmStats& st = ts.stats();
+    double ratio = (double)st.samples_out / st.samples_in;
+    double want = 1.0 / (1.0 + pct / 100.0);
+    bool ok = fabs(ratio - want) <= RATIO_TOL;
+    printf("rate %+d%%: in=%u out=%u ratio %.4f (want %.4f) seeks=%u %s\n",
+           pct, st.samples_in, st.samples_out, ratio, want, st.seeks, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// Arrival times in speaker-clock ms, in order (TCP), for SIM_SECONDS of stream
+static std::vector<double> arrival_trace(double drift_pct, unsigned seed, int* stalls) {
+    std::mt19937 rng(seed);
+    std::exponential_distribution<double> jitter(1.0 / JITTER_MS);
+    std::exponential_distribution<double> stall_gap(1.0 / (STALL_EVERY_S * 1000.0));
+    const double frame_ms = 60.0 / (1.0 + drift_pct / 100.0);
+    std::vector<double> at;
+    double next_stall = stall_gap(rng), last = 0;
+    *stalls = 0;
+    for (double sent = 0; sent < SIM_SECONDS * 1000.0; sent += frame_ms) {
+        double t = sent + jitter(rng);
+        if (sent >= next_stall) {
+            t = next_stall + STALL_MS + jitter(rng);  // Everything sent during the stall lands together after it
+            if (sent >= next_stall + STALL_MS) {
+                next_stall = sent + stall_gap(rng);
+                if (sent >= WARMUP_SECONDS * 1000.0) (*stalls)++;
+            }
+        }
+        last = t > last ? t : last;
+        at.push_back(last);
+    }
+    return at;
+}
+
+struct FillResult {
+    double mean_fill = 0;
+    double near_target = 0;  // Share of frames seeing |fill - target| <= 1
+    int underruns = 0;
+    int dropped = 0;         // Queue full on arrival
+    int max_fill = 0;
+};
+
+static FillResult simulate(const std::vector<double>& at, bool tsm) {
+    static TimeStretch ts;
+    ts.Init(RATE);
+    std::deque<long> queue;  // Frame indices waiting (decode + playback queues)
+    int16_t in[FRAME], out[CHUNK];
+    long dma = 0;            // Samples written and not yet played
+    size_t next = 0;
+    bool starved = true, started = false;
+    FillResult r;
+    long dequeues = 0, fill_sum = 0, near = 0;
+
+    for (long ms = 0; ms < SIM_SECONDS * 1000L; ms++) {
+        while (next < at.size() && at[next] <= ms) {
+            if ((int)queue.size() < QUEUE_MAX) queue.push_back((long)next);
+            else if (ms >= WARMUP_SECONDS * 1000L) r.dropped++;
+            next++;
+        }
+        // OutputTask: blocked in the codec write until the DMA has room
+        while (dma < DMA_SAMPLES && !queue.empty()) {
+            long f = queue.front();
+            queue.pop_front();
+            frame_at(f, in);
+            const bool scored = ms >= WARMUP_SECONDS * 1000L;
+            if (starved && started && scored) r.underruns++;
+            if (scored) {
+                // Fill as PlayDecoded sees it: what is left after this dequeue
+                int fill = (int)queue.size();
+                dequeues++;
+                fill_sum += fill;
+                if (abs(fill - TARGET) <= 1) near++;
+                if (fill > r.max_fill) r.max_fill = fill;
+            }
+            starved = false;
+            started = true;
+            if (!tsm) {
+                dma += FRAME;
+                continue;
+            }
+            ts.SetRatePct(((int)queue.size() - TARGET) * GAIN_PCT);
+            int n = ts.Process(in, FRAME, out, CHUNK);
+            while (n > 0) {
+                dma += n;
+                n = ts.Process(nullptr, 0, out, CHUNK);
+            }
+        }
+        // Speaker: 24 samples per ms
+        dma -= RATE / 1000;
+        if (dma <= 0) {
+            dma = 0;
+            if (queue.empty()) {
+                if (!starved && tsm) {
+                    while (int n = ts.Flush(out, CHUNK)) dma += n;
+                }
+                starved = dma == 0;
+            }
+        }
+    }
+    r.mean_fill = (double)fill_sum / dequeues;
+    r.near_target = (double)near / dequeues;
+    return r;
+}
+
+int main() {
+    bool ok = true;
+    for (int pct : {-TSM_MAX_RATE_PCT, 0, TSM_MAX_RATE_PCT}) ok &= check_ratio(pct);
+
+    printf("\nfill: target %d frames, jitter ~%dms, %dms stall every ~%ds, %ds scored\n",
+           TARGET, JITTER_MS, STALL_MS, STALL_EVERY_S, SIM_SECONDS - WARMUP_SECONDS);
+    printf("%7s %5s %9s %11s %9s %8s %8s %6s\n", "drift", "tsm", "mean_fill", "near_target", "max_fill",
+           "underrun", "dropped", "stalls");
+    for (double drift : {DRIFT_PCT, 0.0, -DRIFT_PCT}) {
+        int stalls;
+        std::vector<double> at = arrival_trace(drift, 7, &stalls);
+        FillResult plain = simulate(at, false);
+        FillResult tsm = simulate(at, true);
+        for (const FillResult* r : {&plain, &tsm}) {
+            printf("%+6.1f%% %5s %9.2f %10.0f%% %9d %8d %8d %6d\n", drift, r == &tsm ? "on" : "off",
+                   r->mean_fill, r->near_target * 100, r->max_fill, r->underruns, r->dropped, stalls);
+        }
+        if (fabs(tsm.mean_fill - TARGET) > 1.0 || tsm.dropped > 0 || tsm.underruns > stalls) ok = false;
+    }
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
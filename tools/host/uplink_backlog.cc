@@ -0,0 +1,238 @@
+// UplinkRateController on a throttled uplink, simulated in 1ms steps.
+//
+// The device side mirrors AudioService: a frame is captured every 60ms into
+// the encode queue (ENCODE_DEPTH, "balanced"; a full queue drops the frame),
+// CodecTask takes frames in order, bundles them as the controller says and
+// sends each message synchronously, timing how long the send blocked. The
+// send blocks while the TCP send buffer (lwIP's ~5.7KB) has no room, so a
+// slow link only shows up as blocking once seconds of audio are queued in
+// it. The link drains that buffer at the scheduled rate, charging
+// MSG_OVERHEAD per message; the server acks every ACK_EVERY frames, and
+// unacked frames beyond ACK_SLACK count as backlog, as in
+// WsTransport::uplink_backlog().
+//
+// Run three ways on the same link schedule: fixed 24kbps single frames (no
+// controller), the controller fed only send blocking and the encode queue,
+// and the controller with acks. Reported per link phase: the bitrate and
+// bundle at the end of it, max frames queued (encode queue + unacked),
+// dropped frames and capture-to-receive latency. Fails unless, with acks,
+// nothing is dropped, mean latency stays under MAX_MEAN_LAT_MS in every
+// phase, the good link stays at the ceiling from the start and is back there
+// by the end; and unless fixed rate does drop frames (the schedule must
+// actually be too slow for it). The RSSI cap and its hysteresis are checked
+// on their own.
+
+#include "uplink_rate.h"
+
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+#define FRAME_MS        60
+#define ENCODE_DEPTH    4                      // "balanced" encode_queue_depth
+#define SNDBUF          5744                   // lwIP TCP_SND_BUF (4 * MSS)
+#define MSG_OVERHEAD    (6 + 4 + 40 + 36)      // WS client header, seq, TCP/IP, 802.11 MAC/LLC
+#define BUNDLE_LEN_B    2                      // Per-frame length prefix in a bundled message
+#define ACK_EVERY       2                      // voice_assistant.py UPLINK_ACK_EVERY
+#define ACK_SLACK       3                      // WS_UPLINK_ACK_SLACK
+#define PROP_MS         10                     // One way
+#define MAX_MEAN_LAT_MS 500
+
+struct Phase {
+    double kbps;
+    int seconds;
+};
+
+static const Phase kSchedule[] = {{64, 5}, {20, 10}, {13, 10}, {64, 10}};
+static const int kPhases = sizeof(kSchedule) / sizeof(kSchedule[0]);
+
+enum Mode { FIXED, SEND_ONLY, ADAPTIVE };
+static const char* const kModeNames[] = {"fixed", "send-only", "adaptive"};
+
+struct PhaseResult {
+    int bps = 0;
+    int bundle = 0;
+    int queued_max = 0;
+    int dropped = 0;
+    long lat_sum = 0;
+    int lat_n = 0;
+    int lat_max = 0;
+    uint32_t steps_down = 0;
+    double lat_mean() const { return lat_n ? (double)lat_sum / lat_n : 0; }
+};
+
+struct Message {
+    std::vector<long> captured;  // Capture time per frame, ms
+    int bytes;                   // Left to cross the link, overhead included
+};
+
+static int phase_at(long ms) {
+    long end = 0;
+    for (int p = 0; p < kPhases; p++) {
+        end += kSchedule[p].seconds * 1000L;
+        if (ms < end) return p;
+    }
+    return kPhases - 1;
+}
+
+static std::vector<PhaseResult> simulate(Mode mode) {
+    UplinkRateController ctrl;
+    ctrl.Init(FRAME_MS * 1000, UPLINK_DEFAULT_MIN_BPS, UPLINK_DEFAULT_MAX_BPS);
+    const int fixed_bps = ctrl.bitrate();
+    auto bitrate = [&] { return mode == FIXED ? fixed_bps : ctrl.bitrate(); };
+    auto bundle = [&] { return mode == FIXED ? 1 : ctrl.bundle(); };
+
+    std::vector<PhaseResult> res(kPhases);
+    std::deque<long> encode_q;          // Capture times
+    std::deque<Message> link;           // In the send buffer, head on the wire
+    std::deque<std::pair<long, long>> acks;  // (arrives at, acked seq)
+    int sndbuf = 0;
+    double wire_credit = 0;             // Bytes the link may still move this ms
+    long tx_seq = 0, rx_seq = 0, acked_sent = 0, acked = 0;
+    Message pending{{}, 0};             // Bundle being filled
+    bool blocked = false;
+    long block_start = 0;
+
+    long total_ms = 0;
+    for (const Phase& p : kSchedule) total_ms += p.seconds * 1000L;
+    for (long ms = 0; ms < total_ms + 3000; ms++) {
+        const int phase = phase_at(ms);
+        PhaseResult& r = res[phase];
+
+        // InputTask: one frame per period while the schedule runs
+        if (ms < total_ms && ms % FRAME_MS == 0) {
+            if ((int)encode_q.size() < ENCODE_DEPTH) encode_q.push_back(ms);
+            else r.dropped++;
+        }
+
+        // Link: drain the send buffer at the phase's rate
+        wire_credit += kSchedule[phase].kbps * 1000 / 8 / 1000;
+        while (!link.empty() && wire_credit >= 1) {
+            Message& m = link.front();
+            int n = m.bytes < (int)wire_credit ? m.bytes : (int)wire_credit;
+            m.bytes -= n;
+            wire_credit -= n;
+            if (m.bytes > 0) break;
+            long arrive = ms + PROP_MS;
+            for (long c : m.captured) {
+                PhaseResult& cr = res[phase_at(c)];
+                int lat = (int)(arrive - c);
+                cr.lat_sum += lat;
+                cr.lat_n++;
+                if (lat > cr.lat_max) cr.lat_max = lat;
+            }
+            rx_seq += (long)m.captured.size();
+            if (rx_seq - acked_sent >= ACK_EVERY) {
+                acked_sent = rx_seq;
+                acks.emplace_back(arrive + PROP_MS, rx_seq);
+            }
+            link.pop_front();
+        }
+        if (link.empty()) wire_credit = 0;  // An idle link banks nothing
+        // Send buffer room frees as bytes cross; headers are counted in it too
+        sndbuf = 0;
+        for (const Message& m : link) sndbuf += m.bytes;
+        while (!acks.empty() && acks.front().first <= ms) {
+            acked = acks.front().second;
+            acks.pop_front();
+        }
+
+        // CodecTask
+        auto on_frame = [&](uint32_t send_us) {
+            int unacked = (int)(tx_seq - (long)pending.captured.size() - acked);
+            int backlog = (int)encode_q.size();
+            if (mode == ADAPTIVE && unacked > ACK_SLACK) backlog += unacked - ACK_SLACK;
+            if (mode != FIXED) ctrl.OnFrame(send_us, backlog);
+            int queued = (int)encode_q.size() + (unacked > 0 ? unacked : 0);
+            if (queued > r.queued_max) r.queued_max = queued;
+        };
+        for (;;) {
+            if (blocked) {
+                if (sndbuf + pending.bytes > SNDBUF) break;
+                sndbuf += pending.bytes;
+                link.push_back(pending);
+                pending = Message{{}, 0};
+                blocked = false;
+                on_frame((uint32_t)(ms - block_start) * 1000);
+                continue;
+            }
+            if (encode_q.empty()) break;
+            long captured = encode_q.front();
+            encode_q.pop_front();
+            int n = bundle();
+            if (pending.captured.empty()) pending.bytes = MSG_OVERHEAD;
+            pending.captured.push_back(captured);
+            pending.bytes += bitrate() * FRAME_MS / 8000 + (n > 1 ? BUNDLE_LEN_B : 0);
+            tx_seq++;
+            if ((int)pending.captured.size() < n) {
+                on_frame(0);  // Held for the bundle: no send this frame
+                continue;
+            }
+            blocked = true;
+            block_start = ms;
+        }
+        if (ms < total_ms) {
+            r.bps = bitrate();
+            r.bundle = bundle();
+            r.steps_down = ctrl.stats().steps_down;
+        }
+    }
+    for (int p = kPhases - 1; p > 0; p--) res[p].steps_down -= res[p - 1].steps_down;
+    return res;
+}
+
+static bool check_rssi_cap() {
+    UplinkRateController ctrl;
+    ctrl.Init(FRAME_MS * 1000, UPLINK_DEFAULT_MIN_BPS, UPLINK_DEFAULT_MAX_BPS);
+    ctrl.SetRssi(UPLINK_RSSI_WEAK_DBM - 5);
+    ctrl.OnFrame(0, 0);
+    bool capped = ctrl.bitrate() <= UPLINK_WEAK_MAX_BPS;
+    ctrl.SetRssi(UPLINK_RSSI_WEAK_DBM + UPLINK_RSSI_HYST_DB - 1);  // Inside the hysteresis
+    for (int i = 0; i < 2 * UPLINK_UP_CLEAR_FRAMES; i++) ctrl.OnFrame(0, 0);
+    bool held = ctrl.bitrate() <= UPLINK_WEAK_MAX_BPS;
+    ctrl.SetRssi(UPLINK_RSSI_WEAK_DBM + UPLINK_RSSI_HYST_DB + 1);
+    for (int i = 0; i < 10 * UPLINK_UP_CLEAR_FRAMES; i++) ctrl.OnFrame(0, 0);
+    bool lifted = ctrl.bitrate() == UPLINK_DEFAULT_MAX_BPS;
+    bool ok = capped && held && lifted;
+    printf("%-4s rssi cap: weak -> %s, inside hysteresis -> %s, strong again -> %s\n", ok ? "ok" : "FAIL",
+           capped ? "capped" : "NOT capped", held ? "held" : "lifted early", lifted ? "back to max" : "stuck");
+    return ok;
+}
+
+int main() {
+    printf("frames every %dms, %dB overhead per message, send buffer %dB, encode queue %d\n", FRAME_MS,
+           MSG_OVERHEAD, SNDBUF, ENCODE_DEPTH);
+    std::vector<PhaseResult> runs[3];
+    for (int m = FIXED; m <= ADAPTIVE; m++) {
+        runs[m] = simulate((Mode)m);
+        printf("\n%s\n  %-16s %6s %6s %6s %7s %7s %7s\n", kModeNames[m], "link", "bps", "bundle", "queued",
+               "dropped", "lat_ms", "lat_max");
+        int start = 0;
+        for (int p = 0; p < kPhases; p++) {
+            const PhaseResult& r = runs[m][p];
+            char link[32];
+            snprintf(link, sizeof(link), "%gkbps %d-%ds", kSchedule[p].kbps, start, start + kSchedule[p].seconds);
+            start += kSchedule[p].seconds;
+            printf("  %-16s %6d %6d %6d %7d %7.0f %7d\n", link, r.bps, r.bundle, r.queued_max, r.dropped,
+                   r.lat_mean(), r.lat_max);
+        }
+    }
+
+    bool ok = true;
+    const std::vector<PhaseResult>& a = runs[ADAPTIVE];
+    int fixed_drops = 0;
+    for (int p = 0; p < kPhases; p++) {
+        fixed_drops += runs[FIXED][p].dropped;
+        if (a[p].dropped > 0 || a[p].lat_mean() > MAX_MEAN_LAT_MS) ok = false;
+    }
+    if (a[0].steps_down > 0 || a[kPhases - 1].bps != UPLINK_DEFAULT_MAX_BPS) ok = false;
+    printf("\n%-4s adaptive: no drops, mean latency < %dms, ceiling held on the good link and regained\n",
+           ok ? "ok" : "FAIL", MAX_MEAN_LAT_MS);
+    bool stressed = fixed_drops > 0;
+    printf("%-4s fixed rate drops %d frames on this schedule\n", stressed ? "ok" : "FAIL", fixed_drops);
+    ok &= stressed;
+    ok &= check_rssi_cap();
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+"""
+Convert an Atom Echo trace dump into Chrome trace JSON.
+
+The server saves the device's trace_meta / trace_events / trace_dump /
+trace_end messages as one JSON object per line (TRACE_DIR). Open the output
+in chrome://tracing or https://ui.perfetto.dev.
+
+If the device clock was synced to the server's, trace_meta carries now_srv_us
+and the output's metadata gives the server (Unix) time of ts 0, so events can
+be lined up with server logs.
+
+Usage: python tools/trace2chrome.py trace-20260101-120000.jsonl [-o out.json]
+"""
+
+import argparse
+import base64
+import json
+import struct
+import sys
+import time
+
+RECORD = struct.Struct("<IBBH")  # ts_us (low 32 bits), task, event, arg — matches TraceRecord
+
+
+def load(path: str):
+    meta, events, parts = None, None, {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            msg = json.loads(line)
+            t = msg.get("type")
+            if t == "trace_meta":
+                meta = msg
+            elif t == "trace_events":
+                events = msg["events"]
+            elif t == "trace_dump":
+                parts.setdefault(msg["core"], {})[msg["part"]] = base64.b64decode(msg["data"])
+    if meta is None or events is None:
+        sys.exit(f"{path}: missing trace_meta/trace_events")
+    return meta, events, parts
+
+
+def convert(meta: dict, events: list, parts: dict) -> dict:
+    now = meta["now_us"]
+    now_low = now & 0xFFFFFFFF
+    tasks = meta["tasks"]
+    records = []
+    for core, chunks in parts.items():
+        data = b"".join(chunks[p] for p in sorted(chunks))
+        for ts, task, ev, arg in RECORD.iter_unpack(data):
+            # Records are older than the dump, so unwrap backwards from now_us
+            full = now - ((now_low - ts) & 0xFFFFFFFF)
+            records.append((full, core, task, ev, arg))
+    records.sort()
+    if not records:
+        return {"traceEvents": []}
+    t0 = records[0][0]
+
+    out = [{"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "atom-echo"}}]
+    for tid, name in enumerate(tasks):
+        out.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": tid, "args": {"name": name}})
+    for ts, core, task, ev, arg in records:
+        name, ph = events[ev] if ev < len(events) else (f"event{ev}", "i")
+        e = {"name": name, "ph": ph, "ts": ts - t0, "pid": 1, "tid": task}
+        if ph == "C":
+            e["args"] = {"value": arg}
+        elif ph == "i":
+            e["s"] = "t"
+            e["args"] = {"arg": arg, "core": core}
+        else:
+            e["args"] = {"arg": arg, "core": core}
+        out.append(e)
+    trace = {"traceEvents": out, "displayTimeUnit": "ms"}
+    if "now_srv_us" in meta:
+        trace["metadata"] = {"server_time_us_at_ts0": meta["now_srv_us"] - (now - t0)}
+    return trace
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("dump", help="JSONL file saved by voice_assistant.py")
+    ap.add_argument("-o", "--output", help="output path (default: <dump>.json)")
+    args = ap.parse_args()
+
+    meta, events, parts = load(args.dump)
+    trace = convert(meta, events, parts)
+    path = args.output or args.dump.rsplit(".", 1)[0] + ".json"
+    with open(path, "w") as f:
+        json.dump(trace, f)
+    print(f"{path}: {len(trace['traceEvents'])} events")
+    if "metadata" in trace:
+        t0 = trace["metadata"]["server_time_us_at_ts0"] / 1e6
+        print(f"ts 0 = server time {time.strftime('%H:%M:%S', time.localtime(t0))}.{int(t0 % 1 * 1e6):06d}")
+
+
+if __name__ == "__main__":
+    main()
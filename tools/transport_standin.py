@@ -0,0 +1,188 @@
+"""
+Local network stand-in comparing downlink audio over the WebSocket (TCP)
+and over UDP, with injected loss.
+
+Each trial streams a reply the way voice_assistant.py does (prefill burst,
+then one 60ms frame every 55ms) over real localhost sockets through a lossy
+relay, and plays it back against a model of the device's playback queue:
+
+  tcp  a lost segment is retransmitted after RTO and everything behind it
+       waits (in-order delivery), i.e. head-of-line blocking
+  udp  a lost datagram is gone; the device conceals it (PLC) once a later
+       frame shows the gap, with no stall
+
+Reported per configuration: underruns and total stall time, concealed
+frames, the longest gap between arrivals, and mean one-way latency (send →
+played, including queueing).
+
+  python tools/transport_standin.py                       # default sweep
+  python tools/transport_standin.py --loss 0.02 --trials 20
+"""
+
+import argparse
+import asyncio
+import random
+import statistics
+import struct
+import time
+
+FRAME_MS = 60
+FRAME_PACE = 0.055
+HEADER = struct.Struct(">IH")  # seq, payload length (stands in for WS framing)
+
+
+async def send_stream(write, frames: int, prefill: int, sent: dict):
+    payload = bytes(60)  # ~8kbps Opus frame
+    for seq in range(1, frames + 1):
+        sent[seq] = time.monotonic()
+        await write(seq, payload)
+        if seq >= prefill and seq < frames:
+            await asyncio.sleep(FRAME_PACE)
+
+
+async def trial_tcp(frames, prefill, loss, rto, rng) -> tuple[dict, dict]:
+    sent, arrived = {}, {}
+    done = asyncio.Event()
+
+    async def device(reader, writer):
+        while len(arrived) < frames:
+            try:
+                seq, n = HEADER.unpack(await reader.readexactly(HEADER.size))
+                await reader.readexactly(n)
+            except asyncio.IncompleteReadError:
+                break
+            arrived[seq] = time.monotonic()
+        done.set()
+
+    dev = await asyncio.start_server(device, "127.0.0.1", 0)
+    dev_port = dev.sockets[0].getsockname()[1]
+
+    async def relay(reader, writer):
+        _, out = await asyncio.open_connection("127.0.0.1", dev_port)
+        while True:
+            try:
+                hdr = await reader.readexactly(HEADER.size)
+                body = await reader.readexactly(HEADER.unpack(hdr)[1])
+            except asyncio.IncompleteReadError:
+                break
+            if rng.random() < loss:
+                await asyncio.sleep(rto)  # Retransmit; later segments queue behind it
+            out.write(hdr + body)
+            await out.drain()
+
+    rel = await asyncio.start_server(relay, "127.0.0.1", 0)
+    _, up = await asyncio.open_connection("127.0.0.1", rel.sockets[0].getsockname()[1])
+
+    async def write(seq, payload):
+        up.write(HEADER.pack(seq, len(payload)) + payload)
+        await up.drain()
+
+    await send_stream(write, frames, prefill, sent)
+    await asyncio.wait_for(done.wait(), 10)
+    up.close()
+    rel.close()
+    dev.close()
+    return sent, arrived
+
+
+async def trial_udp(frames, prefill, loss, rng) -> tuple[dict, dict]:
+    loop = asyncio.get_running_loop()
+    sent, arrived = {}, {}
+
+    class Device(asyncio.DatagramProtocol):
+        def datagram_received(self, data, addr):
+            arrived[HEADER.unpack_from(data)[0]] = time.monotonic()
+
+    dev_t, _ = await loop.create_datagram_endpoint(Device, local_addr=("127.0.0.1", 0))
+    dev_addr = dev_t.get_extra_info("sockname")
+
+    class Relay(asyncio.DatagramProtocol):
+        def connection_made(self, transport):
+            self.transport = transport
+
+        def datagram_received(self, data, addr):
+            if rng.random() >= loss:
+                self.transport.sendto(data, dev_addr)
+
+    rel_t, _ = await loop.create_datagram_endpoint(Relay, local_addr=("127.0.0.1", 0))
+    up, _ = await loop.create_datagram_endpoint(asyncio.DatagramProtocol,
+                                                remote_addr=rel_t.get_extra_info("sockname"))
+
+    async def write(seq, payload):
+        up.sendto(HEADER.pack(seq, len(payload)) + payload)
+
+    await send_stream(write, frames, prefill, sent)
+    await asyncio.sleep(0.1)
+    for t in (up, rel_t, dev_t):
+        t.close()
+    return sent, arrived
+
+
+def play(sent: dict, arrived: dict, frames: int, conceal: bool) -> dict:
+    """Device model: playback starts at the first arrival and takes one frame
+    per 60ms. A missing frame is concealed once a later one has arrived
+    (udp); otherwise the queue underruns until something arrives."""
+    frame_s = FRAME_MS / 1000
+    t = min(arrived.values())
+    underruns, stall, plc, latency = 0, 0.0, 0, []
+    for seq in range(1, frames + 1):
+        a = arrived.get(seq)
+        later = [arrived[s] for s in range(seq + 1, frames + 1) if s in arrived]
+        # When the device can play or conceal this frame
+        ready = a if a is not None else (min(later) if conceal and later else None)
+        if ready is None:
+            continue  # Lost at the tail: nothing ever follows
+        if ready > t:
+            underruns += 1
+            stall += ready - t
+            t = ready
+        if a is not None and a <= t:
+            latency.append(t - sent[seq])
+        else:
+            plc += 1
+        t += frame_s
+    gaps = sorted(arrived.values())
+    return {
+        "underruns": underruns,
+        "stall_ms": stall * 1000,
+        "plc": plc,
+        "gap_max_ms": max((b - a for a, b in zip(gaps, gaps[1:])), default=0) * 1000,
+        "latency_ms": statistics.mean(latency) * 1000 if latency else 0,
+    }
+
+
+async def run_config(transport, loss, prefill, frames, trials, rto, seed) -> dict:
+    results = []
+    for i in range(trials):
+        rng = random.Random(seed + i)
+        if transport == "tcp":
+            sent, arrived = await trial_tcp(frames, prefill, loss, rto, rng)
+        else:
+            sent, arrived = await trial_udp(frames, prefill, loss, rng)
+        results.append(play(sent, arrived, frames, conceal=transport == "udp"))
+    return {k: statistics.mean(r[k] for r in results) for k in results[0]}
+
+
+async def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--loss", type=float, nargs="*", default=[0.0, 0.01, 0.02, 0.05])
+    ap.add_argument("--frames", type=int, default=50, help="frames per reply (60ms each)")
+    ap.add_argument("--trials", type=int, default=5)
+    ap.add_argument("--rto", type=float, default=0.2, help="TCP retransmit delay (Linux min RTO)")
+    ap.add_argument("--ws-prefill", type=int, default=10)
+    ap.add_argument("--udp-prefill", type=int, default=4)
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    print(f"{args.trials} trials x {args.frames} frames, TCP RTO {args.rto * 1000:.0f}ms (means per reply)")
+    print(f"{'loss':>5} {'path':<10} {'underruns':>9} {'stall_ms':>8} {'plc':>5} {'gap_max_ms':>10} {'latency_ms':>10}")
+    for loss in args.loss:
+        for transport, prefill in (("tcp", args.ws_prefill), ("tcp", args.udp_prefill), ("udp", args.udp_prefill)):
+            r = await run_config(transport, loss, prefill, args.frames, args.trials, args.rto, args.seed)
+            label = f"{'ws' if transport == 'tcp' else 'udp'}/p{prefill}"
+            print(f"{loss * 100:4.0f}% {label:<10} {r['underruns']:9.1f} {r['stall_ms']:8.0f} {r['plc']:5.1f} "
+                  f"{r['gap_max_ms']:10.0f} {r['latency_ms']:10.0f}")
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
@@ -0,0 +1,126 @@
+"""
+Local TLS WebSocket stand-in for checking the device's wss:// link.
+
+Serve mode answers hello like voice_assistant.py (no STT/LLM) and logs, per
+connection, whether the TLS session was resumed and the connect time the
+device reports. Restart the server or toggle its WiFi to force reconnects.
+
+Probe mode plays the device's part from the host: it connects N times over
+TLS 1.2 (what the ESP32's mbedTLS negotiates), offering the previous session,
+and reports full vs resumed handshake times.
+
+  openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 3650 \\
+      -subj /CN=atom-echo -keyout key.pem -out cert.pem
+  python tools/wss_standin.py serve --cert cert.pem --key key.pem
+  python tools/wss_standin.py probe --cert cert.pem wss://127.0.0.1:8765/ -n 10
+"""
+
+import argparse
+import asyncio
+import json
+import socket
+import ssl
+import statistics
+import time
+from urllib.parse import urlparse
+
+from aiohttp import web
+
+
+def summarize(label: str, samples: list[float]):
+    if samples:
+        print(f"  {label:<8} n={len(samples):<3} avg={statistics.mean(samples):7.1f}ms "
+              f"min={min(samples):7.1f}ms max={max(samples):7.1f}ms")
+    else:
+        print(f"  {label:<8} n=0")
+
+
+# --- serve ---
+
+async def serve(args):
+    stats = {"full": [], "resume": []}
+
+    async def handler(request):
+        ws = web.WebSocketResponse()
+        await ws.prepare(request)
+        tls = request.transport.get_extra_info("ssl_object")
+        reused = bool(tls and tls.session_reused)
+        print(f"{request.remote}: {tls.version() if tls else 'plain'} "
+              f"{'resumed' if reused else 'full handshake'}")
+        async for msg in ws:
+            if msg.type != web.WSMsgType.TEXT:
+                continue
+            data = json.loads(msg.data)
+            if data.get("type") != "hello":
+                continue
+            link = data.get("link", {})
+            mode, ms = link.get("tls"), link.get("connect_ms")
+            # The device only knows it offered a session; the server knows if it was taken
+            print(f"  device: tls={mode} connect_ms={ms}" +
+                  (" (offered session was rejected)" if mode == "offered" and not reused else ""))
+            if ms is not None and mode in ("full", "offered"):
+                stats["resume" if reused else "full"].append(float(ms))
+                summarize("full", stats["full"])
+                summarize("resumed", stats["resume"])
+            reply = {"type": "session", "session": data.get("session"), "resumed": False, "rx_seq": 0}
+            if tls:
+                reply["tls_resumed"] = reused  # Lets the device count real resumptions
+            await ws.send_json(reply)
+        return ws
+
+    ctx = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+    ctx.load_cert_chain(args.cert, args.key)
+    app = web.Application()
+    app.router.add_get("/", handler)
+    runner = web.AppRunner(app)
+    await runner.setup()
+    await web.TCPSite(runner, "0.0.0.0", args.port, ssl_context=ctx).start()
+    print(f"Listening on wss://0.0.0.0:{args.port}")
+    await asyncio.Event().wait()
+
+
+# --- probe ---
+
+def probe(args):
+    url = urlparse(args.url)
+    host, port = url.hostname, url.port or 443
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    ctx.load_verify_locations(args.cert)  # Pinned, like the device
+    ctx.check_hostname = False
+    ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+
+    session = None
+    stats = {"full": [], "resume": []}
+    for _ in range(args.n):
+        t0 = time.perf_counter()
+        with socket.create_connection((host, port)) as raw:
+            with ctx.wrap_socket(raw, server_hostname=host, session=session) as s:
+                ms = (time.perf_counter() - t0) * 1000
+                stats["resume" if s.session_reused else "full"].append(ms)
+                session = s.session
+    print(f"{args.url}: TCP + TLS handshake")
+    summarize("full", stats["full"])
+    summarize("resumed", stats["resume"])
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="mode", required=True)
+    s = sub.add_parser("serve")
+    s.add_argument("--cert", required=True)
+    s.add_argument("--key", required=True)
+    s.add_argument("--port", type=int, default=8765)
+    p = sub.add_parser("probe")
+    p.add_argument("--cert", required=True, help="server certificate to pin")
+    p.add_argument("url")
+    p.add_argument("-n", type=int, default=10, help="connections")
+    args = ap.parse_args()
+
+    if args.mode == "serve":
+        asyncio.run(serve(args))
+    else:
+        probe(args)
+
+
+if __name__ == "__main__":
+    main()
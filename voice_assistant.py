@@ -2,11 +2,59 @@
 WebSocket-based Voice Assistant backend for Atom Echo (Opus transport).
 
 Protocol (ESP32 ↔ this server):
-  - Binary WebSocket messages = Opus-encoded audio frames
+  - Binary WebSocket messages = 4-byte big-endian sequence number + Opus frame
+    Uplink may bundle frames: seq with the top bit set (first frame's seq), then per frame
+    a 2-byte big-endian length + Opus data; the device does this at low bitrates.
+    The server acks uplink every UPLINK_ACK_EVERY frames with {"type":"uplink_ack","seq":N}; the
+    device counts unacked frames as queued and lowers its bitrate when they pile up
   - Text WebSocket messages = JSON control messages
-  - ESP32 sends: {"type":"hello",...}, {"type":"record_start"}, {"type":"record_stop"}
+  - ESP32 sends: {"type":"hello","session":"<id>","rx_seq":N,"played_seq":N,"tx_seq":N,...},
+    {"type":"record_start"}, {"type":"record_stop","eos":true},
+    {"type":"record_end","frames":N,"last_seq":N,"tail_ms":N,"opus_cx":N,"enc_us":N,...}
+    With eos, record_stop is followed by the padded last frame and record_end, which carries the
+    recording's frame count (STT starts on it), the device's Opus encoder complexity, what a frame
+    costs to encode and where its uplink bitrate settled
+    hello also carries "link":{"tls":"off|full|offered","connect_ms":N} — how the device connected
+    ("offered": it offered its saved TLS session; only the server knows whether it was taken)
+  - Optional UDP downlink (UDP_AUDIO_PORT): server offers {"type":"udp_offer","port":N,"ssrc":S,"seq":N}
+    to a device whose hello has link.udp; the device sends header-only probes from its UDP socket and
+    the server answers {"type":"udp_ready"}. From then on downlink Opus goes as RTP-style datagrams
+    (12-byte header: V=2, PT 111, 16-bit seq, 48kHz timestamp, SSRC) with no retransmit; the device
+    conceals gaps. Control and uplink stay on the WebSocket. Probes count only from the WebSocket
+    peer's IP, and the address is locked once udp_ready is sent (re-learned on reconnect), so a
+    third party that sees the SSRC can't redirect the downlink. The datagrams are cleartext, so
+    UDP is not offered when the WebSocket is wss://. After each reply the device sends
+    {"type":"playback_stats","transport":"ws|udp","underruns":N,"plc":N,"rx_gap_max_ms":N,...}
+  - Credit flow control: the device sends {"type":"credit","limit":N,"fill":F,"window":W} after
+    hello and every few tens of ms while its queues drain; downlink frames up to seq N fit. The
+    server sends whenever credit allows, with no prefill or pacing; without credit it paces blindly.
+  - Server replies to hello: {"type":"session","session":"<id>","resumed":bool,"rx_seq":N}
+    plus "tls_resumed":bool over wss (whether this connection's TLS session was resumed)
+    A hello with a known session id re-attaches it: downlink continues after the
+    device's rx_seq, and uplink buffered during the outage is de-duplicated by seq.
+  - Clock sync: the device sends {"type":"time_req","t1":<device us>} (a burst after hello, then
+    every 10s); the server answers at once with {"type":"time_resp","t1":..,"t2":..,"t3":..},
+    t2/t3 = receive/send Unix time in us. The device maps its clock to server time from the
+    lowest-RTT exchanges; record_stop then carries t_srv_us (button release in server time) and
+    trace_meta now_srv_us, so device events line up with server logs.
   - Server sends: {"type":"tts_start"}, {"type":"tts_end"}, {"type":"stt","text":"..."}
   - Server sends: {"type":"status","stage":"thinking|tool_call|tool_result","detail":"..."}
+  - Server sends: {"type":"latency_profile","name":"low|balanced|robust"}; ESP32 replies with its budget
+  - Server sends: {"type":"loopback_test","runs":N}; ESP32 plays a chirp N times, times its
+    arrival at the mic and replies {"type":"loopback_result","latency_mean_us":...,"jitter_us":...}
+  - Server sends: {"type":"bench","iterations":N}; ESP32 times its Opus/resample/copy kernels
+    and replies {"type":"bench_result","build":...,"kernels":N}, then one
+    {"type":"bench_kernel","index":i,"name":..,"cycles_avg":..,"stack":..} per kernel
+  - Server sends: {"type":"codec_stress","ms":N}; ESP32 streams through the codec from two
+    tasks while toggling input/output and rebuilding I2S DMA, then replies
+    {"type":"codec_stress_result","ok":..,"toggles":..,"drained":..,"drain_max_us":..,"io_users":..}
+  - Server sends: {"type":"trace","action":"start|stop|dump"}; a dump replies with trace_meta,
+    trace_events, trace_dump (base64 records per core) and trace_end messages.
+    tools/trace2chrome.py turns the saved messages into a Chrome/Perfetto trace.
+  - Server sends: {"type":"flight","action":"arm|disarm|dump","underruns":N,"drops":N}; an armed
+    device keeps the last seconds of uplink/downlink Opus, queue depths, underruns and drops, freezes
+    when a threshold trips and, once idle, sends flight_meta, flight_dump parts and flight_end.
+    tools/flight_replay.py turns a saved dump into a timeline and WAV files.
 
 LLM backend: NanoBot WebSocket streaming API at ws://NANOBOT_HOST:18790/ws/chat
   Events: thinking → tool_call → tool_result → ... → done → final
@@ -19,7 +67,9 @@ import io
 import json
 import logging
 import os
+import random
 import re
+import ssl
 import struct
 import time
 import wave
@@ -56,6 +106,10 @@ with open(secrets_path, "r") as f:
     secrets = yaml.safe_load(f)
 
 WS_PORT = 8765
+# wss://: serve TLS with this certificate/key (the device pins the certificate).
+# Session tickets are on by default, so device reconnects resume the TLS session.
+TLS_CERT = os.environ.get("TLS_CERT", "")
+TLS_KEY = os.environ.get("TLS_KEY", "")
 SILICONFLOW_API_KEY = secrets.get("siliconflow_api_key")
 SILICONFLOW_BASE_URL = "https://api.siliconflow.cn/v1"
 
@@ -65,6 +119,26 @@ NANOBOT_HOST = os.environ.get("NANOBOT_HOST", "127.0.0.1")
 NANOBOT_WS_URL = f"ws://{NANOBOT_HOST}:18790/ws/chat"
 NANOBOT_SESSION = "iot:device1"
 
+# Device buffering preset: low | balanced | robust (empty = keep device default)
+LATENCY_PROFILE = os.environ.get("LATENCY_PROFILE", "")
+# Acoustic loopback runs to request after each fresh hello (0 = off).
+# Runs after LATENCY_PROFILE is applied, so results are per profile.
+LOOPBACK_TEST = int(os.environ.get("LOOPBACK_TEST", "0"))
+# On-device kernel benchmark iterations to request after each fresh hello (0 = off)
+BENCH_ITERATIONS = int(os.environ.get("BENCH", "0"))
+# Codec I/O switching stress run (ms) to request after each fresh hello (0 = off)
+CODEC_STRESS_MS = int(os.environ.get("CODEC_STRESS", "0"))
+# Directory for on-device event traces (empty = off). Tracing starts on hello and
+# each utterance is dumped to <TRACE_DIR>/trace-<time>.jsonl after its reply.
+TRACE_DIR = os.environ.get("TRACE_DIR", "")
+# Directory for flight recorder dumps (empty = off). The recorder is armed on
+# hello; the device uploads it after a glitch to <FLIGHT_DIR>/flight-<time>.jsonl.
+FLIGHT_DIR = os.environ.get("FLIGHT_DIR", "")
+# Downlink audio over UDP on this port (0 = WebSocket only). UDP_DROP drops
+# that fraction of datagrams on purpose, to test loss concealment.
+UDP_AUDIO_PORT = int(os.environ.get("UDP_AUDIO_PORT", "0"))
+UDP_DROP = float(os.environ.get("UDP_DROP", "0"))
+
 # Prefix injected before every user message to constrain LLM output for TTS
 VOICE_OUTPUT_PREFIX = (
     "[语音输出模式] 你的回复将通过语音合成朗读给用户。请严格遵守：\n"
@@ -83,52 +157,415 @@ OPUS_DECODE_RATE = 24000   # TTS playback rate on ESP32
 OPUS_FRAME_MS = 60         # frame duration in ms
 OPUS_CHANNELS = 1
 
+# Session resume: sequence header on binary frames, and how long a detached
+# session (mid-reply) waits for the device to reconnect
+SEQ_HEADER = struct.Struct(">I")
+SEQ_BUNDLE_FLAG = 0x80000000
+BUNDLE_LEN = struct.Struct(">H")
+# Uplink acks let the device see frames queued in its TCP send buffer
+UPLINK_ACK_EVERY = 2  # frames
+SESSION_RESUME_TIMEOUT = 30  # seconds, matches WS_RESUME_GRACE_MS on the device
+
+# UDP downlink: RTP-style header (V=2, payload type, seq16, timestamp, SSRC)
+RTP_HEADER = struct.Struct(">BBHII")
+RTP_PAYLOAD_OPUS = 111
+RTP_CLOCK_PER_FRAME = 48 * OPUS_FRAME_MS  # Opus RTP clock is 48kHz
+# Without TCP head-of-line stalls to hide, a short burst is enough
+UDP_PREFILL = 4
+# Credit flow control: with no grant for this long, fall back to blind pacing
+CREDIT_TIMEOUT = 1.0  # seconds
+# After record_stop with eos: start STT anyway if record_end hasn't come by then
+EOS_TIMEOUT = 1.0  # seconds
+
 STT_MODEL = "FunAudioLLM/SenseVoiceSmall"
 TTS_MODEL = "FunAudioLLM/CosyVoice2-0.5B"
 TTS_VOICE = "FunAudioLLM/CosyVoice2-0.5B:anna"
 
 
+# Sessions by device session id, kept across reconnects
+SESSIONS: dict[str, "VoiceSession"] = {}
+# UDP downlink streams by SSRC, and the shared socket
+UDP_STREAMS: dict[int, "VoiceSession"] = {}
+udp_transport: asyncio.DatagramTransport | None = None
+# playback_stats reported by devices, per transport, for comparison
+PLAYBACK_REPORTS: dict[str, list[dict]] = {"ws": [], "udp": []}
+
+
 class VoiceSession:
-    """Handles one WebSocket connection from an ESP32 device."""
+    """One device session. Normally one WebSocket connection, but a session
+    that drops mid-stream can be re-attached to a new connection."""
 
-    def __init__(self, ws: web.WebSocketResponse):
+    def __init__(self, ws: web.WebSocketResponse, peer_ip: str | None, tls_resumed: bool | None = None):
         self.ws = ws
+        self.peer_ip = peer_ip  # WebSocket peer; UDP probes must come from it
+        self.tls_resumed = tls_resumed  # None on plain ws://
         self.opus_decoder = opuslib.Decoder(OPUS_ENCODE_RATE, OPUS_CHANNELS)
         self.opus_encoder = opuslib.Encoder(OPUS_DECODE_RATE, OPUS_CHANNELS, 'voip')
         self.recording = False
         self.pcm_buffer = bytearray()
+        self.record_frames = 0   # Uplink frames received this recording
+        self.stop_t: float | None = None  # record_stop arrival, while waiting for record_end
+        self.stop_srv_us = 0     # Button release in server time (device clock synced), else 0
+        self.rx_us = 0           # Arrival of the message being handled (time_req t2)
+        self._eos_task: asyncio.Task | None = None
         self.processing = False
         self._heartbeat_task: asyncio.Task | None = None
 
-    async def handle_message(self, msg: aiohttp.WSMessage):
+        self.session_id: str | None = None
+        self.tx_seq = 0          # Last downlink frame sequence number assigned
+        self.rx_seq = 0          # Last uplink frame sequence number received
+        self.device_rx_seq = 0   # Last downlink frame the device reported receiving
+        self.uplink_acked = 0    # Last uplink seq acked to the device
+        self.attached = asyncio.Event()
+        self.attached.set()
+        self.pending_json: list[dict] = []  # Sent while detached, replayed on resume
+        self._expire_task: asyncio.Task | None = None
+        self.trace_lines: list[str] = []  # Trace dump messages collected until trace_end
+        self.bench: dict = {}  # Last bench_result header, for its bench_kernel lines
+        self.flight_lines: list[str] = []  # Flight recorder messages collected until flight_end
+
+        self.udp_ssrc = 0        # Downlink stream id while UDP is offered
+        self.udp_addr: tuple | None = None  # Device address, learned from its probes
+        self.udp_ready = False
+
+        self.credit_limit: int | None = None  # Last downlink seq the device has room for
+        self.credit_event = asyncio.Event()
+
+    async def handle_message(self, msg: aiohttp.WSMessage) -> "VoiceSession":
+        """Returns the session that owns the connection from now on (a hello
+        may resume an older one)."""
         if msg.type == aiohttp.WSMsgType.BINARY:
             await self.handle_audio(msg.data)
         elif msg.type == aiohttp.WSMsgType.TEXT:
-            await self.handle_json(msg.data)
+            self.rx_us = time.time_ns() // 1000
+            return await self.handle_json(msg.data)
+        return self
 
-    async def handle_json(self, text: str):
+    async def handle_json(self, text: str) -> "VoiceSession":
         try:
             data = json.loads(text)
         except json.JSONDecodeError:
             logger.warning(f"Invalid JSON: {text[:100]}")
-            return
+            return self
 
         msg_type = data.get("type")
-        if msg_type == "hello":
-            logger.info(f"Device hello: {data}")
+        if msg_type == "time_req":
+            # Answered first and unqueued: the device times the round trip
+            t3 = time.time_ns() // 1000
+            await self.send_json({"type": "time_resp", "t1": data.get("t1", 0), "t2": self.rx_us, "t3": t3},
+                                 queue=False)
+        elif msg_type == "hello":
+            return await self.on_hello(data)
+        elif msg_type == "latency_profile":
+            logger.info(f"Device latency profile '{data.get('name')}': dma={data.get('dma_ms')}ms "
+                        f"uplink<={data.get('uplink_ms')}ms downlink<={data.get('downlink_ms')}ms "
+                        f"credit={data.get('credit_window')}")
+        elif msg_type == "credit":
+            self.credit_limit = int(data.get("limit", 0))
+            self.credit_event.set()
+        elif msg_type == "loopback_result":
+            logger.info(f"Loopback '{data.get('profile')}' (dma={data.get('dma_ms')}ms): "
+                        f"{data.get('detected')}/{data.get('runs')} detected, "
+                        f"latency min/mean/max={data.get('latency_min_us')}/{data.get('latency_mean_us')}/"
+                        f"{data.get('latency_max_us')}us jitter={data.get('jitter_us')}us "
+                        f"peak_ratio_min={data.get('peak_ratio_min')}")
+        elif msg_type == "bench_result":
+            self.bench = data
+            logger.info(f"Bench ({data.get('build')}, {data.get('iterations')} iterations @ "
+                        f"{data.get('cpu_mhz')}MHz, {data.get('kernels')} kernels):")
+        elif msg_type == "bench_kernel":
+            mhz = self.bench.get("cpu_mhz") or 240
+            frame_cycles = mhz * 1000 * (self.bench.get("frame_ms") or 60)
+            load = 100.0 * data.get("cycles_avg", 0) / frame_cycles
+            logger.info(f"  {data.get('name'):<12} {'ok' if data.get('ok') else 'FAIL':<4} "
+                        f"avg={data.get('cycles_avg'):>9} min={data.get('cycles_min'):>9} "
+                        f"max={data.get('cycles_max'):>9} ({load:5.1f}% of frame) "
+                        f"stack={data.get('stack')} out={data.get('out_bytes')}B")
+        elif msg_type == "codec_stress_result":
+            log = logger.info if data.get("ok") else logger.error
+            log(f"Codec stress {'OK' if data.get('ok') else 'FAILED'} ({data.get('ms')}ms): "
+                f"{data.get('toggles')} toggles, {data.get('rebuilds')} DMA rebuilds, "
+                f"{data.get('reads')} reads / {data.get('writes')} writes, "
+                f"{data.get('quiesces')} quiesces ({data.get('drained')} drained, max "
+                f"{data.get('drain_max_us')}us), {data.get('refused')} refused, "
+                f"io_users={data.get('io_users')} bad_reads={data.get('bad_reads')} "
+                f"stopped={data.get('tasks_stopped')} recovered={data.get('recovered')}")
+        elif msg_type in ("trace_meta", "trace_events", "trace_dump"):
+            self.trace_lines.append(text)
+        elif msg_type == "trace_end":
+            self.trace_lines.append(text)
+            self.save_trace(data)
+        elif msg_type == "trace_started" and not data.get("ok"):
+            logger.warning("Device could not start tracing (no memory for the ring buffers)")
+        elif msg_type in ("flight_meta", "flight_dump"):
+            if msg_type == "flight_meta":
+                self.flight_lines = []
+                logger.warning(f"Device flight recorder froze on {data.get('reason')}: "
+                               f"{data.get('records')} records, {data.get('bytes')} bytes")
+            self.flight_lines.append(text)
+        elif msg_type == "flight_end":
+            self.flight_lines.append(text)
+            self.save_flight(data)
+        elif msg_type == "flight_armed" and not data.get("ok"):
+            logger.warning("Device could not arm the flight recorder (no memory for the ring)")
+        elif msg_type == "playback_stats":
+            self.log_playback_stats(data)
         elif msg_type == "record_start":
             logger.info("Recording started")
             self.recording = True
             self.pcm_buffer = bytearray()
+            self.record_frames = 0
         elif msg_type == "record_stop":
-            logger.info(f"Recording stopped, buffer: {len(self.pcm_buffer)} bytes")
-            self.recording = False
-            if not self.processing:
-                asyncio.create_task(self.process_utterance())
+            await self.ack_uplink()
+            self.stop_srv_us = int(data.get("t_srv_us", 0))
+            if self.stop_srv_us:
+                logger.info(f"record_stop one-way: {(self.rx_us - self.stop_srv_us) / 1000:.1f}ms "
+                            "(button release → server, synced clocks)")
+            if data.get("eos"):
+                # The tail is still coming; record_end marks the last frame
+                self.stop_t = time.monotonic()
+                self._eos_task = asyncio.create_task(self._eos_timeout())
+                logger.info(f"Recording stopped, buffer: {len(self.pcm_buffer)} bytes, waiting for end of stream")
+            else:
+                self.finish_recording(data)
+        elif msg_type == "record_end":
+            await self.ack_uplink()
+            self.finish_recording(data)
+        return self
+
+    async def _eos_timeout(self):
+        await asyncio.sleep(EOS_TIMEOUT)
+        self._eos_task = None
+        logger.warning(f"No record_end {EOS_TIMEOUT:.1f}s after record_stop, starting STT anyway")
+        self.finish_recording({})
+
+    def finish_recording(self, data: dict):
+        """End of the uplink stream (record_end, or record_stop from a device
+        without eos): stop collecting audio and start STT."""
+        if not self.recording:
+            return
+        if self._eos_task and self._eos_task is not asyncio.current_task():
+            self._eos_task.cancel()
+        self._eos_task = None
+        if "frames" in data:
+            if data["frames"] != self.record_frames:
+                logger.warning(f"End of stream: device sent {data['frames']} frames "
+                               f"(last seq {data.get('last_seq')}), received {self.record_frames}")
+            if self.stop_srv_us:
+                logger.info(f"Stop → STT start: {(time.time_ns() // 1000 - self.stop_srv_us) / 1000:.0f}ms "
+                            f"from button release (device tail out {data.get('tail_ms')}ms after stop)")
+            elif self.stop_t is not None:
+                logger.info(f"Stop → STT start: {(time.monotonic() - self.stop_t) * 1000:.0f}ms "
+                            f"(device tail out {data.get('tail_ms')}ms after stop)")
+        self.stop_t = None
+        self.stop_srv_us = 0
+        logger.info(f"Recording ended, {self.record_frames} frames, buffer: {len(self.pcm_buffer)} bytes")
+        if "opus_cx" in data:
+            logger.info(f"Device encoder: complexity {data['opus_cx']}, {data.get('enc_us')}us/frame "
+                        f"({data.get('enc_cycles')} cycles, max {data.get('enc_max_us')}us, "
+                        f"budget {data.get('enc_budget_us')}us)")
+        if "up_bps" in data:
+            logger.info(f"Device uplink: {data['up_bps']}bps, {data.get('up_bundle')} frame(s)/message, "
+                        f"send avg {data.get('send_avg_us')}us max {data.get('send_max_us')}us, "
+                        f"backlog max {data.get('backlog_max')}, rssi {data.get('rssi')}dBm")
+        self.recording = False
+        if not self.processing:
+            asyncio.create_task(self.process_utterance())
+
+    async def on_hello(self, data: dict) -> "VoiceSession":
+        sid = data.get("session")
+        old = SESSIONS.get(sid) if sid else None
+        if old is not None and old is not self:
+            logger.info(f"Session {sid} resumed: device rx_seq={data.get('rx_seq')} "
+                        f"played_seq={data.get('played_seq')} tx_seq={data.get('tx_seq')} "
+                        f"(server sent {old.tx_seq}, received {old.rx_seq})")
+            await old.attach(self.ws, data, self.peer_ip, self.tls_resumed)
+            return old
+
+        logger.info(f"Device hello: {data}")
+        self.session_id = sid
+        if sid:
+            SESSIONS[sid] = self
+        await self.send_json(self.session_reply(False))
+        if LATENCY_PROFILE and data.get("latency_profile") != LATENCY_PROFILE:
+            await self.send_json({"type": "latency_profile", "name": LATENCY_PROFILE})
+        if LOOPBACK_TEST > 0:
+            await self.send_json({"type": "loopback_test", "runs": LOOPBACK_TEST})
+        if BENCH_ITERATIONS > 0:
+            await self.send_json({"type": "bench", "iterations": BENCH_ITERATIONS})
+        if CODEC_STRESS_MS > 0:
+            await self.send_json({"type": "codec_stress", "ms": CODEC_STRESS_MS})
+        if TRACE_DIR:
+            await self.send_json({"type": "trace", "action": "start"})
+        if FLIGHT_DIR:
+            await self.send_json({"type": "flight", "action": "arm"})
+        await self.offer_udp(data)
+        return self
+
+    async def offer_udp(self, hello: dict):
+        """Offer the datagram downlink; audio stays on the WebSocket until
+        the device's probe arrives."""
+        self.udp_ready = False
+        self.udp_addr = None
+        if not udp_transport or not hello.get("link", {}).get("udp"):
+            return
+        if not self.udp_ssrc:
+            self.udp_ssrc = random.randint(1, 0x7FFFFFFF)
+            UDP_STREAMS[self.udp_ssrc] = self
+        await self.send_json({"type": "udp_offer", "port": UDP_AUDIO_PORT,
+                              "ssrc": self.udp_ssrc, "seq": self.tx_seq})
+
+    def on_udp_probe(self, addr: tuple):
+        # Anyone who sees the SSRC could send a probe: take the address only
+        # from the WebSocket peer, and only until the stream is set up
+        if self.udp_ready or not self.attached.is_set():
+            return
+        if addr[0] != self.peer_ip:
+            logger.warning(f"UDP probe for ssrc={self.udp_ssrc:08x} from {addr[0]}:{addr[1]} "
+                           f"ignored (WebSocket peer is {self.peer_ip})")
+            return
+        self.udp_addr = addr
+        self.udp_ready = True
+        logger.info(f"UDP downlink ready: {addr[0]}:{addr[1]} ssrc={self.udp_ssrc:08x}")
+        asyncio.create_task(self.send_json({"type": "udp_ready"}, queue=False))
+
+    def log_playback_stats(self, data: dict):
+        transport = "udp" if data.get("transport") == "udp" else "ws"
+        logger.info(f"Playback ({transport}): rx={data.get('rx')} plc={data.get('plc')} "
+                    f"dropped={data.get('dropped')} underruns={data.get('underruns')} "
+                    f"rx_gap_max={data.get('rx_gap_max_ms')}ms udp_lost={data.get('udp_lost')} "
+                    f"udp_late={data.get('udp_late')}")
+        PLAYBACK_REPORTS[transport].append(data)
+        for name, reports in PLAYBACK_REPORTS.items():
+            if reports:
+                n = len(reports)
+                logger.info(f"  {name}: {n} replies, underruns/reply="
+                            f"{sum(r.get('underruns', 0) for r in reports) / n:.2f}, plc/reply="
+                            f"{sum(r.get('plc', 0) for r in reports) / n:.2f}, mean rx_gap_max="
+                            f"{sum(r.get('rx_gap_max_ms', 0) for r in reports) / n:.0f}ms")
+
+    def save_trace(self, end: dict):
+        lines, self.trace_lines = self.trace_lines, []
+        if not TRACE_DIR:
+            return
+        os.makedirs(TRACE_DIR, exist_ok=True)
+        path = os.path.join(TRACE_DIR, time.strftime("trace-%Y%m%d-%H%M%S.jsonl"))
+        with open(path, "w") as f:
+            f.write("\n".join(lines) + "\n")
+        logger.info(f"Trace saved: {path} ({end.get('records')} records, "
+                    f"{end.get('overwritten')} overwritten) — tools/trace2chrome.py {path}")
+
+    def save_flight(self, end: dict):
+        lines, self.flight_lines = self.flight_lines, []
+        if not FLIGHT_DIR:
+            return
+        os.makedirs(FLIGHT_DIR, exist_ok=True)
+        path = os.path.join(FLIGHT_DIR, time.strftime("flight-%Y%m%d-%H%M%S.jsonl"))
+        with open(path, "w") as f:
+            f.write("\n".join(lines) + "\n")
+        logger.info(f"Flight recorder saved: {path} ({end.get('bytes')} bytes, "
+                    f"{end.get('overwritten')} overwritten) — tools/flight_replay.py {path}")
+
+    def session_reply(self, resumed: bool) -> dict:
+        reply = {"type": "session", "session": self.session_id, "resumed": resumed, "rx_seq": self.rx_seq}
+        if self.tls_resumed is not None:
+            reply["tls_resumed"] = self.tls_resumed
+        return reply
+
+    async def attach(self, ws: web.WebSocketResponse, hello: dict, peer_ip: str | None,
+                     tls_resumed: bool | None):
+        """Move this session onto a new connection and replay queued JSON.
+        Downlink streaming picks up once `attached` is set."""
+        self.ws = ws
+        self.peer_ip = peer_ip
+        self.tls_resumed = tls_resumed
+        self.device_rx_seq = int(hello.get("rx_seq", 0))
+        if self._expire_task and not self._expire_task.done():
+            self._expire_task.cancel()
+        self._expire_task = None
+        pending, self.pending_json = self.pending_json, []
+        try:
+            await ws.send_str(json.dumps(self.session_reply(True)))
+            for data in pending:
+                await ws.send_str(json.dumps(data))
+        except Exception:
+            return
+        self.attached.set()
+        await self.offer_udp(hello)
+
+    def detach(self, ws: web.WebSocketResponse):
+        """Connection `ws` is gone. Keep the session for SESSION_RESUME_TIMEOUT."""
+        if self.ws is not ws or not self.attached.is_set():
+            return
+        self.attached.clear()
+        self.udp_ready = False  # The device closes its socket; re-offered on resume
+        if self.session_id:
+            self._expire_task = asyncio.create_task(self._expire())
+
+    async def _expire(self):
+        await asyncio.sleep(SESSION_RESUME_TIMEOUT)
+        if not self.attached.is_set() and SESSIONS.get(self.session_id) is self:
+            del SESSIONS[self.session_id]
+            UDP_STREAMS.pop(self.udp_ssrc, None)
+            logger.info(f"Session {self.session_id} expired")
+
+    async def wait_resume(self) -> bool:
+        try:
+            await asyncio.wait_for(self.attached.wait(), SESSION_RESUME_TIMEOUT)
+            return True
+        except asyncio.TimeoutError:
+            return False
+
+    async def send_audio(self, seq: int, opus_pkt: bytes) -> bool:
+        if not self.attached.is_set():
+            return False
+        if self.udp_ready and udp_transport:
+            # No retransmit: a lost datagram is concealed by the device's decoder
+            if not (UDP_DROP and random.random() < UDP_DROP):
+                header = RTP_HEADER.pack(0x80, RTP_PAYLOAD_OPUS, seq & 0xFFFF,
+                                         (seq * RTP_CLOCK_PER_FRAME) & 0xFFFFFFFF, self.udp_ssrc)
+                udp_transport.sendto(header + opus_pkt, self.udp_addr)
+            return True
+        ws = self.ws
+        try:
+            await ws.send_bytes(SEQ_HEADER.pack(seq) + opus_pkt)
+            return True
+        except Exception:
+            self.detach(ws)
+            return False
+
+    async def handle_audio(self, data: bytes):
+        if len(data) <= SEQ_HEADER.size:
+            return
+        (seq,) = SEQ_HEADER.unpack_from(data)
+        if not seq & SEQ_BUNDLE_FLAG:
+            self.handle_uplink_frame(seq, data[SEQ_HEADER.size:])
+        else:
+            seq &= ~SEQ_BUNDLE_FLAG
+            off = SEQ_HEADER.size
+            while off + BUNDLE_LEN.size <= len(data):
+                (n,) = BUNDLE_LEN.unpack_from(data, off)
+                off += BUNDLE_LEN.size
+                self.handle_uplink_frame(seq, data[off:off + n])
+                off += n
+                seq += 1
+        if self.rx_seq - self.uplink_acked >= UPLINK_ACK_EVERY:
+            await self.ack_uplink()
+
+    async def ack_uplink(self):
+        self.uplink_acked = self.rx_seq
+        await self.send_json({"type": "uplink_ack", "seq": self.rx_seq}, queue=False)
+
+    def handle_uplink_frame(self, seq: int, opus_data: bytes):
+        if seq <= self.rx_seq:
+            return  # Already have it (re-sent after a reconnect)
+        if self.rx_seq and seq != self.rx_seq + 1:
+            logger.warning(f"Uplink gap: {seq - self.rx_seq - 1} frames lost before seq {seq}")
+        self.rx_seq = seq
 
-    async def handle_audio(self, opus_data: bytes):
         if not self.recording:
             return
+        self.record_frames += 1
         try:
             # Decode Opus to 16kHz PCM (matching encoder rate)
             frame_size = OPUS_ENCODE_RATE * OPUS_FRAME_MS // 1000  # 960 samples
@@ -152,7 +589,7 @@ class VoiceSession:
         try:
             while True:
                 await asyncio.sleep(15)
-                await self.send_json({"type": "heartbeat", "timestamp": time.time()})
+                await self.send_json({"type": "heartbeat", "timestamp": time.time()}, queue=False)
         except asyncio.CancelledError:
             pass
 
@@ -193,6 +630,9 @@ class VoiceSession:
         finally:
             self._stop_heartbeat()
             self.processing = False
+            if TRACE_DIR:
+                # The device sends it once playback has drained
+                await self.send_json({"type": "trace", "action": "dump"})
 
     async def llm_stream(self, text: str) -> str:
         """Call NanoBot via WebSocket streaming API.
@@ -296,41 +736,80 @@ class VoiceSession:
             # Encode PCM to Opus frames and send
             frame_samples = OPUS_DECODE_RATE * OPUS_FRAME_MS // 1000  # 1440 samples @ 24kHz
             frame_bytes = frame_samples * 2  # 16-bit
-            offset = 0
+            total = len(pcm_data) // frame_bytes
             frame_count = 0
 
-            # Pre-encode all frames first, then stream with real-time pacing
+            # Encoded on demand (in order, the encoder is stateful) so the
+            # first frame goes out without waiting for the whole reply
             opus_frames = []
-            while offset + frame_bytes <= len(pcm_data):
-                frame = pcm_data[offset:offset + frame_bytes]
-                opus_pkt = self.opus_encoder.encode(frame, frame_samples)
-                opus_frames.append(opus_pkt)
-                offset += frame_bytes
-
-            # Stream with real-time pacing to avoid playback queue underrun.
-            # Send first burst of 10 frames to pre-fill buffer (~600ms),
-            # then pace 1 frame per ~55ms (slightly faster than 60ms real-time).
-            PREFILL = 10  # frames to send immediately to fill ESP32 buffer
+
+            def frame_at(k: int) -> bytes:
+                while len(opus_frames) <= k:
+                    off = len(opus_frames) * frame_bytes
+                    opus_frames.append(self.opus_encoder.encode(pcm_data[off:off + frame_bytes], frame_samples))
+                return opus_frames[k]
+
+            # With credit from the device, send whenever its queues have room.
+            # Otherwise stream blindly: a burst of 10 frames to pre-fill the
+            # buffer (~600ms), then 1 frame per ~55ms (slightly faster than
+            # 60ms real-time).
+            PREFILL = UDP_PREFILL if self.udp_ready else 10  # frames sent immediately
             FRAME_PACE = 0.055  # seconds between frames after prefill
 
-            for i, opus_pkt in enumerate(opus_frames):
-                await self.ws.send_bytes(opus_pkt)
+            # Frames are numbered up front; after a reconnect the stream
+            # restarts (with a fresh prefill) after the device's rx_seq.
+            first_seq = self.tx_seq + 1
+            self.tx_seq += total
+            t_start = time.monotonic()
+            i = 0
+            burst_end = PREFILL
+            while i < total:
+                seq = first_seq + i
+                while self.credit_limit is not None and seq > self.credit_limit and self.attached.is_set():
+                    self.credit_event.clear()
+                    try:
+                        await asyncio.wait_for(self.credit_event.wait(), CREDIT_TIMEOUT)
+                    except asyncio.TimeoutError:
+                        logger.warning(f"No credit for {CREDIT_TIMEOUT}s at seq {seq}, pacing blindly")
+                        self.credit_limit = None
+                        burst_end = i + PREFILL
+                pkt = frame_at(i)
+                if i == 0:
+                    logger.info(f"First frame after {(time.monotonic() - t_start) * 1000:.0f}ms "
+                                f"({'credit' if self.credit_limit is not None else 'paced'})")
+                if not await self.send_audio(seq, pkt):
+                    logger.warning(f"Downlink interrupted at seq {first_seq + i}, waiting for resume")
+                    if not await self.wait_resume():
+                        logger.warning(f"Session not resumed within {SESSION_RESUME_TIMEOUT}s, dropping reply")
+                        return
+                    i = min(max(self.device_rx_seq + 1 - first_seq, 0), total)
+                    burst_end = i + PREFILL
+                    logger.info(f"Downlink resumed at seq {first_seq + i}")
+                    continue
+                i += 1
                 frame_count += 1
-                if i >= PREFILL - 1 and i + 1 < len(opus_frames):
+                if self.credit_limit is None and i >= burst_end and i < total:
                     await asyncio.sleep(FRAME_PACE)
 
-            logger.info(f"Streamed {frame_count} Opus frames ({len(opus_frames) * OPUS_FRAME_MS / 1000:.1f}s)")
+            logger.info(f"Streamed {frame_count} Opus frames ({total * OPUS_FRAME_MS / 1000:.1f}s)")
 
         except Exception as e:
             logger.error(f"TTS stream error: {e}", exc_info=True)
 
         await self.send_json({"type": "tts_end"})
 
-    async def send_json(self, data: dict):
-        try:
-            await self.ws.send_str(json.dumps(data))
-        except Exception:
-            pass
+    async def send_json(self, data: dict, queue: bool = True):
+        """While detached, messages are queued for the resumed connection
+        (queue=False drops them instead)."""
+        if self.attached.is_set():
+            ws = self.ws
+            try:
+                await ws.send_str(json.dumps(data))
+                return
+            except Exception:
+                self.detach(ws)
+        if queue:
+            self.pending_json.append(data)
 
 
 # --- Shared utilities ---
@@ -433,24 +912,42 @@ async def tts_to_pcm(text: str, target_rate: int) -> bytes:
 async def websocket_handler(request):
     ws = web.WebSocketResponse()
     await ws.prepare(request)
-    logger.info(f"Client connected: {request.remote}")
+    tls = request.transport.get_extra_info("ssl_object") if request.transport else None
+    if tls is not None:
+        logger.info(f"Client connected: {request.remote} ({tls.version()}, "
+                    f"session {'resumed' if tls.session_reused else 'full handshake'})")
+    else:
+        logger.info(f"Client connected: {request.remote}")
 
-    session = VoiceSession(ws)
+    session = VoiceSession(ws, request.remote, tls.session_reused if tls is not None else None)
 
     try:
         async for msg in ws:
             if msg.type in (aiohttp.WSMsgType.BINARY, aiohttp.WSMsgType.TEXT):
-                await session.handle_message(msg)
+                session = await session.handle_message(msg)
             elif msg.type == aiohttp.WSMsgType.ERROR:
                 logger.error(f"WS error: {ws.exception()}")
     except Exception as e:
         logger.error(f"WS handler error: {e}")
     finally:
+        session.detach(ws)
         logger.info("Client disconnected")
 
     return ws
 
 
+class UdpAudioProtocol(asyncio.DatagramProtocol):
+    """Only probes come in: header-only datagrams carrying an offered SSRC."""
+
+    def datagram_received(self, data: bytes, addr: tuple):
+        if len(data) < RTP_HEADER.size or data[0] & 0xC0 != 0x80:
+            return
+        ssrc = RTP_HEADER.unpack_from(data)[4]
+        session = UDP_STREAMS.get(ssrc)
+        if session is not None:
+            session.on_udp_probe(addr)
+
+
 async def main():
     app = web.Application()
     app.router.add_get('/ws', websocket_handler)
@@ -458,9 +955,23 @@ async def main():
 
     runner = web.AppRunner(app)
     await runner.setup()
-    site = web.TCPSite(runner, '0.0.0.0', WS_PORT)
+    ssl_ctx = None
+    if TLS_CERT and TLS_KEY:
+        ssl_ctx = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+        ssl_ctx.load_cert_chain(TLS_CERT, TLS_KEY)
+    site = web.TCPSite(runner, '0.0.0.0', WS_PORT, ssl_context=ssl_ctx)
     await site.start()
-    logger.info(f"WebSocket server listening on ws://0.0.0.0:{WS_PORT}")
+    logger.info(f"WebSocket server listening on {'wss' if ssl_ctx else 'ws'}://0.0.0.0:{WS_PORT}")
+    if UDP_AUDIO_PORT and ssl_ctx:
+        # Datagrams carry no TLS: offering them would send the wss:// downlink in the clear
+        logger.warning(f"UDP_AUDIO_PORT={UDP_AUDIO_PORT} ignored: UDP audio is cleartext and the "
+                       f"WebSocket is wss://; downlink stays on the WebSocket")
+    elif UDP_AUDIO_PORT:
+        global udp_transport
+        udp_transport, _ = await asyncio.get_running_loop().create_datagram_endpoint(
+            UdpAudioProtocol, local_addr=('0.0.0.0', UDP_AUDIO_PORT))
+        logger.info(f"UDP audio downlink on :{UDP_AUDIO_PORT}" +
+                    (f" (dropping {UDP_DROP:.0%} on purpose)" if UDP_DROP else ""))
     await asyncio.Event().wait()
 
 